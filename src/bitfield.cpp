@@ -0,0 +1,162 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bitfield.hpp"
+
+#include <string.h>
+#include <endian.h>
+#include <algorithm>
+
+namespace sbt {
+
+const size_t Bitfield::npos = static_cast<size_t>(-1);
+
+Bitfield::Bitfield()
+  : m_bytes(make_shared<Buffer>())
+  , m_size(0)
+{
+}
+
+Bitfield::Bitfield(size_t size)
+  : m_bytes(make_shared<Buffer>((size + 7) / 8))
+  , m_size(size)
+{
+}
+
+Bitfield::Bitfield(const uint8_t* bytes, size_t size)
+  : m_bytes(make_shared<Buffer>(bytes, (size + 7) / 8))
+  , m_size(size)
+{
+  // a peer might have set the spare bits
+  if (size % 8 != 0)
+    m_bytes->back() &= static_cast<uint8_t>(0xff00 >> size % 8);
+}
+
+uint64_t
+Bitfield::loadWord(size_t word) const
+{
+  uint64_t value = 0;
+  size_t offset = word * 8;
+  memcpy(&value, m_bytes->buf() + offset, std::min<size_t>(8, m_bytes->size() - offset));
+  return value;
+}
+
+void
+Bitfield::storeWord(size_t word, uint64_t value)
+{
+  size_t offset = word * 8;
+  memcpy(m_bytes->buf() + offset, &value, std::min<size_t>(8, m_bytes->size() - offset));
+}
+
+void
+Bitfield::detach()
+{
+  if (m_bytes.use_count() > 1)
+    m_bytes = make_shared<Buffer>(m_bytes->begin(), m_bytes->end());
+}
+
+void
+Bitfield::set(size_t index)
+{
+  if (index >= m_size)
+    throw std::out_of_range("Piece is out of the bitfield");
+
+  detach();
+  (*m_bytes)[index / 8] |= 0x80 >> index % 8;
+}
+
+void
+Bitfield::reset(size_t index)
+{
+  if (index >= m_size)
+    throw std::out_of_range("Piece is out of the bitfield");
+
+  detach();
+  (*m_bytes)[index / 8] &= ~(0x80 >> index % 8);
+}
+
+size_t
+Bitfield::count() const
+{
+  size_t n = 0;
+  for (size_t i = 0; i < getNumWords(); i++)
+    n += __builtin_popcountll(loadWord(i));
+
+  return n;
+}
+
+Bitfield&
+Bitfield::operator&=(const Bitfield& other)
+{
+  detach();
+
+  size_t common = std::min(getNumWords(), other.getNumWords());
+  for (size_t i = 0; i < common; i++)
+    storeWord(i, loadWord(i) & other.loadWord(i));
+
+  for (size_t i = common; i < getNumWords(); i++)
+    storeWord(i, 0);
+
+  return *this;
+}
+
+Bitfield&
+Bitfield::andNot(const Bitfield& other)
+{
+  detach();
+
+  size_t common = std::min(getNumWords(), other.getNumWords());
+  for (size_t i = 0; i < common; i++)
+    storeWord(i, loadWord(i) & ~other.loadWord(i));
+
+  return *this;
+}
+
+bool
+Bitfield::intersects(const Bitfield& other) const
+{
+  size_t common = std::min(getNumWords(), other.getNumWords());
+  for (size_t i = 0; i < common; i++) {
+    if ((loadWord(i) & other.loadWord(i)) != 0)
+      return true;
+  }
+
+  return false;
+}
+
+size_t
+Bitfield::findNext(size_t index) const
+{
+  if (index >= m_size)
+    return npos;
+
+  // in big-endian order the first piece of a word is its top bit
+  size_t i = index / 64;
+  uint64_t word = be64toh(loadWord(i)) & (~0ULL >> index % 64);
+
+  while (word == 0) {
+    if (++i == getNumWords())
+      return npos;
+    word = be64toh(loadWord(i));
+  }
+
+  return i * 64 + __builtin_clzll(word);
+}
+
+} // namespace sbt
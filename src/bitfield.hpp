@@ -0,0 +1,162 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_BITFIELD_HPP
+#define SBT_BITFIELD_HPP
+
+#include "common.hpp"
+#include "util/buffer.hpp"
+
+namespace sbt {
+
+/**
+ * @brief Set of pieces, stored as the bitfield sent on the wire
+ *
+ * Bit i is the (0x80 >> i % 8) bit of byte i / 8, and the spare bits of
+ * the last byte are always clear.  Set operations, counting and search
+ * go through the bytes 64 bits at a time.  The bytes are shared by
+ * copies of a bitfield and handed out by getBytes() for a bitfield
+ * message without copying, a bitfield copies them before it changes.
+ */
+class Bitfield
+{
+public:
+  static const size_t npos;
+
+public:
+  Bitfield();
+
+  /** @brief Creates a bitfield of @p size pieces, all clear
+   */
+  explicit
+  Bitfield(size_t size);
+
+  /** @brief Creates a bitfield of @p size pieces from their wire
+   *         encoding, which must be (@p size + 7) / 8 bytes long
+   */
+  Bitfield(const uint8_t* bytes, size_t size);
+
+  size_t
+  size() const
+  {
+    return m_size;
+  }
+
+  /** @return false if @p index is clear or not a piece of the bitfield
+   */
+  bool
+  test(size_t index) const
+  {
+    return index < m_size && ((*m_bytes)[index / 8] & (0x80 >> index % 8)) != 0;
+  }
+
+  bool
+  operator[](size_t index) const
+  {
+    return test(index);
+  }
+
+  /** @throws std::out_of_range if @p index is not a piece of the bitfield
+   */
+  void
+  set(size_t index);
+
+  /** @throws std::out_of_range if @p index is not a piece of the bitfield
+   */
+  void
+  reset(size_t index);
+
+  /** @return the number of set pieces
+   */
+  size_t
+  count() const;
+
+  bool
+  all() const
+  {
+    return count() == m_size;
+  }
+
+  bool
+  none() const
+  {
+    return findFirst() == npos;
+  }
+
+  /** @brief Keep only the pieces that are also set in @p other
+   */
+  Bitfield&
+  operator&=(const Bitfield& other);
+
+  /** @brief Clear the pieces that are set in @p other
+   */
+  Bitfield&
+  andNot(const Bitfield& other);
+
+  /** @return true if a piece is set in both this and @p other
+   */
+  bool
+  intersects(const Bitfield& other) const;
+
+  /** @return the first set piece, or npos if there is none
+   */
+  size_t
+  findFirst() const
+  {
+    return findNext(0);
+  }
+
+  /** @return the first set piece at or after @p index, or npos
+   */
+  size_t
+  findNext(size_t index) const;
+
+  /** @return the wire encoding, shared with this bitfield
+   */
+  ConstBufferPtr
+  getBytes() const
+  {
+    return m_bytes;
+  }
+
+private:
+  size_t
+  getNumWords() const
+  {
+    return (m_bytes->size() + 7) / 8;
+  }
+
+  // the last word may be short, it is padded with zeros
+  uint64_t
+  loadWord(size_t word) const;
+
+  void
+  storeWord(size_t word, uint64_t value);
+
+  void
+  detach();
+
+private:
+  BufferPtr m_bytes;
+  size_t m_size;
+};
+
+} // namespace sbt
+
+#endif // SBT_BITFIELD_HPP
@@ -0,0 +1,76 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "choker.hpp"
+
+#include <algorithm>
+#include <stdlib.h>
+
+namespace sbt {
+
+const time_t Choker::INTERVAL = 10;
+const size_t Choker::NUM_SLOTS = 4;
+const int Choker::OPTIMISTIC_ROUNDS = 3;
+
+Choker::Choker()
+  : m_numSlots(NUM_SLOTS)
+  , m_optimistic(-1)
+  , m_round(0)
+  , m_isRechokeNeeded(false)
+{
+}
+
+std::vector<int>
+Choker::rechoke(std::vector<Candidate> candidates, bool isNewRound)
+{
+  m_isRechokeNeeded = false;
+
+  // fastest first, equal rates keep their order
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [] (const Candidate& a, const Candidate& b) {
+                     return a.rate > b.rate;
+                   });
+
+  std::vector<int> unchoked;
+  size_t numRegular = std::min(m_numSlots, candidates.size());
+  for (size_t i = 0; i < numRegular; i++)
+    unchoked.push_back(candidates[i].id);
+
+  // the peers left over may be unchoked optimistically
+  std::vector<int> others;
+  for (size_t i = numRegular; i < candidates.size(); i++)
+    others.push_back(candidates[i].id);
+
+  bool isKept = std::find(others.begin(), others.end(), m_optimistic) != others.end();
+
+  if (isNewRound && ++m_round >= OPTIMISTIC_ROUNDS) {
+    m_round = 0;
+    isKept = false;
+  }
+
+  if (!isKept)
+    m_optimistic = others.empty() ? -1 : others[rand() % others.size()];
+
+  if (m_optimistic >= 0)
+    unchoked.push_back(m_optimistic);
+
+  return unchoked;
+}
+
+} // namespace sbt
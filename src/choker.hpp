@@ -0,0 +1,104 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_CHOKER_HPP
+#define SBT_CHOKER_HPP
+
+#include "common.hpp"
+
+#include <vector>
+
+namespace sbt {
+
+/**
+ * @brief Decides which interested peers we upload to
+ *
+ * Every round the interested peers are ranked by their rate (the rate
+ * they upload to us while downloading, the rate we upload to them when
+ * seeding) and the best ones get the regular unchoke slots, so peers
+ * that reciprocate get our bandwidth.  One more peer is unchoked
+ * optimistically, picked at random every OPTIMISTIC_ROUNDS rounds, to
+ * find better partners and to get new peers started.
+ *
+ * The choker only chooses, the client chokes and unchokes the peers.
+ */
+class Choker
+{
+public:
+  // seconds between two rounds
+  static const time_t INTERVAL;
+  static const size_t NUM_SLOTS;
+  static const int OPTIMISTIC_ROUNDS;
+
+  struct Candidate
+  {
+    int id;
+    double rate;
+  };
+
+public:
+  Choker();
+
+  void
+  setNumSlots(size_t numSlots)
+  {
+    m_numSlots = numSlots;
+  }
+
+  /** @brief Choose the peers to unchoke among the interested
+   *         @p candidates, identified by their id
+   *  @param isNewRound the rates are new, the optimistic unchoke may
+   *         move on.  Otherwise only the set of candidates changed
+   */
+  std::vector<int>
+  rechoke(std::vector<Candidate> candidates, bool isNewRound);
+
+  /** @return the id of the optimistically unchoked peer, -1 if none
+   */
+  int
+  getOptimistic() const
+  {
+    return m_optimistic;
+  }
+
+  /** @brief A peer became (not) interested or went away, rechoke
+   *         without waiting for the next round
+   */
+  void
+  requestRechoke()
+  {
+    m_isRechokeNeeded = true;
+  }
+
+  bool
+  isRechokeNeeded() const
+  {
+    return m_isRechokeNeeded;
+  }
+
+private:
+  size_t m_numSlots;
+  int m_optimistic;
+  int m_round;
+  bool m_isRechokeNeeded;
+};
+
+} // namespace sbt
+
+#endif // SBT_CHOKER_HPP
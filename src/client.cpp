@@ -30,6 +30,7 @@
 #include "msg/handshake.hpp"
 
 #include <fstream>
+#include <algorithm>
 #include <boost/tokenizer.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -48,37 +49,57 @@
 
 namespace sbt {
 
-bool Client::m_alarm = false;
-FILE *Client::m_torrentFile = NULL;
+volatile sig_atomic_t Client::m_isClosing = 0;
+EventLoop* Client::m_signalLoop = nullptr;
+
+const time_t Client::RESUME_INTERVAL = 30;
+const size_t Client::MAX_HALF_OPEN = 8;
+const time_t Client::CONNECT_INTERVAL = 1;
+// the address announced to the tracker
+const std::string Client::ANNOUNCE_IP = "127.0.0.1";
+// resume checks handed to each worker thread at a time
+const int Client::CHECKS_PER_THREAD = 2;
+// often enough for the limits to be smooth at block granularity
+const std::chrono::milliseconds Client::LIMITER_INTERVAL(100);
 
 Client::Client(const std::string& port, const std::string& torrent)
   : m_interval(3600)
   , m_isFirstReq(true)
-  , m_isFirstRes(true)
+  , m_lastRechoke(time(NULL))
+  , m_uploadLimiter(0)
+  , m_downloadLimiter(0)
+  , m_peerUploadLimit(0)
+  , m_peerDownloadLimit(0)
+  , m_limiterTimer(0)
+  , m_numHalfOpen(0)
+  , m_nextPeerId(0)
+  , m_numChecked(0)
+  , m_isChecking(false)
+  , m_nextCheck(0)
+  , m_hasCheckResume(false)
 {
   srand(time(NULL));
 
   m_clientPort = boost::lexical_cast<uint16_t>(port);
 
-  //initialize threads
-  pthread_mutex_init(&threadLock, NULL);
-  pthread_mutex_init(&pieceLock, NULL);
-  pthread_mutex_init(&pieceLock, NULL);
-  for (int i=0; i<MAX_THREAD; i++)
-    isUsed[i] = false;
-
-  //set signals to close file on termination
+  //set signals to flush file on termination
+  m_signalLoop = &m_loop;
   signal(SIGTERM, closeFile);
   signal(SIGINT, closeFile);
   signal(SIGQUIT, closeFile);
   signal(SIGKILL, closeFile);
   signal(SIGHUP, closeFile);
 
+  // the loop never waits on the workers, what it holds back while
+  // they are busy continues from here
+  m_workers.setReadyCallback([this] {
+    m_loop.post(std::bind(&Client::onWorkersReady, this));
+  });
+
   loadMetaInfo(torrent);
   std::cout << "loaded metainfo" << std::endl;
   prepareFile();
   std::cout << "prepared file!" << std::endl;
-  run();
 }
 
 void
@@ -90,89 +111,77 @@ Client::log(std::string msg)
 void
 Client::closeFile(int signo)
 {
-  log("closing file");
-  if (m_torrentFile) {
-    fclose(m_torrentFile);
-    m_torrentFile = NULL;
-  }
+  // the file is flushed and the resume data saved from the loop,
+  // which may be waiting on another thread than the one signalled
+  int savedErrno = errno;
+  m_isClosing = 1;
+  if (m_signalLoop != nullptr)
+    m_signalLoop->wakeUp();
+  errno = savedErrno;
   return;
 }
 
-void *
-Client::acceptPeers(void *c)
+// Sets up the listening socket and registers it with
+// the event loop, connections are accepted in acceptPeers()
+void
+Client::listenPeers()
 {
-  // since this is a static method, we 
-  // must recover the class instance
-  Client *client = static_cast<Client *>(c);
-
   log("Attempting to accept peers...");
 
   // create a TCP socket
-  client->m_listeningSock = socket(AF_INET, SOCK_STREAM, 0);
+  m_listeningSock = socket(AF_INET, SOCK_STREAM, 0);
 
   // allow others to reused address
   int yes =1;
-  if (setsockopt(client->m_listeningSock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
+  if (setsockopt(m_listeningSock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
     perror("setsockopt");
-    return NULL;
+    return;
   }
 
   // bind address to socket
   struct sockaddr_in addr;
   addr.sin_family = AF_INET;
-  addr.sin_port = htons(client->m_clientPort);
+  addr.sin_port = htons(m_clientPort);
   addr.sin_addr.s_addr = inet_addr("127.0.0.1"); 
   memset(addr.sin_zero, '\0', sizeof(addr.sin_zero));
-  if (bind(client->m_listeningSock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+  if (bind(m_listeningSock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
     perror("bind");
-    return NULL;
+    return;
   }
 
   // set the socket to listen
-  if (listen(client->m_listeningSock, 10) == -1) {
+  if (listen(m_listeningSock, SOMAXCONN) == -1) {
     perror("listen");
-    return NULL;
+    return;
   }
 
-  log("Listening on sock, waiting for connections...");
+  EventLoop::setNonBlocking(m_listeningSock);
+  m_loop.add(m_listeningSock, EPOLLIN, std::bind(&Client::acceptPeers, this));
 
-  std::vector<int> acceptedThreads = {};
+  log("Listening on sock, waiting for connections...");
+}
 
+// Accepts all pending connections (the listening socket
+// is edge triggered) and hands them to the event loop
+void
+Client::acceptPeers()
+{
   while (true) {
-
-    int threadId = -1;
-
-    // check if we have enough threads and grab one 
-    pthread_mutex_lock(&client->threadLock);
-    for (int i=0; i < client->MAX_THREAD; i++) {
-      if (!client->isUsed[i]) {
-        client->isUsed[i] = true;
-        threadId = i;
-        break;
-      }
-    }
-    pthread_mutex_unlock(&client->threadLock);
-
-    // if no threads are available now
-    if (threadId < 0) {
-      log("ran out of threads");
-      usleep(500000);
-      continue;
-    }
-
     // wait for a connection with accept()
     struct sockaddr_in clientAddr;
-    socklen_t clientAddrSize;
-    int clientSockfd = accept(client->m_listeningSock, (struct sockaddr*)&clientAddr, &clientAddrSize);
+    socklen_t clientAddrSize = sizeof(clientAddr);
+    int clientSockfd = accept(m_listeningSock, (struct sockaddr*)&clientAddr, &clientAddrSize);
 
     if (clientSockfd == -1) {
-      perror("accept");
-      return NULL;
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("accept");
+      return;
     }
 
     if (clientAddr.sin_family != AF_INET) {
       log("skipping address");
-      client->isUsed[threadId] = false;
       close(clientSockfd);
       continue;
     }
@@ -181,109 +190,91 @@ Client::acceptPeers(void *c)
     inet_ntop(clientAddr.sin_family, &clientAddr.sin_addr, ipstr, sizeof(ipstr));
     log("Accepted a connection from: " + std::string(ipstr) + ":" + std::to_string(ntohs(clientAddr.sin_port)));
 
+    // a peer closed in this iteration may still hold the endpoint
+    uint16_t port = ntohs(clientAddr.sin_port);
+    shared_ptr<Peer> existing = m_peers.find(ipstr, port);
+    if (existing && existing->getState() == Peer::STATE_CLOSED)
+      m_peers.erase(ipstr, port);
+
     // initialize a peer
-    Peer p(clientSockfd);
+    auto p = make_shared<Peer>(clientSockfd);
+    p->setIp(ipstr);
+    p->setPort(port);
+    p->setId(m_nextPeerId++);
+    p->setCloseCallback(std::bind(&Client::onPeerClosed, this, p->getIp(), p->getPort()));
 
     // pass references to the peers so that they can modify/access
     // piecesDone, the file, etc.
-    p.setClientData(&client->m_piecesDone, 
-                    &client->m_piecesLocked, 
-                    &client->m_metaInfo, 
-                    &client->m_peers,
-                    client->m_torrentFile,
-                    &client->pieceLock,
-                    &client->fileLock);
-
+    p->setClientData(&m_piecesDone, 
+                     &m_picker, 
+                     &m_partials,
+                     &m_metaInfo, 
+                     &m_peers,
+                     m_storage,
+                     &m_workers,
+                     &m_choker,
+                     &m_uploadLimiter,
+                     &m_downloadLimiter,
+                     &m_resume);
+    p->setRateLimits(m_peerUploadLimit, m_peerDownloadLimit);
+
+    // the registry owns the peer, a connection it does not take
+    // is refused before the loop refers to the peer
+    if (!m_peers.insert(ipstr, port, p)) {
+      log("refusing a second connection from: " + std::string(ipstr) + ":" + std::to_string(port));
+      close(clientSockfd);
+      continue;
+    }
 
     // run it
-    pthread_create(&client->threads[threadId], 0, (Client::runAcceptPeer), static_cast<void*>(&p));
-    acceptedThreads.push_back(threadId);
+    p->respondAndRun(m_loop);
   }
-
-  // wait on children threads to end
-  while (true) {
-    usleep(500000);
-  }
-  // for (int i : acceptedThreads) {
-  //   pthread_join(client->threads[i], NULL);
-  // }
-
-}
-
-// this function should be called from pthread_create
-// it runs a peer who initiates the handshake
-void * 
-Client::runHandshakePeer(void *peer)
-{
-  Peer *p = static_cast<Peer *>(peer); 
-  p->handshakeAndRun();
-
-  return NULL;
-}
-
-// this function should be called from pthread_create
-// it runs a peer who accepts the handshake
-void * 
-Client::runAcceptPeer(void *peer)
-{
-  Peer *p = static_cast<Peer *>(peer); 
-  p->respondAndRun();
-
-  return NULL;
 }
 
 void
-Client::alarmHandler(int sig)
+Client::setPeerRateLimits(uint64_t upload, uint64_t download)
 {
-  if (sig == SIGALRM) 
-    m_alarm = true;
+  m_peerUploadLimit = upload;
+  m_peerDownloadLimit = download;
 
-  return;
+  for (auto& peer : m_peers)
+    peer->setRateLimits(upload, download);
 }
 
+// Starts connecting to an idle peer, unless it is in its
+// backoff after failed attempts or there are MAX_HALF_OPEN
+// connection attempts in progress already
 int
 Client::addPeer(Peer *peer)
 {
-  if (peerRunning(peer->getPort())) {
+  if (peer->getState() != Peer::STATE_IDLE ||
+      !peer->isConnectDue(std::chrono::steady_clock::now())) {
     return -1;
   }
 
-  int threadId = -1;
-
-  // check if we have enough threads and grab one 
-  pthread_mutex_lock(&threadLock);
-  for (int i=0; i < MAX_THREAD; i++) {
-    if (!isUsed[i]) {
-      isUsed[i] = true;
-      threadId = i;
-      break;
-    }
-  }
-  pthread_mutex_unlock(&threadLock);
-
-  if (threadId < 0) {
-    log("Not enough threads to support peers");
+  if (m_numHalfOpen >= MAX_HALF_OPEN)
     return -1;
-  }
-
-  // iterator->first = key
-  // iterator->second = value
-  // Repeat if you also want to iterate through the second map.
 
   // pass references to the peers so that they can modify/access
   // piecesDone, the file, etc.
   peer->setClientData(&m_piecesDone, 
-                      &m_piecesLocked, 
+                      &m_picker, 
+                      &m_partials,
                       &m_metaInfo, 
                       &m_peers,
-                      m_torrentFile,
-                      &pieceLock,
-                      &fileLock);
+                      m_storage,
+                      &m_workers,
+                      &m_choker,
+                      &m_uploadLimiter,
+                      &m_downloadLimiter,
+                      &m_resume);
+  peer->setRateLimits(m_peerUploadLimit, m_peerDownloadLimit);
+
+  // start connecting, the peer is then driven by the event loop
+  peer->handshakeAndRun(m_loop);
 
-  // run a peer in a new thread
-  // log("starting peer " + peer->getPeerId());
-  m_portsRunning.push_back(peer->getPort());
-  pthread_create(&threads[threadId], NULL, (Client::runHandshakePeer), static_cast<void*>(peer));
+  if (peer->getState() == Peer::STATE_CONNECTING)
+    m_numHalfOpen++;
 
   return 0;
 }
@@ -295,46 +286,149 @@ Client::run()
   sendTrackerRequest();
   recvTrackerResponse();
 
-  // set the alarm to go off after m_interval seconds
-  alarm(m_interval);
-
-  // handle the alarm with this function
-  signal(SIGALRM, alarmHandler);
-
   // setup listening
-  isUsed[0] = true;
-  pthread_create(&threads[0], NULL, (Client::acceptPeers), static_cast<void*>(this));
+  listenPeers();
+
+  // everything that happens over time runs on the loop's timers
+  m_loop.schedule(std::chrono::seconds(m_interval), std::bind(&Client::onAnnounceTimer, this));
+  m_loop.schedule(std::chrono::seconds(Choker::INTERVAL), std::bind(&Client::onRechokeTimer, this));
+  m_loop.schedule(std::chrono::seconds(RESUME_INTERVAL), std::bind(&Client::onResumeTimer, this));
 
   // attempt connecting to all peers from the first request
+  onConnectTimer();
 
   while (true) {
 
-    for (auto& peer : m_peers) {
-      addPeer(&peer);
+    // sleep until a socket is ready, work is posted or a timer is due
+    m_loop.runOnce(-1);
+
+    if (m_isClosing) {
+      log("closing file");
+      saveResumeData();
+      m_isClosing = 0;
+    }
+    else if (m_resume.isDirty() && !m_isChecking && allPiecesDone()) {
+      saveResumeData();
+    }
+
+    if (m_choker.isRechokeNeeded())
+      rechoke(false);
+
+    // peers wait for bandwidth, hand it out as it comes in
+    if (m_limiterTimer == 0 &&
+        (m_uploadLimiter.getNumWaiting() > 0 || m_downloadLimiter.getNumWaiting() > 0)) {
+      m_limiterTimer = m_loop.schedule(LIMITER_INTERVAL, std::bind(&Client::onLimiterTimer, this));
     }
 
-    // if alarm went off
-    if (m_alarm) { 
-      connectTracker();
-      sendTrackerRequest();
-      recvTrackerResponse();
+    // give idle peers a chance to pick up the blocks released
+    // by peers that disconnected (or timed out)
+    if (m_picker.takeWorkReleased()) {
+      for (auto& peer : m_peers)
+        peer->run();
+    }
 
-      log("Sent/recieved tracker response. next interval: " + std::to_string(m_interval));
+    dropClosedPeers();
+  }
+}
 
-      // set the alarm to go off after m_interval seconds
-      alarm(m_interval);
+void
+Client::onPeerClosed(const std::string& ip, uint16_t port)
+{
+  m_closedPeers.push_back(std::make_pair(ip, port));
+}
 
-      // handle the alarm with this function
-      signal(SIGALRM, alarmHandler);
+// Removes the peers whose connection was closed from the registry,
+// once no handler of theirs is running. Work still in flight for
+// a peer keeps it alive until it is done, a peer the tracker still
+// lists is added again with its next response
+void
+Client::dropClosedPeers()
+{
+  for (const auto& endpoint : m_closedPeers) {
+    // the endpoint may have been taken by a new connection meanwhile
+    shared_ptr<Peer> peer = m_peers.find(endpoint.first, endpoint.second);
+    if (peer && peer->getState() == Peer::STATE_CLOSED)
+      m_peers.erase(endpoint.first, endpoint.second);
+  }
 
-      m_alarm = false;
-    }
+  m_closedPeers.clear();
+}
+
+// Re-announces to the tracker every interval it asks for, and
+// connects to the new peers right away
+void
+Client::onAnnounceTimer()
+{
+  connectTracker();
+  sendTrackerRequest();
+  recvTrackerResponse();
+
+  log("Sent/recieved tracker response. next interval: " + std::to_string(m_interval));
+
+  m_loop.schedule(std::chrono::seconds(m_interval), std::bind(&Client::onAnnounceTimer, this));
+
+  connectPeers();
+}
 
-    // sleep for 0.5 sec
-    usleep(500000);
+// Connects to the peers whose backoff is over
+void
+Client::onConnectTimer()
+{
+  connectPeers();
+
+  m_loop.schedule(std::chrono::seconds(CONNECT_INTERVAL), std::bind(&Client::onConnectTimer, this));
+}
+
+// Starts connecting to all the idle peers at once, up to the
+// cap on connects in progress
+void
+Client::connectPeers()
+{
+  m_numHalfOpen = 0;
+  for (auto& peer : m_peers) {
+    if (peer->getState() == Peer::STATE_CONNECTING)
+      m_numHalfOpen++;
+  }
+
+  for (auto& peer : m_peers) {
+    addPeer(peer.get());
   }
 }
 
+// A choke round, with the rates measured since the last one
+void
+Client::onRechokeTimer()
+{
+  time_t now = time(NULL);
+  for (auto& peer : m_peers)
+    peer->updateRates(now - m_lastRechoke);
+
+  rechoke(true);
+  m_lastRechoke = now;
+
+  m_loop.schedule(std::chrono::seconds(Choker::INTERVAL), std::bind(&Client::onRechokeTimer, this));
+}
+
+void
+Client::onResumeTimer()
+{
+  if (m_resume.isDirty() && !m_isChecking)
+    saveResumeData();
+
+  m_loop.schedule(std::chrono::seconds(RESUME_INTERVAL), std::bind(&Client::onResumeTimer, this));
+}
+
+// hands out the bandwidth that came in since, to the peers
+// waiting for it in turn
+void
+Client::onLimiterTimer()
+{
+  m_limiterTimer = 0;
+
+  m_uploadLimiter.tick();
+  m_downloadLimiter.tick();
+}
+
 void
 Client::loadMetaInfo(const std::string& torrent)
 {
@@ -400,6 +494,15 @@ Client::connectTracker()
     throw Error("Cannot connect tracker");
   }
 
+  // our address, as the tracker sees it unless there is a NAT
+  struct sockaddr_in localAddr;
+  socklen_t localAddrSize = sizeof(localAddr);
+  if (getsockname(m_trackerSock, (struct sockaddr*)&localAddr, &localAddrSize) == 0) {
+    char localIp[INET_ADDRSTRLEN] = {'\0'};
+    inet_ntop(AF_INET, &localAddr.sin_addr, localIp, sizeof(localIp));
+    m_clientIp = localIp;
+  }
+
   freeaddrinfo(res);
 }
 
@@ -408,20 +511,20 @@ Client::sendTrackerRequest()
 {
   TrackerRequestParam param;
 
-  int upload = m_metaInfo.getBytesUploaded();
-  int download = m_metaInfo.getBytesDownloaded();
-  int left = m_metaInfo.getBytesLeft(); 
+  uint64_t upload = m_metaInfo.getBytesUploaded();
+  uint64_t download = m_metaInfo.getBytesDownloaded();
+  uint64_t left = m_metaInfo.getBytesLeft();
 
   param.setInfoHash(m_metaInfo.getHash());
   param.setPeerId("SIMPLEBT.TEST.PEERID");
-  param.setIp("127.0.0.1"); 
+  param.setIp(ANNOUNCE_IP);
   param.setPort(m_clientPort); 
   param.setUploaded(upload);
   param.setDownloaded(download);
   param.setLeft(left); 
   if (m_isFirstReq)
     param.setEvent(TrackerRequestParam::STARTED);
-  if (left <= 0)
+  if (left == 0)
     param.setEvent(TrackerRequestParam::COMPLETED);
 
   // std::string path = m_trackerFile;
@@ -515,153 +618,267 @@ Client::recvTrackerResponse()
 
   bencoding::Dictionary dict;
 
-  std::stringstream tss;
-  tss.str(bodyOs.str());
-  dict.wireDecode(tss);
+  std::string body = bodyOs.str();
+  dict.wireDecode(reinterpret_cast<const uint8_t*>(body.data()), body.size());
 
   TrackerResponse trackerResponse;
   trackerResponse.decode(dict);
   std::vector<PeerInfo> infos = trackerResponse.getPeers();
   m_interval = trackerResponse.getInterval();
 
-  // if it's the first request, just add to the peer list
-  if (m_isFirstRes) {
-    for (const auto& peer : infos) {
-      // if it's the client, skip
-      if (peer.port == m_clientPort) 
-        continue;
-
-      Peer p(peer.peerId, peer.ip, peer.port);
-      m_peers.push_back(p);
-    }
-
-    m_isFirstRes = false;
-  }
-
-  else {
-
-    for (const auto& peer : infos) {
-      // if it's the client, skip
-      if (peer.port == m_clientPort) 
-        continue;
-
-      if (peerRunning(peer.port))
-        continue;
+  // add the peers we don't know yet to the peer list
+  for (const auto& peer : infos) {
+    // if it's the client, skip. The tracker lists us at the address
+    // we announce or the one we connected to it from
+    if (peer.port == m_clientPort &&
+        (peer.ip == ANNOUNCE_IP || peer.ip == m_clientIp))
+      continue;
 
-      Peer p(peer.peerId, peer.ip, peer.port);
+    if (m_peers.contains(peer.ip, peer.port))
+      continue;
 
-      m_peers.push_back(p);
-    }
+    auto p = make_shared<Peer>(peer.peerId, peer.ip, peer.port);
+    p->setId(m_nextPeerId++);
+    p->setCloseCallback(std::bind(&Client::onPeerClosed, this, p->getIp(), p->getPort()));
+    m_peers.insert(peer.ip, peer.port, p);
   }
-
 }
 
 // Prepares the destination data file
-// If it exists, this function scans it's bytes, compares it with the correct hashes
-// and determines how much of the file needs to be redownloaded.
+// If it exists and the resume data saved with it is up to date, the pieces done are
+// taken from the resume data. Otherwise, this function schedules a check of it's pieces
+// against the correct hashes on the worker pool, the pieces are marked done by
+// onPieceChecked() as they pass, so that the client can announce and serve them while
+// the rest are checked.
 // If it doesn't exist, this function creates the file
 
 void 
 Client::prepareFile()
 {
   std::string torrentFileName = m_metaInfo.getName();
-  int fileLength = m_metaInfo.getLength();
+  uint64_t fileLength = m_metaInfo.getLength();
   int pieceLength = m_metaInfo.getPieceLength();
   int pieceCount = m_metaInfo.getNumPieces(); 
-  int finalPieceLength = fileLength % pieceLength;
+  int finalPieceLength = static_cast<int>(fileLength % pieceLength);
   if (finalPieceLength == 0) finalPieceLength = pieceLength;
 
   // initialize all pieces to false
-  m_piecesDone = std::vector<bool>(pieceCount);
-  m_piecesLocked = std::vector<bool>(pieceCount);
-  for (int i=0; i<pieceCount; i++) {
-    m_piecesDone[i] = false;
-    m_piecesLocked[i] = false;
+  m_piecesDone = Bitfield(pieceCount);
+  m_picker.reset(pieceCount);
+
+  // open the file, it is created and allocated to the proper
+  // size if it doesn't exist or it's not the right length
+  m_storage = Storage::open(torrentFileName, fileLength);
+
+  uint64_t bytesLeft = fileLength;
+
+  m_resumeFileName = torrentFileName + ".resume";
+  m_resume.reset(m_metaInfo.getHash(), pieceCount);
+
+  if (!m_storage->hasExistingData()) {
+    log("bytes left: " + std::to_string(bytesLeft));
+    m_metaInfo.setBytesLeft(bytesLeft);
+    return;
   }
 
-  // open the file for reading 
-  m_torrentFile = (FILE*)malloc(sizeof(FILE));
-  m_torrentFile = fopen (torrentFileName.c_str(), "r");
+  ResumeData saved;
+  bool hasResume = saved.load(m_resumeFileName) &&
+                   equal(saved.getInfoHash(), m_metaInfo.getHash()) &&
+                   saved.getNumPieces() == pieceCount &&
+                   saved.getLength() == fileLength;
+
+  // the file is unchanged since the resume data was saved,
+  // trust it without reading the file
+  if (hasResume && saved.getMtime() == m_storage->getModificationTime()) {
+    for (int i=0; i<pieceCount; i++) {
+      if (!saved.hasPiece(i))
+        continue;
 
-  int bytesLeft = m_metaInfo.getLength();
+      m_piecesDone.set(i);
+      m_picker.setHave(i);
+      m_resume.setPiece(i, saved.getChecksum(i));
+      bytesLeft -= (i == pieceCount-1 ? finalPieceLength : pieceLength);
+    }
 
-  // if file exists 
-  if (m_torrentFile != NULL) {
-    fseek(m_torrentFile, 0, SEEK_END);
-    // and if it's the proper size
-    if (ftell(m_torrentFile) == fileLength) {
-      rewind(m_torrentFile);
+    log("resume data is up to date, bytes left: " + std::to_string(bytesLeft));
+    m_metaInfo.setBytesLeft(bytesLeft);
+    return;
+  }
 
-      char *pBuf = (char *)malloc(sizeof(char) * pieceLength);
-      uint64_t curPieceLength;
+  log("bytes left: " + std::to_string(bytesLeft));
+  m_metaInfo.setBytesLeft(bytesLeft);
 
-      for (int i=0; i<pieceCount; i++) {
+  // check which pieces are done. Every piece is read by a worker, the
+  // result goes back to the loop. The pieces done in the (stale) resume
+  // data pass if their CRC-32 still matches, others are hashed
+  log("checking " + std::to_string(pieceCount) + " pieces on " +
+      std::to_string(m_workers.getNumThreads()) + " threads" +
+      (hasResume ? " against the resume data" : ""));
 
-        curPieceLength = (i == pieceCount-1 ? finalPieceLength : pieceLength);
+  m_isChecking = true;
+  for (int i=0; i<pieceCount; i++)
+    m_picker.setChecking(i);
 
-        fseek(m_torrentFile, i * m_metaInfo.getPieceLength(), SEEK_SET);
-        if (fread(pBuf, 1, curPieceLength, m_torrentFile) != curPieceLength) {
-          log("fread error");
-          return;
-        }
+  m_checkResume = saved;
+  m_hasCheckResume = hasResume;
+  checkPieces();
+}
 
-        ConstBufferPtr pieceBuf = std::make_shared<const Buffer> (pBuf, curPieceLength);
+// Hands the next pieces of the resume check to the workers, as many
+// as keep them busy. Called again as the results come in
+void
+Client::checkPieces()
+{
+  int pieceLength = m_metaInfo.getPieceLength();
+  int pieceCount = m_metaInfo.getNumPieces();
+  int finalPieceLength = static_cast<int>(m_metaInfo.getLength() -
+                                          static_cast<uint64_t>(pieceCount - 1) * pieceLength);
+  int maxInFlight = CHECKS_PER_THREAD * m_workers.getNumThreads();
+  shared_ptr<Storage> storage = m_storage;
+
+  for (; m_nextCheck < pieceCount && m_nextCheck - m_numChecked < maxInFlight; m_nextCheck++) {
+    int i = m_nextCheck;
+    uint32_t curPieceLength = (i == pieceCount-1 ? finalPieceLength : pieceLength);
+    uint64_t offset = static_cast<uint64_t>(i) * pieceLength;
+    BufferView hash = m_metaInfo.getPieceHash(i);
+    bool hasChecksum = m_hasCheckResume && m_checkResume.hasPiece(i);
+    uint32_t savedChecksum = hasChecksum ? m_checkResume.getChecksum(i) : 0;
+
+    bool isPosted = m_workers.tryPost([=] {
+      BufferPtr pieceBuf = make_shared<Buffer>(curPieceLength);
+      bool isRead = storage->read(offset, pieceBuf->buf(), curPieceLength);
+      uint32_t checksum = ResumeData::checksum(pieceBuf->buf(), curPieceLength);
+
+      bool isDone = isRead &&
+                    ((hasChecksum && checksum == savedChecksum) ||
+                     equal(util::sha1(pieceBuf), hash));
+
+      m_loop.post(std::bind(&Client::onPieceChecked, this, i, curPieceLength,
+                            isDone, checksum));
+    });
+
+    // the peers keep the workers busy, continued from onWorkersReady()
+    if (!isPosted)
+      break;
+  }
+}
 
-        if (equal(util::sha1(pieceBuf), m_metaInfo.getHashOfPiece(i))) {
-          m_piecesDone[i] = true;
-          m_piecesLocked[i] = true;
-          bytesLeft -= curPieceLength;
-        } else {
-          m_piecesDone[i] = false;
-          m_piecesLocked[i] = false;
-        }
-      }
+// Called on the loop thread once the worker queue has room again
+// after it was found full
+void
+Client::onWorkersReady()
+{
+  if (m_isChecking)
+    checkPieces();
 
-      log("bytes left: " + std::to_string(bytesLeft));
-      m_metaInfo.setBytesLeft(bytesLeft);
-      fseek(m_torrentFile, 0, SEEK_SET);
+  for (auto& peer : m_peers)
+    peer->onWorkersReady();
+}
 
-      return;
-    } 
+// Called on the loop thread with the result of a piece's resume
+// check. A done piece is announced to the connected peers, others
+// become available for downloading
+void
+Client::onPieceChecked(int index, uint32_t length, bool isDone, uint32_t checksum)
+{
+  if (isDone) {
+    m_piecesDone.set(index);
+    m_picker.setHave(index);
+    m_resume.setPiece(index, checksum);
+  }
+  else {
+    m_picker.release(index);
   }
 
-  // file doesn't exist or it's not the right length
-  // create and allocate to proper size 
-  m_torrentFile = fopen(torrentFileName.c_str(), "w+");
-  fseek(m_torrentFile, fileLength-1, SEEK_SET);
-  fputc(0, m_torrentFile);
+  if (isDone) {
+    m_metaInfo.setBytesLeft(m_metaInfo.getBytesLeft() - length);
 
-  log("bytes left: " + std::to_string(bytesLeft));
-  m_metaInfo.setBytesLeft(bytesLeft);
+    for (auto& peer : m_peers) {
+      if (peer->getState() == Peer::STATE_RUNNING)
+        peer->sendHave(index);
+    }
+  }
+
+  // report progress every 10%
+  int pieceCount = m_metaInfo.getNumPieces();
+  m_numChecked++;
+  if (m_numChecked * 10 / pieceCount != (m_numChecked - 1) * 10 / pieceCount) {
+    log("checked " + std::to_string(m_numChecked) + "/" +
+        std::to_string(pieceCount) + " pieces");
+  }
+
+  if (m_numChecked == pieceCount) {
+    log("check done, bytes left: " + std::to_string(m_metaInfo.getBytesLeft()));
+
+    m_isChecking = false;
+    m_checkResume = ResumeData();
+    saveResumeData();
+  }
+  else {
+    checkPieces();
+  }
 
   return;
+}
+
+// Flushes the file and saves which pieces are done in the
+// resume file next to it, together with the file's mtime
+void
+Client::saveResumeData()
+{
+  m_storage->sync();
+
+  // pieces still being checked would be saved as missing
+  if (m_isChecking)
+    return;
+
+  m_resume.setFileInfo(m_storage->getLength(), m_storage->getModificationTime());
+  if (!m_resume.save(m_resumeFileName))
+    log("could not save resume data");
 } 
 
-bool
-Client::allPiecesDone()
+// Unchokes the peers the choker chooses among the interested
+// ones, and chokes the others. Leechers are ranked by how fast
+// they upload to us, once we seed by how fast they download
+void
+Client::rechoke(bool isNewRound)
 {
-  for (int i=0; i<m_metaInfo.getNumPieces(); i++) 
-  {
-    if (!m_piecesDone.at(i))
-      return false;
+  bool isSeeding = allPiecesDone();
+
+  // the candidates are identified by the ids of the peers, which
+  // stay the same from round to round (e.g., for the optimistic
+  // unchoke) while peers come and go
+  std::vector<Peer*> running;
+  std::vector<Choker::Candidate> candidates;
+  for (auto& peer : m_peers) {
+    if (peer->getState() != Peer::STATE_RUNNING)
+      continue;
+
+    running.push_back(peer.get());
+    if (!peer->isPeerInterested())
+      continue;
+
+    Choker::Candidate candidate;
+    candidate.id = peer->getId();
+    candidate.rate = isSeeding ? peer->getUploadRate() : peer->getDownloadRate();
+    candidates.push_back(candidate);
   }
 
-  return true;
+  std::vector<int> unchoked = m_choker.rechoke(candidates, isNewRound);
+  std::sort(unchoked.begin(), unchoked.end());
+
+  for (Peer* peer : running) {
+    if (std::binary_search(unchoked.begin(), unchoked.end(), peer->getId()))
+      peer->unchoke();
+    else
+      peer->choke();
+  }
 }
 
 bool
-Client::peerRunning(uint16_t port)
+Client::allPiecesDone()
 {
-  for (std::vector<uint16_t>::iterator it = m_portsRunning.begin();
-       it != m_portsRunning.end();
-       it++)
-  {
-    if (port == *it) {
-      return true;
-    }
-  }
-
-  return false;
+  return m_picker.isComplete();
 }
 
 } // namespace sbt
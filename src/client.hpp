@@ -23,10 +23,20 @@
 #define SBT_CLIENT_HPP
 
 #include <pthread.h>
+#include <signal.h>
 #include "common.hpp"
 #include "meta-info.hpp"
 #include "tracker-response.hpp"
 #include "peer.hpp"
+#include "event-loop.hpp"
+#include "piece-picker.hpp"
+#include "bitfield.hpp"
+#include "storage.hpp"
+#include "worker-pool.hpp"
+#include "choker.hpp"
+#include "rate-limiter.hpp"
+#include "resume-data.hpp"
+#include "peer-registry.hpp"
 
 namespace sbt {
 
@@ -44,12 +54,31 @@ public:
   };
 
 public:
+  /** @brief Load the torrent and check the file, the transfer starts
+   *         with run(), after the limits are set
+   */
   Client(const std::string& port,
          const std::string& torrent);
 
   void
   run();
 
+  /** @brief Cap the rates of all peers together, in bytes/s, 0 for
+   *         unlimited
+   */
+  void
+  setRateLimits(uint64_t upload, uint64_t download)
+  {
+    m_uploadLimiter.setRate(upload);
+    m_downloadLimiter.setRate(download);
+  }
+
+  /** @brief Cap the rates of every single peer, in bytes/s, 0 for
+   *         unlimited
+   */
+  void
+  setPeerRateLimits(uint64_t upload, uint64_t download);
+
   const std::string&
   getTrackerHost() {
     return m_trackerHost;
@@ -78,26 +107,59 @@ private:
   void
   recvTrackerResponse();
 
+  void
+  connectPeers();
+
+  void
+  onAnnounceTimer();
+
+  void
+  onConnectTimer();
+
+  void
+  onRechokeTimer();
+
+  void
+  onResumeTimer();
+
+  void
+  onLimiterTimer();
+
+  void
+  onPeerClosed(const std::string& ip, uint16_t port);
+
+  void
+  dropClosedPeers();
+
   void 
   prepareFile();
 
+  void
+  checkPieces();
+
+  void
+  onWorkersReady();
+
+  void
+  onPieceChecked(int index, uint32_t length, bool isDone, uint32_t checksum);
+
+  void
+  saveResumeData();
+
+  void
+  rechoke(bool isNewRound);
+
   static void
   log(std::string msg);
 
-  static void 
-  alarmHandler(int sig);
-
   static void
   closeFile(int sig);
 
-  static void * 
-  runHandshakePeer(void *peer);
-
-  static void * 
-  runAcceptPeer(void *peer);
+  void
+  listenPeers();
 
-  static void *
-  acceptPeers(void *c);
+  void
+  acceptPeers();
 
   bool
   allPiecesDone();
@@ -105,9 +167,6 @@ private:
   int
   addPeer(Peer *peer);
 
-  bool
-  peerRunning(uint16_t port);
-
 private:
   MetaInfo m_metaInfo;
   std::string m_trackerHost;
@@ -115,32 +174,82 @@ private:
   std::string m_trackerFile;
 
   uint16_t m_clientPort;
+  std::string m_clientIp;
+  static const std::string ANNOUNCE_IP;
 
   int m_trackerSock;
   int m_listeningSock;
 
   uint64_t m_interval;
   bool m_isFirstReq;
-  bool m_isFirstRes;
-
-  std::vector<bool> m_piecesDone;
-  std::vector<bool> m_piecesLocked;
-
-  // list of peers (from tracker)
-  std::vector<Peer> m_peers;
-  std::vector<uint16_t> m_portsRunning;
-
-  pthread_t threads[20];
-  static const int MAX_THREAD = 20;
-  bool isUsed[20] = {0};
-
-  pthread_mutex_t threadLock;
-  pthread_mutex_t pieceLock;
-  pthread_mutex_t fileLock;
 
-  // for alarm functionality
-  static bool m_alarm;
-  static FILE *m_torrentFile;
+  Bitfield m_piecesDone;
+
+  // picks pieces to download for all the peers
+  PiecePicker m_picker;
+
+  // the pieces being downloaded, shared so that in endgame
+  // several peers can work on the same blocks
+  PartialPieceMap m_partials;
+
+  // peers (from tracker, and accepted ones) by endpoint, heap
+  // allocated so that the event loop handlers can keep pointers
+  // to them. Closed peers are dropped by dropClosedPeers()
+  PeerRegistry m_peers;
+  std::vector<std::pair<std::string, uint16_t>> m_closedPeers;
+
+  // chooses the peers we upload to, every Choker::INTERVAL
+  // seconds or when the interested peers change
+  Choker m_choker;
+  time_t m_lastRechoke;
+
+  // bandwidth shared by all the peers, handed out on the loop
+  // thread every LIMITER_INTERVAL while peers wait for it, and
+  // the limits of each peer
+  RateLimiter m_uploadLimiter;
+  RateLimiter m_downloadLimiter;
+  uint64_t m_peerUploadLimit;
+  uint64_t m_peerDownloadLimit;
+  EventLoop::TimerId m_limiterTimer;
+  static const std::chrono::milliseconds LIMITER_INTERVAL;
+
+  // outgoing connects in progress, at most MAX_HALF_OPEN, new
+  // ones are started every CONNECT_INTERVAL
+  size_t m_numHalfOpen;
+  static const size_t MAX_HALF_OPEN;
+  static const time_t CONNECT_INTERVAL;
+
+  // the id of the next peer, ids are not reused
+  int m_nextPeerId;
+
+  // drives every peer socket
+  EventLoop m_loop;
+
+  // runs the resume check off the loop thread, declared after
+  // m_loop so that pending tasks finish before the loop goes away
+  WorkerPool m_workers;
+  int m_numChecked;
+  bool m_isChecking;
+
+  // the pieces are checked in order, m_nextCheck is the next one to
+  // hand to the workers. A few are in flight per thread, so the check
+  // never fills the queue. m_checkResume is the stale resume data
+  int m_nextCheck;
+  ResumeData m_checkResume;
+  bool m_hasCheckResume;
+  static const int CHECKS_PER_THREAD;
+
+  shared_ptr<Storage> m_storage;
+
+  // pieces done, saved to m_resumeFileName every RESUME_INTERVAL
+  // seconds and on termination
+  ResumeData m_resume;
+  std::string m_resumeFileName;
+  static const time_t RESUME_INTERVAL;
+
+  // set on termination signals, which wake up the loop
+  static volatile sig_atomic_t m_isClosing;
+  static EventLoop* m_signalLoop;
 };
 
 } // namespace sbt
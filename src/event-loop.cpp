@@ -0,0 +1,181 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "event-loop.hpp"
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+
+namespace sbt {
+
+EventLoop::EventLoop()
+  : m_generation(0)
+{
+  m_epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epfd == -1)
+    throw Error("Cannot create epoll instance");
+
+  m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_eventFd == -1) {
+    close(m_epfd);
+    throw Error("Cannot create eventfd");
+  }
+
+  pthread_mutex_init(&m_postLock, NULL);
+  add(m_eventFd, EPOLLIN, std::bind(&EventLoop::runPosted, this));
+}
+
+EventLoop::~EventLoop()
+{
+  pthread_mutex_destroy(&m_postLock);
+  close(m_eventFd);
+  close(m_epfd);
+}
+
+void
+EventLoop::add(int fd, uint32_t events, const Handler& handler)
+{
+  Entry& entry = m_handlers[fd];
+  entry.generation = ++m_generation;
+  entry.handler = make_shared<Handler>(handler);
+
+  // tag the event with a generation so that a stale event for a closed
+  // (and possibly reused) fd in the same batch is not misdelivered
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events | EPOLLET;
+  ev.data.u64 = (static_cast<uint64_t>(entry.generation) << 32) | static_cast<uint32_t>(fd);
+
+  if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    m_handlers.erase(fd);
+    perror("epoll_ctl");
+    throw Error("Cannot watch socket");
+  }
+}
+
+void
+EventLoop::remove(int fd)
+{
+  if (m_handlers.erase(fd) > 0)
+    epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int
+EventLoop::runOnce(int timeoutMs)
+{
+  struct epoll_event events[MAX_EVENTS];
+
+  // deferred between two iterations, e.g., by the client
+  runDeferred();
+
+  // wake up for the next timer
+  int timerTimeout = m_timers.getTimeout();
+  if (timerTimeout >= 0 && (timeoutMs < 0 || timerTimeout < timeoutMs))
+    timeoutMs = timerTimeout;
+
+  int n = epoll_wait(m_epfd, events, MAX_EVENTS, timeoutMs);
+  if (n == -1) {
+    // interrupted by a signal (e.g., the tracker alarm)
+    if (errno == EINTR)
+      return 0;
+    perror("epoll_wait");
+    throw Error("epoll_wait failed");
+  }
+
+  for (int i = 0; i < n; i++) {
+    int fd = static_cast<int>(events[i].data.u64 & 0xffffffff);
+    uint32_t generation = static_cast<uint32_t>(events[i].data.u64 >> 32);
+
+    auto it = m_handlers.find(fd);
+    if (it == m_handlers.end() || it->second.generation != generation)
+      continue;
+
+    // hold on to the handler, it may remove itself while running
+    shared_ptr<Handler> handler = it->second.handler;
+    (*handler)(events[i].events);
+  }
+
+  m_timers.advance();
+  runDeferred();
+
+  return n;
+}
+
+void
+EventLoop::post(const Callback& callback)
+{
+  pthread_mutex_lock(&m_postLock);
+  m_posted.push_back(callback);
+  pthread_mutex_unlock(&m_postLock);
+
+  uint64_t one = 1;
+  if (write(m_eventFd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    perror("write eventfd");
+}
+
+void
+EventLoop::wakeUp()
+{
+  // only async-signal-safe calls, a counter that is full already
+  // wakes the loop up just as well
+  uint64_t one = 1;
+  ssize_t n = write(m_eventFd, &one, sizeof(one));
+  (void)n;
+}
+
+void
+EventLoop::runPosted()
+{
+  uint64_t count;
+  while (read(m_eventFd, &count, sizeof(count)) > 0)
+    ;
+
+  std::deque<Callback> posted;
+  pthread_mutex_lock(&m_postLock);
+  posted.swap(m_posted);
+  pthread_mutex_unlock(&m_postLock);
+
+  for (const auto& callback : posted)
+    callback();
+}
+
+void
+EventLoop::runDeferred()
+{
+  // callbacks may defer more work, which runs right away too
+  while (!m_deferred.empty()) {
+    Callback callback = m_deferred.front();
+    m_deferred.pop_front();
+    callback();
+  }
+}
+
+void
+EventLoop::setNonBlocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    perror("fcntl");
+    throw Error("Cannot set socket non-blocking");
+  }
+}
+
+} // namespace sbt
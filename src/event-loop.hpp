@@ -0,0 +1,162 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_EVENT_LOOP_HPP
+#define SBT_EVENT_LOOP_HPP
+
+#include "common.hpp"
+#include "timer-wheel.hpp"
+#include <map>
+#include <deque>
+
+#include <sys/epoll.h>
+#include <pthread.h>
+
+namespace sbt {
+
+/**
+ * @brief Single-threaded epoll reactor
+ *
+ * Every socket (listening, outgoing and accepted peers) is registered
+ * edge-triggered together with a handler, which is invoked with the
+ * ready event mask.  Handlers are expected to drain the socket until
+ * EAGAIN, since an edge is only reported once.
+ *
+ * Other threads hand work to the loop thread with post(), which wakes
+ * the loop up through an eventfd.  Work the loop thread itself wants
+ * done once the events at hand are handled (e.g., sending the messages
+ * queued meanwhile) is deferred with defer().  Timeouts and periodic
+ * work are scheduled on a timer wheel, the loop sleeps until the next
+ * timer is due.
+ */
+class EventLoop
+{
+public:
+  class Error : public std::runtime_error
+  {
+  public:
+    explicit
+    Error(const std::string& what)
+      : std::runtime_error(what)
+    {
+    }
+  };
+
+  typedef function<void(uint32_t events)> Handler;
+  typedef function<void()> Callback;
+  typedef TimerWheel::TimerId TimerId;
+
+public:
+  EventLoop();
+
+  ~EventLoop();
+
+  /** @brief Start watching @p fd for @p events (EPOLLET is always added)
+   */
+  void
+  add(int fd, uint32_t events, const Handler& handler);
+
+  /** @brief Stop watching @p fd, must be called before the fd is closed
+   *
+   *  It is safe to call from within a handler, pending events for
+   *  @p fd in the current batch are dropped.
+   */
+  void
+  remove(int fd);
+
+  /** @brief Wait at most @p timeoutMs (-1 for as long as it takes)
+   *         for events or a timer and dispatch them.  The deferred
+   *         callbacks run before waiting and after the dispatch
+   *  @return number of dispatched events
+   */
+  int
+  runOnce(int timeoutMs);
+
+  /** @brief Run @p callback on the loop thread, from any thread
+   */
+  void
+  post(const Callback& callback);
+
+  /** @brief Wake the loop up from waiting, also from a signal handler
+   */
+  void
+  wakeUp();
+
+  /** @brief Run @p callback at the end of this iteration, from the
+   *         loop thread only
+   */
+  void
+  defer(const Callback& callback)
+  {
+    m_deferred.push_back(callback);
+  }
+
+  /** @brief Run @p callback on the loop thread once @p delay has
+   *         passed, from the loop thread only
+   */
+  TimerId
+  schedule(TimerWheel::Clock::duration delay, const Callback& callback)
+  {
+    return m_timers.schedule(delay, callback);
+  }
+
+  /** @brief Cancel a timer, ids of timers that ran are ignored
+   */
+  void
+  cancel(TimerId id)
+  {
+    m_timers.cancel(id);
+  }
+
+  static void
+  setNonBlocking(int fd);
+
+private:
+  void
+  runPosted();
+
+  void
+  runDeferred();
+
+private:
+  struct Entry
+  {
+    uint32_t generation;
+    shared_ptr<Handler> handler;
+  };
+
+  static const int MAX_EVENTS = 64;
+
+  int m_epfd;
+  uint32_t m_generation;
+  std::map<int, Entry> m_handlers;
+
+  // callbacks posted from other threads, guarded by m_postLock
+  int m_eventFd;
+  std::deque<Callback> m_posted;
+
+  std::deque<Callback> m_deferred;
+  pthread_mutex_t m_postLock;
+
+  TimerWheel m_timers;
+};
+
+} // namespace sbt
+
+#endif // SBT_EVENT_LOOP_HPP
@@ -21,20 +21,34 @@
 
 #include "client.hpp"
 
+#include <boost/lexical_cast.hpp>
+
 int
 main(int argc, char** argv)
 {
   try
   {
     // Check command line arguments.
-    if (argc != 3)
+    if (argc != 3 && argc != 5 && argc != 7)
     {
-      std::cerr << "Usage: simple-bt <port> <torrent_file>\n";
+      std::cerr << "Usage: simple-bt <port> <torrent_file> "
+                << "[<upload_limit> <download_limit> "
+                << "[<peer_upload_limit> <peer_download_limit>]]\n"
+                << "  limits in KiB/s, 0 for unlimited, the peer limits\n"
+                << "  apply to every single peer\n";
       return 1;
     }
 
+    uint64_t limits[4] = {0, 0, 0, 0};
+    for (int i = 3; i < argc; i++)
+      limits[i - 3] = boost::lexical_cast<uint64_t>(argv[i]) * 1024;
+
     // Initialise the client.
     sbt::Client client(argv[1], argv[2]);
+    client.setRateLimits(limits[0], limits[1]);
+    client.setPeerRateLimits(limits[2], limits[3]);
+
+    client.run();
   }
   catch (std::exception& e)
   {
@@ -23,6 +23,8 @@
 #include "util/buffer-stream.hpp"
 #include "util/hash.hpp"
 
+#include <iterator>
+
 using std::string;
 using std::make_shared;
 using std::dynamic_pointer_cast;
@@ -81,9 +83,11 @@ MetaInfo::MetaInfo()
   : m_info(new bencoding::Dictionary)
 {
   m_root.insert(INFO, m_info);
+  updateFields();
 
   bytesUploaded = 0;
   bytesDownloaded = 0;
+  bytesLeft = 0;
 }
 
 void
@@ -95,19 +99,43 @@ MetaInfo::wireEncode(std::ostream& os) const
 void
 MetaInfo::wireDecode(std::istream& is)
 {
-  m_root = bencoding::Dictionary();
-  m_root.wireDecode(is);
+  std::string encoded((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+  wireDecode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size());
+}
 
-  if (static_cast<bool>(m_root.get(INFO))) {
-    m_info = dynamic_pointer_cast<bencoding::Dictionary>(m_root.get(INFO));
-  }
-  else {
-    m_root = bencoding::Dictionary();
+void
+MetaInfo::wireDecode(const uint8_t* data, size_t size)
+{
+  bencoding::Tape tape;
+  tape.parse(data, size);
+
+  bencoding::Value root = tape.getRoot();
+  if (root.getType() != bencoding::TYPE_DICTIONARY)
+    throw bencoding::Error("meta-info is not a dictionary");
+
+  bencoding::Value info = root.get(INFO);
+  if (!info || info.getType() != bencoding::TYPE_DICTIONARY)
     throw bencoding::Error("no info in meta-info");
-  }
+
+  m_root = bencoding::Dictionary();
+  m_root.decode(root);
+  m_info = dynamic_pointer_cast<bencoding::Dictionary>(m_root.get(INFO));
+
+  updateFields();
+
+  // hash the info dictionary as it is in the file, encoding it
+  // again may not give the same bytes (e.g., unsorted keys)
+  util::Sha1 hash;
+  hash.update(info.getRawData(), info.getRawSize());
+  m_infoHash = hash.finalize();
+
+  if (m_pieces->size() % 20 != 0 ||
+      m_pieces->size() < static_cast<size_t>(m_numPieces) * 20)
+    throw bencoding::Error("pieces do not match the length in meta-info");
 
   bytesUploaded = 0;
   bytesDownloaded = 0;
+  bytesLeft = 0;
 }
 
 void
@@ -132,53 +160,21 @@ void
 MetaInfo::setName(const std::string& name)
 {
   m_info->insert(NAME, make_shared<bencoding::String>(name));
-}
-
-std::string
-MetaInfo::getName()
-{
-  auto i = m_info->get(NAME);
-
-  if (static_cast<bool>(i)) {
-    return dynamic_pointer_cast<bencoding::String>(i)->toString();
-  }
-  else
-    return string();
+  updateFields();
 }
 
 void
 MetaInfo::setPieceLength(int64_t length)
 {
   m_info->insert(PIECE_LENGTH, make_shared<bencoding::Integer>(length));
-}
-
-int64_t
-MetaInfo::getPieceLength()
-{
-  auto i = m_info->get(PIECE_LENGTH);
-
-  if (static_cast<bool>(i)) {
-    return dynamic_pointer_cast<bencoding::Integer>(i)->getValue();
-  }
-  else
-    return -1;
+  updateFields();
 }
 
 void
 MetaInfo::setPieces(const std::vector<uint8_t> pieces)
 {
-  m_info->insert(PIECES, make_shared<bencoding::String>(&pieces.front(), pieces.size()));
-}
-
-std::vector<uint8_t>
-MetaInfo::getPieces()
-{
-  auto i = m_info->get(PIECES);
-
-  if (static_cast<bool>(i))
-    return dynamic_pointer_cast<bencoding::String>(i)->getValue();
-  else
-    return std::vector<uint8_t>();
+  m_info->insert(PIECES, make_shared<bencoding::String>(pieces.data(), pieces.size()));
+  updateFields();
 }
 
 void
@@ -187,17 +183,7 @@ MetaInfo::setLength(int64_t length)
   m_info->erase(FILES);
 
   m_info->insert(LENGTH, make_shared<bencoding::Integer>(length));
-}
-
-int64_t
-MetaInfo::getLength()
-{
-  auto i = m_info->get(LENGTH);
-
-  if (static_cast<bool>(i))
-    return dynamic_pointer_cast<bencoding::Integer>(i)->getValue();
-  else
-    return -1;
+  updateFields();
 }
 
 void
@@ -213,6 +199,7 @@ MetaInfo::addFile(const MetaInfo::File file)
   }
 
   dynamic_pointer_cast<bencoding::List>(i)->append(file.encode());
+  updateFields();
 }
 
 std::vector<MetaInfo::File>
@@ -236,27 +223,47 @@ MetaInfo::getFiles()
 ConstBufferPtr
 MetaInfo::getHash()
 {
-  OBufferStream os;
-
-  m_info->wireEncode(os);
+  if (!m_infoHash) {
+    OBufferStream os;
+    m_info->wireEncode(os);
+    m_infoHash = util::sha1(os.buf());
+  }
 
-  return util::sha1(os.buf());
+  return m_infoHash;
 }
 
-std::vector<uint8_t>
-MetaInfo::getHashOfPiece(int index)
+void
+MetaInfo::updateFields()
 {
-  if (index >= getNumPieces()) 
-  {
-    std::cout << "Error: requested out of index piece" << std::endl;
-    return std::vector<uint8_t>();
+  auto name = m_info->get(NAME);
+  auto pieceLength = m_info->get(PIECE_LENGTH);
+  auto length = m_info->get(LENGTH);
+  auto pieces = m_info->get(PIECES);
+
+  if ((name && name->getType() != bencoding::TYPE_STRING) ||
+      (pieceLength && pieceLength->getType() != bencoding::TYPE_INTEGER) ||
+      (length && length->getType() != bencoding::TYPE_INTEGER) ||
+      (pieces && pieces->getType() != bencoding::TYPE_STRING))
+    throw bencoding::Error("bad field type in meta-info");
+
+  m_name = name ? dynamic_pointer_cast<bencoding::String>(name)->toString() : string();
+  m_pieceLength = pieceLength ? dynamic_pointer_cast<bencoding::Integer>(pieceLength)->getValue() : -1;
+  m_length = length ? dynamic_pointer_cast<bencoding::Integer>(length)->getValue() : -1;
+
+  if (pieces) {
+    const auto& value = dynamic_pointer_cast<bencoding::String>(pieces)->getValue();
+    m_pieces = make_shared<Buffer>(value.begin(), value.end());
   }
+  else
+    m_pieces = make_shared<Buffer>();
 
-  std::vector<uint8_t> chunkHash;
-  for (int i = 0; i < 20; i++)
-    chunkHash.push_back(getPieces().at(index*20+i));
+  if (m_length >= 0 && m_pieceLength > 0)
+    m_numPieces = m_length / m_pieceLength + (m_length % m_pieceLength == 0 ? 0 : 1);
+  else
+    m_numPieces = 0;
 
-  return chunkHash;
+  // the info dictionary has changed
+  m_infoHash.reset();
 }
 
 } // namespace sbt
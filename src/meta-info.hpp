@@ -24,9 +24,17 @@
 
 #include <pthread.h>
 #include "util/bencoding.hpp"
+#include "util/buffer-view.hpp"
 
 namespace sbt {
 
+/**
+ * @brief Torrent file
+ *
+ * The fields used while downloading (name, lengths, piece hashes) are
+ * taken out of the bencoded tree once, when it is decoded or changed,
+ * so their getters neither look them up nor copy them.
+ */
 class MetaInfo
 {
 public:
@@ -63,6 +71,13 @@ public:
   void
   wireDecode(std::istream& is);
 
+  /** @brief Decode the torrent file in @p data, the info hash is taken
+   *         over the info dictionary as it is encoded there
+   *  @throws bencoding::Error if it is not a valid torrent file
+   */
+  void
+  wireDecode(const uint8_t* data, size_t size);
+
   void
   setAnnounce(const std::string& announce);
 
@@ -72,29 +87,49 @@ public:
   void
   setName(const std::string& name);
 
-  std::string
-  getName();
+  const std::string&
+  getName() const
+  {
+    return m_name;
+  }
 
   void
   setPieceLength(int64_t length);
 
   int64_t
-  getPieceLength();
+  getPieceLength() const
+  {
+    return m_pieceLength;
+  }
 
   void
   setPieces(const std::vector<uint8_t> pieces);
 
-  std::vector<uint8_t>
-  getPieces();
+  /** @return the SHA-1 hashes of all the pieces, one after the other
+   */
+  const std::vector<uint8_t>&
+  getPieces() const
+  {
+    return *m_pieces;
+  }
 
-  std::vector<uint8_t>
-  getHashOfPiece(int index);
+  /** @return the 20 byte SHA-1 hash of piece @p index, not copied
+   *  @throws std::out_of_range if there is no such piece
+   */
+  BufferView
+  getPieceHash(int index) const
+  {
+    return BufferView(m_pieces, static_cast<size_t>(index) * 20, 20);
+  }
 
   void
   setLength(int64_t length);
 
   int64_t
-  getLength();
+  getLength() const
+  {
+    return m_length;
+  }
 
   void
   addFile(const MetaInfo::File file);
@@ -108,56 +143,63 @@ public:
     return m_root;
   }
 
+  /** @return the SHA-1 of the info dictionary, computed once
+   */
   ConstBufferPtr
   getHash();
 
   int
-  getNumPieces()
+  getNumPieces() const
   {
-    int64_t fileLength = getLength();
-    int64_t pieceLength = getPieceLength();
-    return fileLength / pieceLength + (fileLength % pieceLength == 0 ? 0 : 1);
+    return m_numPieces;
   }
 
   //TODO: add locks to bytes uploaded/downloaded
   
-  int
+  uint64_t
   getBytesDownloaded()
   {
     return bytesDownloaded;
   }
 
   void
-  increaseBytesDownloaded(int bytes)
+  increaseBytesDownloaded(uint64_t bytes)
   {
     bytesDownloaded += bytes;
     bytesLeft -= bytes;
   }
 
-  int
+  uint64_t
   getBytesUploaded()
   {
     return bytesUploaded;
   }
 
   void
-  increaseBytesUploaded(int bytes)
+  increaseBytesUploaded(uint64_t bytes)
   {
     bytesUploaded += bytes;
   }
 
-  int
+  uint64_t
   getBytesLeft()
   {
     return bytesLeft;
   }
 
   void
-  setBytesLeft(int bytes)
+  setBytesLeft(uint64_t bytes)
   {
     bytesLeft = bytes;
   }
 
+private:
+  /** @brief Take the cached fields out of m_info
+   *  @throws bencoding::Error if a field has the wrong type
+   */
+  void
+  updateFields();
+
 private:
   static const std::string ANNOUNCE;
   static const std::string INFO;
@@ -171,9 +213,19 @@ private:
   bencoding::Dictionary m_root;
   std::shared_ptr<bencoding::Dictionary> m_info;
 
-  int bytesUploaded;
-  int bytesDownloaded; 
-  int bytesLeft;
+  // cached fields of m_info
+  std::string m_name;
+  int64_t m_pieceLength;
+  int64_t m_length;
+  int m_numPieces;
+  BufferPtr m_pieces;
+
+  // info hash, computed when first needed unless decoded
+  ConstBufferPtr m_infoHash;
+
+  uint64_t bytesUploaded;
+  uint64_t bytesDownloaded;
+  uint64_t bytesLeft;
 };
 
 } // namespace sbt
@@ -28,7 +28,11 @@ namespace msg {
 const size_t HandShake::HANDSHAKE_LENGTH = 68;
 const uint8_t HandShake::PSTR_LENGTH = 19;
 const std::string HandShake::PSTR("BitTorrent protocol");
-const Buffer HandShake::RESERVED(8, 0);
+const size_t HandShake::RESERVED_OFFSET = 20;
+const size_t HandShake::RESERVED_LENGTH = 8;
+// the fast extension is the third least significant bit
+const size_t HandShake::FAST_EXTENSION_BYTE = 7;
+const uint8_t HandShake::FAST_EXTENSION_BIT = 0x04;
 
 const size_t HandShake::INFOHASH_OFFSET = 28;
 const size_t HandShake::INFOHASH_LENGTH = 20;
@@ -36,15 +40,32 @@ const size_t HandShake::PEERID_OFFSET = 48;
 const size_t HandShake::PEERID_LENGTH = 20;
 
 HandShake::HandShake()
+  : m_reserved(RESERVED_LENGTH)
 {
 }
 
 HandShake::HandShake(ConstBufferPtr infoHash, std::string peerId)
   : m_infoHash(infoHash)
   , m_peerId(peerId)
+  , m_reserved(RESERVED_LENGTH)
 {
 }
 
+void
+HandShake::setFastExtension(bool isEnabled)
+{
+  if (isEnabled)
+    m_reserved[FAST_EXTENSION_BYTE] |= FAST_EXTENSION_BIT;
+  else
+    m_reserved[FAST_EXTENSION_BYTE] &= ~FAST_EXTENSION_BIT;
+}
+
+bool
+HandShake::supportsFastExtension() const
+{
+  return (m_reserved[FAST_EXTENSION_BYTE] & FAST_EXTENSION_BIT) != 0;
+}
+
 ConstBufferPtr
 HandShake::encode()
 {
@@ -52,7 +73,7 @@ HandShake::encode()
 
   os.write(reinterpret_cast<const char*>(&PSTR_LENGTH), 1);
   os.write(&PSTR.front(), PSTR.size());
-  os.write(reinterpret_cast<const char*>(&RESERVED.front()), RESERVED.size());
+  os.write(reinterpret_cast<const char*>(&m_reserved.front()), m_reserved.size());
   os.write(reinterpret_cast<const char*>(&m_infoHash->front()), m_infoHash->size());
   os.write(&m_peerId.front(), m_peerId.size());
 
@@ -64,6 +85,7 @@ void HandShake::decode(ConstBufferPtr msg)
   if (msg->size() != HANDSHAKE_LENGTH)
     throw Error("Wrong handshake length");
 
+  m_reserved = Buffer(&(*msg)[RESERVED_OFFSET], RESERVED_LENGTH);
   m_infoHash = std::make_shared<Buffer>(&(*msg)[INFOHASH_OFFSET], INFOHASH_LENGTH);
   m_peerId = std::string(reinterpret_cast<const char*>(&(*msg)[PEERID_OFFSET]), PEERID_LENGTH);
 }
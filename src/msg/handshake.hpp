@@ -59,6 +59,15 @@ public:
     return m_peerId;
   }
 
+  /** @brief Announce support for the fast extension (BEP 6) in the
+   *         reserved bytes
+   */
+  void
+  setFastExtension(bool isEnabled);
+
+  bool
+  supportsFastExtension() const;
+
   ConstBufferPtr
   encode();
 
@@ -69,7 +78,10 @@ private:
   static const size_t HANDSHAKE_LENGTH;
   static const uint8_t PSTR_LENGTH;
   static const std::string PSTR;
-  static const Buffer RESERVED;
+  static const size_t RESERVED_OFFSET;
+  static const size_t RESERVED_LENGTH;
+  static const size_t FAST_EXTENSION_BYTE;
+  static const uint8_t FAST_EXTENSION_BIT;
 
   static const size_t INFOHASH_OFFSET;
   static const size_t INFOHASH_LENGTH;
@@ -78,6 +90,7 @@ private:
 
   ConstBufferPtr m_infoHash;
   std::string m_peerId;
+  Buffer m_reserved;
 };
 
 } // namespace msg
@@ -21,7 +21,9 @@
 
 #include "msg-base.hpp"
 #include "../util/buffer-stream.hpp"
+#include "../util/hash.hpp"
 #include <arpa/inet.h>
+#include <algorithm>
 
 namespace sbt {
 namespace msg {
@@ -69,23 +71,63 @@ MsgBase::encode()
   return os.buf();
 }
 
+void
+MsgBase::encodeTo(Buffer& buffer)
+{
+  if (m_id == MSG_ID_KEEP_ALIVE) {
+    encodeUint32(buffer, 0);
+    return;
+  }
+
+  // the length is filled in once the payload is written
+  size_t start = buffer.size();
+  encodeUint32(buffer, 0);
+  buffer.push_back(m_id);
+
+  encodePayloadTo(buffer);
+
+  uint32_t tmpValue = htonl(buffer.size() - start - 4);
+  std::copy_n(reinterpret_cast<const uint8_t*>(&tmpValue), 4, buffer.begin() + start);
+}
+
+void
+MsgBase::encodePayloadTo(Buffer& buffer)
+{
+  encodePayload();
+
+  if (static_cast<bool>(m_payload))
+    buffer.insert(buffer.end(), m_payload->begin(), m_payload->end());
+}
+
 void
 MsgBase::decode(ConstBufferPtr msg)
 {
-  size_t totalLength = decodeUint32(msg->get());
+  decode(BufferView(msg));
+}
+
+void
+MsgBase::decode(const BufferView& msg)
+{
+  if (msg.size() < PAYLOAD_OFFSET - 1)
+    throw Error("Message is too short!");
+
+  size_t totalLength = decodeUint32(msg.data());
+
+  m_payload = nullptr;
+  m_payloadView = BufferView();
 
   if (totalLength == 0) {
     m_id = MSG_ID_KEEP_ALIVE;
-    m_payload = nullptr;
     return;
   }
 
-  m_id = (*msg)[ID_OFFSET];
+  if (msg.size() < PAYLOAD_OFFSET - 1 + totalLength)
+    throw Error("Message is truncated!");
+
+  m_id = msg[ID_OFFSET];
 
   if (totalLength > 1)
-    m_payload = make_shared<Buffer>(msg->get() + PAYLOAD_OFFSET,  totalLength - 1);
-  else
-    m_payload = nullptr;
+    m_payloadView = msg.slice(PAYLOAD_OFFSET, totalLength - 1);
 
   decodePayload();
 }
@@ -104,6 +146,14 @@ MsgBase::encodeUint32(std::ostream& os, uint32_t value)
   os.write(reinterpret_cast<const char*>(&tmpValue), 4);
 }
 
+void
+MsgBase::encodeUint32(Buffer& buffer, uint32_t value)
+{
+  uint32_t tmpValue = htonl(value);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&tmpValue);
+  buffer.insert(buffer.end(), bytes, bytes + 4);
+}
+
 KeepAlive::KeepAlive()
   : MsgBase(MSG_ID_KEEP_ALIVE)
 {
@@ -150,13 +200,19 @@ Have::encodePayload()
   setPayload(os.buf());
 }
 
+void
+Have::encodePayloadTo(Buffer& buffer)
+{
+  encodeUint32(buffer, m_index);
+}
+
 void
 Have::decodePayload()
 {
-  if (getPayload()->size() != 4)
+  if (getPayloadView().size() != 4)
     throw Error("Wrong have payload!");
 
-  m_index = decodeUint32(getPayload()->get());
+  m_index = decodeUint32(getPayloadView().data());
 }
 
 
@@ -185,13 +241,21 @@ Request::encodePayload()
   setPayload(os.buf());
 }
 
+void
+Request::encodePayloadTo(Buffer& buffer)
+{
+  encodeUint32(buffer, m_index);
+  encodeUint32(buffer, m_begin);
+  encodeUint32(buffer, m_length);
+}
+
 void
 Request::decodePayload()
 {
-  if (getPayload()->size() != 12)
+  if (getPayloadView().size() != 12)
     throw Error("Wrong request payload!");
 
-  const uint8_t* payload = getPayload()->get();
+  const uint8_t* payload = getPayloadView().data();
   m_index = decodeUint32(payload);
   m_begin = decodeUint32(payload + 4);
   m_length = decodeUint32(payload + 8);
@@ -236,6 +300,14 @@ Piece::Piece()
 }
 
 Piece::Piece(uint32_t index, uint32_t begin, ConstBufferPtr block)
+  : MsgBase(MSG_ID_PIECE)
+  , m_index(index)
+  , m_begin(begin)
+  , m_block(static_cast<bool>(block) ? BufferView(block) : BufferView())
+{
+}
+
+Piece::Piece(uint32_t index, uint32_t begin, const BufferView& block)
   : MsgBase(MSG_ID_PIECE)
   , m_index(index)
   , m_begin(begin)
@@ -243,6 +315,21 @@ Piece::Piece(uint32_t index, uint32_t begin, ConstBufferPtr block)
 {
 }
 
+const size_t Piece::HEADER_LENGTH = 13;
+
+ConstBufferPtr
+Piece::encodeHeader(uint32_t index, uint32_t begin, uint32_t blockLength)
+{
+  OBufferStream os;
+
+  encodeUint32(os, blockLength + 9);
+  os.put(MSG_ID_PIECE);
+  encodeUint32(os, index);
+  encodeUint32(os, begin);
+
+  return os.buf();
+}
+
 void
 Piece::encodePayload()
 {
@@ -250,22 +337,29 @@ Piece::encodePayload()
 
   encodeUint32(os, m_index);
   encodeUint32(os, m_begin);
-  if (static_cast<bool>(m_block))
-    os.write(reinterpret_cast<const char*>(m_block->buf()), m_block->size());
+  os.write(reinterpret_cast<const char*>(m_block.data()), m_block.size());
 
   setPayload(os.buf());
 }
 
+void
+Piece::encodePayloadTo(Buffer& buffer)
+{
+  encodeUint32(buffer, m_index);
+  encodeUint32(buffer, m_begin);
+  buffer.insert(buffer.end(), m_block.data(), m_block.data() + m_block.size());
+}
+
 void
 Piece::decodePayload()
 {
-  if (getPayload()->size() < 8)
+  const BufferView& payload = getPayloadView();
+  if (payload.size() < 8)
     throw Error("Wrong piece payload!");
 
-  const uint8_t* payload = getPayload()->get();
-  m_index = decodeUint32(payload);
-  m_begin = decodeUint32(payload + 4);
-  m_block = make_shared<Buffer>(payload + 8, getPayload()->size() - 8);
+  m_index = decodeUint32(payload.data());
+  m_begin = decodeUint32(payload.data() + 4);
+  m_block = payload.slice(8, payload.size() - 8);
 }
 
 Cancel::Cancel()
@@ -293,18 +387,185 @@ Cancel::encodePayload()
   setPayload(os.buf());
 }
 
+void
+Cancel::encodePayloadTo(Buffer& buffer)
+{
+  encodeUint32(buffer, m_index);
+  encodeUint32(buffer, m_begin);
+  encodeUint32(buffer, m_length);
+}
+
 void
 Cancel::decodePayload()
 {
-  if (getPayload()->size() != 12)
+  if (getPayloadView().size() != 12)
     throw Error("Wrong request payload!");
 
-  const uint8_t* payload = getPayload()->get();
+  const uint8_t* payload = getPayloadView().data();
+  m_index = decodeUint32(payload);
+  m_begin = decodeUint32(payload + 4);
+  m_length = decodeUint32(payload + 8);
+}
+
+SuggestPiece::SuggestPiece()
+  : MsgBase(MSG_ID_SUGGEST_PIECE)
+{
+}
+
+SuggestPiece::SuggestPiece(uint32_t index)
+  : MsgBase(MSG_ID_SUGGEST_PIECE)
+  , m_index(index)
+{
+}
+
+void
+SuggestPiece::encodePayload()
+{
+  OBufferStream os;
+
+  encodeUint32(os, m_index);
+
+  setPayload(os.buf());
+}
+
+void
+SuggestPiece::encodePayloadTo(Buffer& buffer)
+{
+  encodeUint32(buffer, m_index);
+}
+
+void
+SuggestPiece::decodePayload()
+{
+  if (getPayloadView().size() != 4)
+    throw Error("Wrong suggest piece payload!");
+
+  m_index = decodeUint32(getPayloadView().data());
+}
+
+HaveAll::HaveAll()
+  : MsgBase(MSG_ID_HAVE_ALL)
+{
+}
+
+HaveNone::HaveNone()
+  : MsgBase(MSG_ID_HAVE_NONE)
+{
+}
+
+RejectRequest::RejectRequest()
+  : MsgBase(MSG_ID_REJECT_REQUEST)
+{
+}
+
+RejectRequest::RejectRequest(uint32_t index, uint32_t begin, uint32_t length)
+  : MsgBase(MSG_ID_REJECT_REQUEST)
+  , m_index(index)
+  , m_begin(begin)
+  , m_length(length)
+{
+}
+
+void
+RejectRequest::encodePayload()
+{
+  OBufferStream os;
+
+  encodeUint32(os, m_index);
+  encodeUint32(os, m_begin);
+  encodeUint32(os, m_length);
+
+  setPayload(os.buf());
+}
+
+void
+RejectRequest::encodePayloadTo(Buffer& buffer)
+{
+  encodeUint32(buffer, m_index);
+  encodeUint32(buffer, m_begin);
+  encodeUint32(buffer, m_length);
+}
+
+void
+RejectRequest::decodePayload()
+{
+  if (getPayloadView().size() != 12)
+    throw Error("Wrong reject request payload!");
+
+  const uint8_t* payload = getPayloadView().data();
   m_index = decodeUint32(payload);
   m_begin = decodeUint32(payload + 4);
   m_length = decodeUint32(payload + 8);
 }
 
+AllowedFast::AllowedFast()
+  : MsgBase(MSG_ID_ALLOWED_FAST)
+{
+}
+
+AllowedFast::AllowedFast(uint32_t index)
+  : MsgBase(MSG_ID_ALLOWED_FAST)
+  , m_index(index)
+{
+}
+
+std::vector<uint32_t>
+AllowedFast::generateSet(const std::string& ip, ConstBufferPtr infoHash,
+                         uint32_t numPieces, size_t size)
+{
+  std::vector<uint32_t> pieces;
+
+  struct in_addr addr;
+  if (numPieces == 0 || inet_pton(AF_INET, ip.c_str(), &addr) != 1)
+    return pieces;
+
+  size = std::min<size_t>(size, numPieces);
+
+  // the network of the peer followed by the info hash, hashed over
+  // and over, each digest gives five indices
+  uint32_t network = htonl(ntohl(addr.s_addr) & 0xFFFFFF00);
+  const uint8_t* networkBytes = reinterpret_cast<const uint8_t*>(&network);
+  std::vector<uint8_t> x(networkBytes, networkBytes + 4);
+  x.insert(x.end(), infoHash->begin(), infoHash->end());
+
+  while (pieces.size() < size) {
+    x = util::sha1(x);
+
+    for (size_t i = 0; i < 5 && pieces.size() < size; i++) {
+      uint32_t index = decodeUint32(x.data() + i * 4) % numPieces;
+      if (std::find(pieces.begin(), pieces.end(), index) == pieces.end())
+        pieces.push_back(index);
+    }
+  }
+
+  return pieces;
+}
+
+void
+AllowedFast::encodePayload()
+{
+  OBufferStream os;
+
+  encodeUint32(os, m_index);
+
+  setPayload(os.buf());
+}
+
+void
+AllowedFast::encodePayloadTo(Buffer& buffer)
+{
+  encodeUint32(buffer, m_index);
+}
+
+void
+AllowedFast::decodePayload()
+{
+  if (getPayloadView().size() != 4)
+    throw Error("Wrong allowed fast payload!");
+
+  m_index = decodeUint32(getPayloadView().data());
+}
+
 
 } // namespace msg
 } // namespace sbt
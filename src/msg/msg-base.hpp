@@ -23,6 +23,7 @@
 #define SBT_MSG_BASE_HPP
 
 #include "../util/buffer.hpp"
+#include "../util/buffer-view.hpp"
 
 namespace sbt {
 namespace msg {
@@ -49,7 +50,14 @@ enum MsgId {
   MSG_ID_REQUEST = 6,
   MSG_ID_PIECE = 7,
   MSG_ID_CANCEL = 8,
-  MSG_ID_PORT = 9
+  MSG_ID_PORT = 9,
+
+  // fast extension (BEP 6), only once both handshakes announced it
+  MSG_ID_SUGGEST_PIECE = 13,
+  MSG_ID_HAVE_ALL = 14,
+  MSG_ID_HAVE_NONE = 15,
+  MSG_ID_REJECT_REQUEST = 16,
+  MSG_ID_ALLOWED_FAST = 17
 };
 
 class MsgBase
@@ -75,12 +83,24 @@ public:
     m_id = id;
   }
 
+  /** @return the payload, copied out of the decoded message on first use
+   */
   ConstBufferPtr
   getPayload()
   {
+    if (!m_payload && m_payloadView)
+      m_payload = m_payloadView.copy();
     return m_payload;
   }
 
+  /** @return the payload of a decoded message, without copying it
+   */
+  const BufferView&
+  getPayloadView() const
+  {
+    return m_payloadView;
+  }
+
   void
   setPayload(ConstBufferPtr payload)
   {
@@ -90,13 +110,32 @@ public:
   ConstBufferPtr
   encode();
 
+  /** @brief Append the encoded message to @p buffer, e.g., to send
+   *         it together with other messages
+   */
+  void
+  encodeTo(Buffer& buffer);
+
   void
   decode(ConstBufferPtr msg);
 
+  /** @brief Decode a message in place, the payload (and e.g. the
+   *         block of a piece) keeps referring to @p msg
+   */
+  void
+  decode(const BufferView& msg);
+
 protected:
   virtual void
   encodePayload() = 0;
 
+  /** @brief Append the payload to @p buffer, by default the one set
+   *         by encodePayload().  Messages of fixed fields write them
+   *         directly instead
+   */
+  virtual void
+  encodePayloadTo(Buffer& buffer);
+
   virtual void
   decodePayload() = 0;
 
@@ -106,6 +145,9 @@ protected:
   static void
   encodeUint32(std::ostream& os, uint32_t value);
 
+  static void
+  encodeUint32(Buffer& buffer, uint32_t value);
+
 
 protected:
   static const size_t ID_OFFSET;
@@ -113,6 +155,7 @@ protected:
 
   uint8_t m_id;
   ConstBufferPtr m_payload;
+  BufferView m_payloadView;
 };
 
 class KeepAlive : public MsgBase
@@ -218,6 +261,9 @@ public:
   virtual void
   encodePayload();
 
+  virtual void
+  encodePayloadTo(Buffer& buffer);
+
   virtual void
   decodePayload();
 
@@ -310,6 +356,9 @@ public:
   virtual void
   encodePayload();
 
+  virtual void
+  encodePayloadTo(Buffer& buffer);
+
   virtual void
   decodePayload();
 
@@ -326,6 +375,17 @@ public:
 
   Piece(uint32_t index, uint32_t begin, ConstBufferPtr block);
 
+  Piece(uint32_t index, uint32_t begin, const BufferView& block);
+
+  /** @brief Encode everything of a piece message but the block itself
+   *         (length, id, index and begin), so that the block can be sent
+   *         straight from the file
+   */
+  static ConstBufferPtr
+  encodeHeader(uint32_t index, uint32_t begin, uint32_t blockLength);
+
+  static const size_t HEADER_LENGTH;
+
   uint32_t
   getIndex() const
   {
@@ -350,14 +410,16 @@ public:
     m_begin = begin;
   }
 
-  ConstBufferPtr
+  /** @return the block, referring into the decoded message
+   */
+  const BufferView&
   getBlock() const
   {
     return m_block;
   }
 
   void
-  setBlock(ConstBufferPtr block)
+  setBlock(const BufferView& block)
   {
     m_block = block;
   }
@@ -365,13 +427,16 @@ public:
   virtual void
   encodePayload();
 
+  virtual void
+  encodePayloadTo(Buffer& buffer);
+
   virtual void
   decodePayload();
 
 private:
   uint32_t m_index;
   uint32_t m_begin;
-  ConstBufferPtr m_block;
+  BufferView m_block;
 };
 
 class Cancel : public MsgBase
@@ -420,6 +485,9 @@ public:
   virtual void
   encodePayload();
 
+  virtual void
+  encodePayloadTo(Buffer& buffer);
+
   virtual void
   decodePayload();
 
@@ -429,6 +497,174 @@ private:
   uint32_t m_length;
 };
 
+class SuggestPiece : public MsgBase
+{
+public:
+  SuggestPiece();
+
+  explicit
+  SuggestPiece(uint32_t index);
+
+  uint32_t
+  getIndex() const
+  {
+    return m_index;
+  }
+
+  void
+  setIndex(uint32_t index)
+  {
+    m_index = index;
+  }
+
+  virtual void
+  encodePayload();
+
+  virtual void
+  encodePayloadTo(Buffer& buffer);
+
+  virtual void
+  decodePayload();
+
+private:
+  uint32_t m_index;
+};
+
+class HaveAll : public MsgBase
+{
+public:
+  HaveAll();
+
+  virtual void
+  encodePayload()
+  {
+  }
+
+  virtual void
+  decodePayload()
+  {
+  }
+};
+
+class HaveNone : public MsgBase
+{
+public:
+  HaveNone();
+
+  virtual void
+  encodePayload()
+  {
+  }
+
+  virtual void
+  decodePayload()
+  {
+  }
+};
+
+class RejectRequest : public MsgBase
+{
+public:
+  RejectRequest();
+
+  RejectRequest(uint32_t index, uint32_t begin, uint32_t length);
+
+  uint32_t
+  getIndex() const
+  {
+    return m_index;
+  }
+
+  void
+  setIndex(uint32_t index)
+  {
+    m_index = index;
+  }
+
+  uint32_t
+  getBegin() const
+  {
+    return m_begin;
+  }
+
+  void
+  setBegin(uint32_t begin)
+  {
+    m_begin = begin;
+  }
+
+  uint32_t
+  getLength() const
+  {
+    return m_length;
+  }
+
+  void
+  setLength(uint32_t length)
+  {
+    m_length = length;
+  }
+
+  virtual void
+  encodePayload();
+
+  virtual void
+  encodePayloadTo(Buffer& buffer);
+
+  virtual void
+  decodePayload();
+
+private:
+  uint32_t m_index;
+  uint32_t m_begin;
+  uint32_t m_length;
+};
+
+class AllowedFast : public MsgBase
+{
+public:
+  AllowedFast();
+
+  explicit
+  AllowedFast(uint32_t index);
+
+  /** @brief Get the pieces a peer at @p ip may request while choked
+   *
+   *  The set is derived from the /24 network of the peer and the info
+   *  hash as BEP 6 describes, so reconnecting from another address of
+   *  the same network does not give a peer more pieces.
+   *
+   *  @return at most @p size distinct piece indices
+   */
+  static std::vector<uint32_t>
+  generateSet(const std::string& ip, ConstBufferPtr infoHash,
+              uint32_t numPieces, size_t size);
+
+  uint32_t
+  getIndex() const
+  {
+    return m_index;
+  }
+
+  void
+  setIndex(uint32_t index)
+  {
+    m_index = index;
+  }
+
+  virtual void
+  encodePayload();
+
+  virtual void
+  encodePayloadTo(Buffer& buffer);
+
+  virtual void
+  decodePayload();
+
+private:
+  uint32_t m_index;
+};
+
 
 } // namespace msg
 } // namespace sbt
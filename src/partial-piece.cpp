@@ -0,0 +1,222 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "partial-piece.hpp"
+
+#include <algorithm>
+
+namespace sbt {
+
+// 16 KiB is the request size every client is expected to serve
+const uint32_t PartialPiece::BLOCK_SIZE = 16384;
+
+PartialPiece::PartialPiece(int index, uint32_t length)
+  : m_index(index)
+  , m_length(length)
+  , m_blocks((length + BLOCK_SIZE - 1) / BLOCK_SIZE, BLOCK_NONE)
+  , m_numRequests(m_blocks.size(), 0)
+  , m_numReceived(0)
+  , m_numHashed(0)
+  , m_hasWriteError(false)
+{
+  pthread_mutex_init(&m_hashLock, NULL);
+}
+
+PartialPiece::~PartialPiece()
+{
+  pthread_mutex_destroy(&m_hashLock);
+}
+
+uint32_t
+PartialPiece::getBlockLength(size_t block) const
+{
+  if (block == m_blocks.size() - 1)
+    return m_length - block * BLOCK_SIZE;
+  else
+    return BLOCK_SIZE;
+}
+
+bool
+PartialPiece::nextBlock(uint32_t& begin, uint32_t& length)
+{
+  for (size_t i = 0; i < m_blocks.size(); i++) {
+    if (m_blocks[i] == BLOCK_NONE) {
+      m_blocks[i] = BLOCK_REQUESTED;
+      m_numRequests[i] = 1;
+      begin = i * BLOCK_SIZE;
+      length = getBlockLength(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+PartialPiece::requestAgain(size_t block, uint32_t& begin, uint32_t& length)
+{
+  if (block >= m_blocks.size() || m_blocks[block] != BLOCK_REQUESTED)
+    return false;
+
+  m_numRequests[block]++;
+  begin = block * BLOCK_SIZE;
+  length = getBlockLength(block);
+  return true;
+}
+
+void
+PartialPiece::abortBlock(uint32_t begin)
+{
+  size_t block = begin / BLOCK_SIZE;
+
+  if (block >= m_blocks.size() || m_blocks[block] != BLOCK_REQUESTED)
+    return;
+
+  if (--m_numRequests[block] == 0)
+    m_blocks[block] = BLOCK_NONE;
+}
+
+bool
+PartialPiece::receiveBlock(uint32_t begin, size_t size)
+{
+  if (begin % BLOCK_SIZE != 0)
+    return false;
+
+  size_t i = begin / BLOCK_SIZE;
+  if (i >= m_blocks.size() || size != getBlockLength(i))
+    return false;
+
+  if (m_blocks[i] == BLOCK_RECEIVED)
+    return false;
+
+  m_blocks[i] = BLOCK_RECEIVED;
+  m_numRequests[i] = 0;
+  m_numReceived++;
+
+  return true;
+}
+
+void
+PartialPiece::dropBlock(uint32_t begin)
+{
+  size_t i = begin / BLOCK_SIZE;
+
+  if (i >= m_blocks.size() || m_blocks[i] != BLOCK_RECEIVED)
+    return;
+
+  m_blocks[i] = BLOCK_NONE;
+  m_numReceived--;
+}
+
+bool
+PartialPiece::hashBlock(uint32_t begin, const uint8_t* block, size_t size)
+{
+  size_t i = begin / BLOCK_SIZE;
+
+  pthread_mutex_lock(&m_hashLock);
+
+  if (i != m_numHashed) {
+    m_buffered[i] = Buffer(block, size);
+    pthread_mutex_unlock(&m_hashLock);
+    return false;
+  }
+
+  updateHash(block, size);
+
+  // the block may have closed a gap
+  auto it = m_buffered.begin();
+  while (it != m_buffered.end() && it->first == m_numHashed) {
+    updateHash(it->second.buf(), it->second.size());
+    it = m_buffered.erase(it);
+  }
+
+  bool isHashed = (m_numHashed == m_blocks.size());
+  if (isHashed)
+    m_digest = m_hash.finalize();
+
+  pthread_mutex_unlock(&m_hashLock);
+  return isHashed;
+}
+
+bool
+PartialPiece::addBlock(uint32_t begin, const uint8_t* block, size_t size)
+{
+  if (!receiveBlock(begin, size))
+    return false;
+
+  hashBlock(begin, block, size);
+  return true;
+}
+
+size_t
+PartialPiece::getNumBuffered() const
+{
+  pthread_mutex_lock(&m_hashLock);
+  size_t numBuffered = m_buffered.size();
+  pthread_mutex_unlock(&m_hashLock);
+
+  return numBuffered;
+}
+
+ConstBufferPtr
+PartialPiece::getHash() const
+{
+  pthread_mutex_lock(&m_hashLock);
+  ConstBufferPtr digest = m_digest;
+  pthread_mutex_unlock(&m_hashLock);
+
+  return digest;
+}
+
+uint32_t
+PartialPiece::getChecksum() const
+{
+  pthread_mutex_lock(&m_hashLock);
+  uint32_t checksum = m_crc.checksum();
+  pthread_mutex_unlock(&m_hashLock);
+
+  return checksum;
+}
+
+void
+PartialPiece::updateHash(const uint8_t* block, size_t size)
+{
+  m_hash.update(block, size);
+  m_crc.process_bytes(block, size);
+  m_numHashed++;
+}
+
+void
+PartialPiece::reset()
+{
+  std::fill(m_blocks.begin(), m_blocks.end(), BLOCK_NONE);
+  std::fill(m_numRequests.begin(), m_numRequests.end(), 0);
+  m_numReceived = 0;
+  m_hasWriteError = false;
+
+  pthread_mutex_lock(&m_hashLock);
+  m_numHashed = 0;
+  m_buffered.clear();
+  m_hash.finalize();
+  m_crc.reset();
+  m_digest.reset();
+  pthread_mutex_unlock(&m_hashLock);
+}
+
+} // namespace sbt
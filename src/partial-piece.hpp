@@ -0,0 +1,202 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_PARTIAL_PIECE_HPP
+#define SBT_PARTIAL_PIECE_HPP
+
+#include "util/buffer.hpp"
+#include "util/hash.hpp"
+
+#include <map>
+#include <atomic>
+#include <pthread.h>
+#include <boost/crc.hpp>
+
+namespace sbt {
+
+/**
+ * @brief A piece being downloaded, split into fixed size blocks
+ *
+ * Blocks are requested independently and may arrive in any order.
+ * The piece is hashed as its blocks arrive: a block that continues
+ * the hashed prefix is hashed at once and can be written out, a block
+ * ahead of a missing one is kept until the gap is filled.  So the
+ * digest is ready with the last block and only out-of-order blocks
+ * are buffered.  In endgame the same block may be requested from
+ * several peers, it stays requested until the last of them aborts it.
+ *
+ * The requests are tracked on the loop thread, which takes a block in
+ * with receiveBlock().  Its data may then be hashed with hashBlock()
+ * on any thread, e.g., by the worker writing it out.
+ */
+class PartialPiece
+{
+public:
+  static const uint32_t BLOCK_SIZE;
+
+public:
+  PartialPiece(int index, uint32_t length);
+
+  ~PartialPiece();
+
+  int
+  getIndex() const
+  {
+    return m_index;
+  }
+
+  uint32_t
+  getLength() const
+  {
+    return m_length;
+  }
+
+  size_t
+  getNumBlocks() const
+  {
+    return m_blocks.size();
+  }
+
+  /** @brief Pick the next block that is neither requested nor received
+   *         and mark it requested
+   *  @return false if there is no such block
+   */
+  bool
+  nextBlock(uint32_t& begin, uint32_t& length);
+
+  /** @brief Request a block again that is already requested, but not
+   *         yet received, for endgame
+   *  @return false if the block is not outstanding
+   */
+  bool
+  requestAgain(size_t block, uint32_t& begin, uint32_t& length);
+
+  /** @brief Withdraw one request of a block (e.g., we got choked), the
+   *         block can be picked again once no request is left
+   */
+  void
+  abortBlock(uint32_t begin);
+
+  /** @brief Mark the block at @p begin received
+   *  @return false if the block does not line up with a block of
+   *          this piece or it was already received
+   */
+  bool
+  receiveBlock(uint32_t begin, size_t size);
+
+  /** @brief Forget a received block that could not be handed on to be
+   *         hashed, so that it is picked again
+   */
+  void
+  dropBlock(uint32_t begin);
+
+  /** @brief Hash a received block into the piece, or keep a copy of
+   *         it until the blocks before it are hashed
+   *  @return true if the piece is completely hashed now
+   */
+  bool
+  hashBlock(uint32_t begin, const uint8_t* block, size_t size);
+
+  /** @brief receiveBlock() and hashBlock() in one go
+   */
+  bool
+  addBlock(uint32_t begin, const uint8_t* block, size_t size);
+
+  /** @return the number of received blocks waiting to be hashed
+   */
+  size_t
+  getNumBuffered() const;
+
+  /** @brief A block could not be written out, the piece has to be
+   *         downloaded again once it is complete
+   */
+  void
+  setWriteError()
+  {
+    m_hasWriteError = true;
+  }
+
+  bool
+  hasWriteError() const
+  {
+    return m_hasWriteError;
+  }
+
+  bool
+  isComplete() const
+  {
+    return m_numReceived == m_blocks.size();
+  }
+
+  /** @brief Forget all the blocks, e.g., after a failed hash check
+   */
+  void
+  reset();
+
+  /** @return the SHA-1 of the piece once it is completely hashed,
+   *          or null
+   */
+  ConstBufferPtr
+  getHash() const;
+
+  /** @return the CRC-32 of the piece once it is completely hashed, as
+   *          ResumeData::checksum() computes it
+   */
+  uint32_t
+  getChecksum() const;
+
+private:
+  enum BlockState {
+    BLOCK_NONE,
+    BLOCK_REQUESTED,
+    BLOCK_RECEIVED
+  };
+
+  uint32_t
+  getBlockLength(size_t block) const;
+
+  void
+  updateHash(const uint8_t* block, size_t size);
+
+private:
+  int m_index;
+  uint32_t m_length;
+
+  std::vector<uint8_t> m_blocks;
+  std::vector<uint16_t> m_numRequests;
+  size_t m_numReceived;
+
+  // the first m_numHashed blocks are hashed, received blocks
+  // after the first missing one wait in m_buffered.  The hash
+  // state is guarded by m_hashLock
+  size_t m_numHashed;
+  std::map<size_t, Buffer> m_buffered;
+  util::Sha1 m_hash;
+  boost::crc_32_type m_crc;
+  ConstBufferPtr m_digest;
+  std::atomic<bool> m_hasWriteError;
+  mutable pthread_mutex_t m_hashLock;
+};
+
+// in-progress pieces by index, shared by all the peers
+typedef std::map<int, shared_ptr<PartialPiece>> PartialPieceMap;
+
+} // namespace sbt
+
+#endif // SBT_PARTIAL_PIECE_HPP
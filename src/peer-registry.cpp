@@ -0,0 +1,183 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "peer-registry.hpp"
+
+#include <arpa/inet.h>
+
+namespace sbt {
+
+// buckets of the smallest table, a power of two
+const size_t PeerRegistry::MIN_CAPACITY = 16;
+
+// markers of the table buckets that hold no slot
+static const uint32_t EMPTY = 0xFFFFFFFF;
+static const uint32_t ERASED = 0xFFFFFFFE;
+
+PeerRegistry::iterator::iterator(PeerRegistry* registry, size_t slot)
+  : m_registry(registry)
+  , m_slot(slot)
+{
+  skipFree();
+}
+
+PeerRegistry::iterator&
+PeerRegistry::iterator::operator++()
+{
+  m_slot++;
+  skipFree();
+  return *this;
+}
+
+void
+PeerRegistry::iterator::skipFree()
+{
+  while (m_slot < m_registry->m_slots.size() && !m_registry->m_slots[m_slot].peer)
+    m_slot++;
+}
+
+PeerRegistry::PeerRegistry()
+  : m_table(MIN_CAPACITY, EMPTY)
+  , m_size(0)
+  , m_numErased(0)
+{
+}
+
+bool
+PeerRegistry::makeKey(const std::string& ip, uint16_t port, uint64_t& key)
+{
+  struct in_addr addr;
+  if (inet_pton(AF_INET, ip.c_str(), &addr) != 1)
+    return false;
+
+  key = (static_cast<uint64_t>(ntohl(addr.s_addr)) << 16) | port;
+  return true;
+}
+
+static size_t
+hashKey(uint64_t key, size_t mask)
+{
+  // Fibonacci hashing, folded so that the high bits count
+  uint64_t hash = key * 0x9E3779B97F4A7C15ULL;
+  return (hash ^ (hash >> 32)) & mask;
+}
+
+size_t
+PeerRegistry::findBucket(uint64_t key) const
+{
+  size_t mask = m_table.size() - 1;
+  for (size_t i = hashKey(key, mask); ; i = (i + 1) & mask) {
+    uint32_t slot = m_table[i];
+    if (slot == EMPTY)
+      return i;
+    if (slot != ERASED && m_slots[slot].key == key)
+      return i;
+  }
+}
+
+bool
+PeerRegistry::insert(const std::string& ip, uint16_t port, shared_ptr<Peer> peer)
+{
+  uint64_t key = 0;
+  if (!makeKey(ip, port, key))
+    return false;
+
+  // keep at most half of the buckets taken, so that the probe
+  // sequences stay short
+  if ((m_size + m_numErased + 1) * 2 > m_table.size()) {
+    size_t capacity = m_table.size();
+    while ((m_size + 1) * 4 > capacity)
+      capacity *= 2;
+    rehash(capacity);
+  }
+
+  size_t bucket = findBucket(key);
+  if (m_table[bucket] != EMPTY)
+    return false;
+
+  uint32_t slot = 0;
+  if (!m_freeSlots.empty()) {
+    slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+  }
+  else {
+    slot = m_slots.size();
+    m_slots.push_back(Slot());
+  }
+
+  m_slots[slot].key = key;
+  m_slots[slot].peer = peer;
+  m_table[bucket] = slot;
+  m_size++;
+
+  return true;
+}
+
+shared_ptr<Peer>
+PeerRegistry::find(const std::string& ip, uint16_t port) const
+{
+  uint64_t key = 0;
+  if (!makeKey(ip, port, key))
+    return shared_ptr<Peer>();
+
+  uint32_t slot = m_table[findBucket(key)];
+  if (slot == EMPTY)
+    return shared_ptr<Peer>();
+
+  return m_slots[slot].peer;
+}
+
+bool
+PeerRegistry::erase(const std::string& ip, uint16_t port)
+{
+  uint64_t key = 0;
+  if (!makeKey(ip, port, key))
+    return false;
+
+  size_t bucket = findBucket(key);
+  uint32_t slot = m_table[bucket];
+  if (slot == EMPTY)
+    return false;
+
+  // the bucket may be in the probe sequence of other keys
+  m_table[bucket] = ERASED;
+  m_numErased++;
+
+  m_slots[slot].peer.reset();
+  m_freeSlots.push_back(slot);
+  m_size--;
+
+  return true;
+}
+
+void
+PeerRegistry::rehash(size_t capacity)
+{
+  m_table.assign(capacity, EMPTY);
+  m_numErased = 0;
+
+  for (size_t slot = 0; slot < m_slots.size(); slot++) {
+    if (!m_slots[slot].peer)
+      continue;
+
+    m_table[findBucket(m_slots[slot].key)] = slot;
+  }
+}
+
+} // namespace sbt
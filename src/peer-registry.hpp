@@ -0,0 +1,175 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_PEER_REGISTRY_HPP
+#define SBT_PEER_REGISTRY_HPP
+
+#include "common.hpp"
+
+#include <deque>
+#include <vector>
+
+namespace sbt {
+
+class Peer;
+
+/**
+ * @brief The peers of a client, keyed by their (ip, port) endpoint
+ *
+ * The peers are kept in a slab of slots that never move, so a
+ * reference to a slot (and the peer in it) stays valid while peers
+ * are added, and the slots of removed peers are reused.  The
+ * endpoints are looked up in an open-addressing hash table of slot
+ * numbers with linear probing, so finding, adding and removing a
+ * peer is O(1) however many peers the tracker hands out.
+ *
+ * Iterating visits the peers in the order of their slots, peers
+ * added meanwhile may or may not be visited.
+ */
+class PeerRegistry
+{
+public:
+  static const size_t MIN_CAPACITY;
+
+  class iterator
+  {
+  public:
+    iterator(PeerRegistry* registry, size_t slot);
+
+    shared_ptr<Peer>&
+    operator*() const
+    {
+      return m_registry->m_slots[m_slot].peer;
+    }
+
+    shared_ptr<Peer>*
+    operator->() const
+    {
+      return &m_registry->m_slots[m_slot].peer;
+    }
+
+    iterator&
+    operator++();
+
+    bool
+    operator==(const iterator& other) const
+    {
+      return m_slot == other.m_slot;
+    }
+
+    bool
+    operator!=(const iterator& other) const
+    {
+      return m_slot != other.m_slot;
+    }
+
+  private:
+    void
+    skipFree();
+
+  private:
+    PeerRegistry* m_registry;
+    size_t m_slot;
+  };
+
+public:
+  PeerRegistry();
+
+  /** @brief Add a peer known by @p ip and @p port
+   *  @return false if the endpoint is taken already, or @p ip is
+   *          not an IPv4 address
+   */
+  bool
+  insert(const std::string& ip, uint16_t port, shared_ptr<Peer> peer);
+
+  /** @return the peer at the endpoint, or null
+   */
+  shared_ptr<Peer>
+  find(const std::string& ip, uint16_t port) const;
+
+  bool
+  contains(const std::string& ip, uint16_t port) const
+  {
+    return static_cast<bool>(find(ip, port));
+  }
+
+  /** @brief Drop the peer at the endpoint, its slot is reused
+   *  @return false if there is none
+   */
+  bool
+  erase(const std::string& ip, uint16_t port);
+
+  size_t
+  size() const
+  {
+    return m_size;
+  }
+
+  bool
+  empty() const
+  {
+    return m_size == 0;
+  }
+
+  iterator
+  begin()
+  {
+    return iterator(this, 0);
+  }
+
+  iterator
+  end()
+  {
+    return iterator(this, m_slots.size());
+  }
+
+private:
+  static bool
+  makeKey(const std::string& ip, uint16_t port, uint64_t& key);
+
+  /** @return the position of @p key in the table, or of the empty
+   *          bucket that ends its probe sequence
+   */
+  size_t
+  findBucket(uint64_t key) const;
+
+  void
+  rehash(size_t capacity);
+
+private:
+  struct Slot
+  {
+    uint64_t key;
+    shared_ptr<Peer> peer;
+  };
+
+  // the peers, never moved, and the slots free for reuse
+  std::deque<Slot> m_slots;
+  std::vector<uint32_t> m_freeSlots;
+
+  // slot numbers by hash of the endpoint, EMPTY or ERASED,
+  // the capacity is a power of two
+  std::vector<uint32_t> m_table;
+  size_t m_size;
+  size_t m_numErased;
+};
+
+} // namespace sbt
+
+#endif // SBT_PEER_REGISTRY_HPP
@@ -3,668 +3,1906 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include "peer.hpp"
-#include "msg/handshake.hpp"
 #include "util/buffer-stream.hpp"
 #include "util/hash.hpp"
 
 namespace sbt {
 
+const size_t Peer::MIN_PIPELINE_DEPTH = 5;
+const size_t Peer::MAX_PIPELINE_DEPTH = 250;
+// upper bound on the round trip time the pipeline should cover
+const double Peer::REQUEST_QUEUE_TIME = 3.0;
+// a few blocks per recv(), at least one message of the longest
+const size_t Peer::RECV_BUFFER_SIZE = 131072;
+// queued bytes that are sent without waiting for the end of
+// the loop iteration, and that stop more blocks from being queued
+const size_t Peer::SEND_FLUSH_SIZE = 16384;
+const size_t Peer::MAX_SEND_QUEUE_SIZE = 524288;
+// seconds a connect may take, and to wait before trying again
+const int Peer::CONNECT_TIMEOUT = 5;
+const int Peer::CONNECT_BACKOFF = 5;
+const int Peer::MAX_CONNECT_BACKOFF = 300;
+// seconds without sending anything before a keep-alive, without
+// receiving anything before we hang up, and without a block
+// before the outstanding requests are given up
+const int Peer::KEEP_ALIVE_INTERVAL = 120;
+const int Peer::IDLE_TIMEOUT = 300;
+const int Peer::REQUEST_TIMEOUT = 60;
+// pieces a choked peer may download, enough to get started with
+const size_t Peer::ALLOWED_FAST_SIZE = 10;
+// the longest block we serve, the usual is 16 KiB and no client
+// asks for more than 128 KiB
+const uint32_t Peer::MAX_REQUEST_LENGTH = 131072;
+
 Peer::Peer (std::string peerId,
       std::string ip,
       uint16_t port)
 : m_peerId(peerId)
 , m_ip(ip)
 , m_port(port)
-, m_activePiece(-1) 
+, m_id(-1)
+, m_sock(-1)
+, m_state(STATE_IDLE)
+, m_isIncoming(false)
+, m_loop(NULL)
+, m_recvBuf(make_shared<Buffer>())
+, m_recvBegin(0)
+, m_recvEnd(0)
+, m_sendQueueSize(0)
+, m_sendOffset(0)
+, m_isFlushScheduled(false)
+, m_isWaitingOnWorkers(false)
+, m_numConnectFailures(0)
+, m_timer(0)
 , interested(false) 
-, requested(false) 
+, m_pipelineDepth(MIN_PIPELINE_DEPTH)
+, m_minPipelineDepth(MIN_PIPELINE_DEPTH)
+, m_maxPipelineDepth(MAX_PIPELINE_DEPTH)
+, m_rateBytes(0)
 , unchoked(false) 
 , unchoking(false) 
+, m_isPeerInterested(false)
+, m_supportsFast(false)
+, m_downloaded(0)
+, m_uploaded(0)
+, m_lastDownloaded(0)
+, m_lastUploaded(0)
+, m_downloadRate(0)
+, m_uploadRate(0)
+, m_isUploadWaiting(false)
+, m_isDownloadWaiting(false)
+, m_hasDownloadCredit(false)
+, m_bucketTimer(0)
 {
 
 }
 
 Peer::Peer (int sockfd)
-: m_sock(sockfd) 
-, m_activePiece(-1) 
+: m_port(0)
+, m_id(-1)
+, m_sock(sockfd) 
+, m_state(STATE_IDLE)
+, m_isIncoming(true)
+, m_loop(NULL)
+, m_recvBuf(make_shared<Buffer>())
+, m_recvBegin(0)
+, m_recvEnd(0)
+, m_sendQueueSize(0)
+, m_sendOffset(0)
+, m_isFlushScheduled(false)
+, m_isWaitingOnWorkers(false)
+, m_numConnectFailures(0)
+, m_timer(0)
 , interested(false) 
-, requested(false) 
+, m_pipelineDepth(MIN_PIPELINE_DEPTH)
+, m_minPipelineDepth(MIN_PIPELINE_DEPTH)
+, m_maxPipelineDepth(MAX_PIPELINE_DEPTH)
+, m_rateBytes(0)
 , unchoked(false) 
 , unchoking(false) 
+, m_isPeerInterested(false)
+, m_supportsFast(false)
+, m_downloaded(0)
+, m_uploaded(0)
+, m_lastDownloaded(0)
+, m_lastUploaded(0)
+, m_downloadRate(0)
+, m_uploadRate(0)
+, m_isUploadWaiting(false)
+, m_isDownloadWaiting(false)
+, m_hasDownloadCredit(false)
+, m_bucketTimer(0)
 {
 }
 
 void 
-Peer::setClientData(std::vector<bool>* clientPiecesDone,
-                    std::vector<bool>* clientPiecesLocked,
+Peer::setClientData(Bitfield* clientPiecesDone,
+                    PiecePicker* picker,
+                    PartialPieceMap* partials,
                     MetaInfo *metaInfo,
-                    std::vector<Peer>* peers,
-                    FILE *clientFile,
-                    pthread_mutex_t *clientPieceLock,
-                    pthread_mutex_t *clientFileLock)
+                    PeerRegistry* peers,
+                    shared_ptr<Storage> clientStorage,
+                    WorkerPool* workers,
+                    Choker* choker,
+                    RateLimiter* uploadLimiter,
+                    RateLimiter* downloadLimiter,
+                    ResumeData *clientResume)
 {
   m_clientPiecesDone = clientPiecesDone;
-  m_clientPiecesLocked = clientPiecesLocked;
+  m_picker = picker;
+  m_partials = partials;
   m_metaInfo = metaInfo;
   m_peers = peers;
-  m_clientFile = clientFile;
-  pieceLock = clientPieceLock;
-  pieceLock = clientFileLock;
+  m_clientStorage = clientStorage;
+  m_workers = workers;
+  m_choker = choker;
+  m_uploadLimiter = uploadLimiter;
+  m_downloadLimiter = downloadLimiter;
+  m_clientResume = clientResume;
 }
 
-// This function responds to the handshake of a 
-// peer attempting to initiate a connection, 
-// exchanges bitfields, and calls the main
-// run() function of the Peer
+// This function registers a connection accepted from
+// a peer with the event loop. The peer initiates the
+// handshake, we respond to it and exchange bitfields
+// from handleEvent() before running
 void
-Peer::respondAndRun()
+Peer::respondAndRun(EventLoop& loop)
 {
-  // wait for a handshake
-  if (waitOnHandshake()) {
-    // pthread_exit(NULL);
-    return;
-  } else {
-    log("handshake exchange successfull");
-  }
-
-  // send our handshake
-  msg::HandShake hs(m_metaInfo->getHash(), "SIMPLEBT.TEST.PEERID");
-  ConstBufferPtr hsMsg = hs.encode();
-  send(m_sock, hsMsg->buf(), hsMsg->size(), 0);
-
-  // construct our bitfield (don't send it yet)
-  // we use it's size to know how much bytes to 
-  // wait for on their bitfield
-  msg::Bitfield bf = constructBitfield();
-  ConstBufferPtr bfMsg = bf.encode(); 
-
-  // wait on the bitfield (this fctn also parses the bitfield)
-  if (waitOnBitfield(bfMsg->size())) {
-    // pthread_exit(NULL);
-    return;
-  } else {
-    log("bitfield exchange successfull");
-  }
+  m_loop = &loop;
+  m_state = STATE_HANDSHAKE;
 
-  // send our bitfield
-  send(m_sock, bfMsg->buf(), bfMsg->size(), 0);
+  EventLoop::setNonBlocking(m_sock);
+  m_loop->add(m_sock, EPOLLIN | EPOLLOUT | EPOLLRDHUP,
+              std::bind(&Peer::handleEvent, this, std::placeholders::_1));
 
-  // run the main peer loop
-  run();
+  m_lastReceived = std::chrono::steady_clock::now();
+  m_lastSent = m_lastReceived;
+  scheduleTimer();
 }
 
-// This function attempts to connect by initiating
-// a handshake, exchanges bitfields, and calls the
-// main run() function of the Peer
+// This function starts a non-blocking connect to the
+// peer. Once connected we initiate the handshake, and
+// the rest of the exchange is driven by handleEvent()
 void
-Peer::handshakeAndRun()
+Peer::handshakeAndRun(EventLoop& loop)
 {
   log("Attempting to connect...");
 
+  m_loop = &loop;
+
   // generate the socket and connect it
   int peerSock = socket(AF_INET, SOCK_STREAM, 0);
   setSock(peerSock);
-  if (connectSocket()) {
-    // pthread_exit(NULL);
-    return;
-  } else {
-    log("Connection successful");
-  }
-
-  // send our handshake
-  msg::HandShake hs(m_metaInfo->getHash(), "SIMPLEBT.TEST.PEERID");
-  ConstBufferPtr hsMsg = hs.encode();
-  send(m_sock, hsMsg->buf(), hsMsg->size(), 0);
-
-  // wait for a handshake
-  if (waitOnHandshake()) {
-    // pthread_exit(NULL);
-    return;
-  } else {
-    log("handshake exchange successfull");
-  }
+  EventLoop::setNonBlocking(m_sock);
 
-  // construct and send our bitfield 
-  msg::Bitfield bf = constructBitfield();
-  ConstBufferPtr bfMsg = bf.encode(); 
-  send(m_sock, bfMsg->buf(), bfMsg->size(), 0);
+  m_state = STATE_CONNECTING;
+  m_connectStart = std::chrono::steady_clock::now();
+  m_loop->add(m_sock, EPOLLIN | EPOLLOUT | EPOLLRDHUP,
+              std::bind(&Peer::handleEvent, this, std::placeholders::_1));
+  scheduleTimer();
 
-  // wait on the bitfield (this fctn also parses the bitfield)
-  if (waitOnBitfield(bfMsg->size())) {
-    // pthread_exit(NULL);
+  int status = connectSocket();
+  if (status < 0) {
+    failConnect();
     return;
-  } else {
-    log("bitfield exchange successfull");
   }
 
-  // hand off to the main running function
-  run();
+  // connected immediately (e.g., loopback)
+  if (status == 0)
+    onConnected();
 }
 
+// Closes a failed connection attempt and makes the peer idle
+// again, so that the client tries again once the backoff,
+// doubling with every failure, is over
 void
-Peer::run()
+Peer::failConnect()
 {
-  while (true) 
-  {
-    // check if all pieces are done
-    if (allPiecesDone()) {
-      // log("all pieces done");
-      //pthread_exit(NULL);
-    } else {
-
-      // if we are not waiting on unchoke or piece already 
-      if (!interested && !requested)
-      {
-        // if we have not acquired a piece, try finding one
-        if (m_activePiece < 0)
-          getFirstAvailablePiece();
-        
-        if (m_activePiece >= 0) {
-          // if we are choked, send a interested msg
-          if (!unchoked) {
-            msg::Interested interest;
-            ConstBufferPtr cbf = interest.encode();
-            send(m_sock, cbf->buf(), cbf->size(), 0);
-
-            interested = true;
-            log("Sent interested message"); 
-          }
-          // if not choked, send the request
-          else {
-            int pieceLength = m_metaInfo->getPieceLength(); 
-            // if it's the final piece, it's a diff length
-            if (m_activePiece == m_metaInfo->getNumPieces()-1) {
-              pieceLength = m_metaInfo->getLength() % m_metaInfo->getPieceLength();
-              if (pieceLength == 0)
-                pieceLength = m_metaInfo->getPieceLength();
-            }
-
-            msg::Request req(m_activePiece, 0, pieceLength); 
-            ConstBufferPtr cbf = req.encode();
-            send(m_sock, cbf->buf(), cbf->size(), 0);
-
-            requested = true;
-            log("Send request message for piece: " + std::to_string(m_activePiece) + " with length: " + std::to_string(pieceLength));
-          }
-        } else {
-          // no active piece found
-        }
-      }
-    }
-
-    waitOnMessage();
-  }
-}
+  closeConnection();
 
-// Finds the first available piece to download. If none
-// are found, returns -1
-// Locks the available piece
-void
-Peer::getFirstAvailablePiece()
-{
-  pthread_mutex_lock(pieceLock);
-  for (int i=0; i<m_metaInfo->getNumPieces(); i++) 
-  {
-    if (!m_clientPiecesLocked->at(i) && m_piecesDone.at(i)) {
-      (*m_clientPiecesLocked)[i] = true;
-      m_activePiece = i;
-      pthread_mutex_unlock(pieceLock);
-      return;
-    }
-  }
-  pthread_mutex_unlock(pieceLock);
+  m_numConnectFailures++;
+  int backoff = CONNECT_BACKOFF << std::min(m_numConnectFailures - 1, 16);
+  backoff = std::min(backoff, MAX_CONNECT_BACKOFF);
+  m_nextConnect = std::chrono::steady_clock::now() + std::chrono::seconds(backoff);
 
-  log("could not find piece from this peer");
-  return;
+  m_state = STATE_IDLE;
+  log("retrying to connect in " + std::to_string(backoff) + " seconds");
 }
 
-int
-Peer::connectSocket() 
+// called once the outgoing connection is established
+void
+Peer::onConnected()
 {
-  struct addrinfo hints;
-  struct addrinfo* res;
-
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_INET; // IPv4
-  hints.ai_socktype = SOCK_STREAM;
-
-  std::string peerPort = std::to_string(getPort());
-
-  // get address
-  int status = 0;
-  if ((status = getaddrinfo(getIp().c_str(), peerPort.c_str(), &hints, &res)) != 0) 
-  {
-    log("Could not find addrinfo for IP");
-    return -1;
-  }
+  log("Connection successful");
+  m_numConnectFailures = 0;
 
-  struct sockaddr_in* ipv4 = (struct sockaddr_in*)res->ai_addr;
-  char ipstr[INET_ADDRSTRLEN] = {'\0'};
-  inet_ntop(res->ai_family, &(ipv4->sin_addr), ipstr, sizeof(ipstr));
+  // send our handshake, and our bitfield right behind it
+  // instead of waiting on theirs, they go out in one write.
+  // We don't know yet whether the peer supports the fast
+  // extension, so this is always a plain bitfield
+  sendMessage(constructHandshake().encode());
+  sendMessage(constructBitfield().encode());
 
-  if (connect(getSock(), res->ai_addr, res->ai_addrlen) == -1) {
-    perror("connect");
-    return -1;
-  }
-
-  freeaddrinfo(res);
+  m_state = STATE_HANDSHAKE;
 
-  return 0;
+  // from now on the peer has to keep talking
+  m_lastReceived = std::chrono::steady_clock::now();
+  scheduleTimer();
 }
 
-// Waits on a handshake, returns 0 if recieved a successful handshake
-// returns -1 if the handshake has the wrong hash or error
-int
-Peer::waitOnHandshake()
+// Sets the timer to the earliest deadline of the state: the
+// connect timeout while connecting, then hanging up on a silent
+// peer, sending a keep-alive and giving up unanswered requests
+void
+Peer::scheduleTimer()
 {
-  int HANDSHAKE_LENGTH = 68;
-  int status;
+  using namespace std::chrono;
 
-  // handshake is always length 68
-  char *hsBuf = (char *) malloc (HANDSHAKE_LENGTH);
-  if ((status = recv(m_sock, hsBuf, HANDSHAKE_LENGTH, 0)) == -1) {
-    perror("recv");
-    return -1;
+  if (m_timer != 0) {
+    m_loop->cancel(m_timer);
+    m_timer = 0;
   }
 
-  ConstBufferPtr cbf = std::make_shared<Buffer> (hsBuf, HANDSHAKE_LENGTH);
-  msg::HandShake hs;
-  hs.decode(cbf);
-
-  // update the peer ID
-  setPeerId(hs.getPeerId());
-
-  // check the info hashes match. 
-  if (memcmp(m_metaInfo->getHash()->buf(), 
-             hs.getInfoHash()->buf(), 
-             20) != 0) {
-    log("detected incorrect hash on handshake");
-    // pthread_exit(NULL);
-    return -1;
+  steady_clock::time_point deadline;
+  if (m_state == STATE_CONNECTING) {
+    deadline = m_connectStart + seconds(CONNECT_TIMEOUT);
+  }
+  else if (m_state == STATE_HANDSHAKE || m_state == STATE_BITFIELD ||
+           m_state == STATE_RUNNING) {
+    deadline = m_lastReceived + seconds(IDLE_TIMEOUT);
+
+    if (m_state == STATE_RUNNING)
+      deadline = std::min(deadline, m_lastSent + seconds(KEEP_ALIVE_INTERVAL));
+    if (!m_requests.empty())
+      deadline = std::min(deadline, m_lastBlock + seconds(REQUEST_TIMEOUT));
+  }
+  else {
+    return;
   }
 
-  return 0;
+  steady_clock::duration delay = std::max(deadline - steady_clock::now(),
+                                          steady_clock::duration::zero());
+  m_timer = m_loop->schedule(delay, std::bind(&Peer::onTimer, this));
 }
 
-// Input: size- the size of the Bitfield msg we are expecting,
-// INLCLUDING length/id of the msg 
-// Waits on a bitfield, returns 0 if recieved a successful 
-// returns -1 if the bitfield is the wrong length or error
-// This function also calls setBitfield, which parses the
-// bitfield in m_piecesDone
-int
-Peer::waitOnBitfield(int size)
+void
+Peer::onTimer()
 {
-  int status;
+  using namespace std::chrono;
 
-  char *bfBuf = (char *) malloc (size);
-  if ((status = recv(m_sock, bfBuf, size, 0)) == -1) {
-    perror("recv");
-    return -1;
+  m_timer = 0;
+  steady_clock::time_point now = steady_clock::now();
+
+  // e.g., to a blackholed address
+  if (m_state == STATE_CONNECTING) {
+    if (now - m_connectStart >= seconds(CONNECT_TIMEOUT)) {
+      log("connect timed out");
+      failConnect();
+      return;
+    }
+  }
+  else if (now - m_lastReceived >= seconds(IDLE_TIMEOUT)) {
+    log("connection timed out");
+    closeConnection();
+    return;
   }
 
-  // length is first four bytes
-  // uint32_t length = ntohl(*reinterpret_cast<uint32_t *> (bfBuf));
-  // next byte is the ID 
-  // uint8_t id = *(bfBuf+4);
+  if (m_state == STATE_RUNNING && now - m_lastSent >= seconds(KEEP_ALIVE_INTERVAL)) {
+    msg::KeepAlive keepAlive;
+    sendMessage(keepAlive);
+  }
 
-  // next bytes are the bitfield
-  char *bitfield = bfBuf+5;
-  setBitfield(bitfield, m_metaInfo->getNumPieces());
+  if (!m_requests.empty() && now - m_lastBlock >= seconds(REQUEST_TIMEOUT))
+    timeoutRequests();
 
-  return 0;
+  scheduleTimer();
 }
 
-int
-Peer::waitOnMessage()
+void
+Peer::handleEvent(uint32_t events)
 {
-  int status;
+  // a malformed message (or anything else going wrong with
+  // this peer) only closes its connection, not the client
+  try {
+    if (m_state == STATE_CONNECTING) {
+      if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+        return;
+
+      int error = 0;
+      socklen_t len = sizeof(error);
+      if (getsockopt(m_sock, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+        log("connect failed: " + std::string(strerror(error)));
+        failConnect();
+        return;
+      }
 
-  // first, we wait on a length and ID, which will always be 5 bytes
-  char *msgBuf = (char *) malloc (5);
-  if ((status = recv(m_sock, msgBuf, 5, 0)) == -1) {
-    log("recv error");
-    perror("recv");
-    return -1;
-  }
+      onConnected();
+    }
 
-  // first 4 bytes are the length
-  uint32_t length = ntohl(*reinterpret_cast<uint32_t *> (msgBuf));
-  uint32_t msgLength = length+4;
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+      readSocket();
 
-  // next byte is the ID 
-  uint8_t id = *(msgBuf+4);
+    // the requests (or our interest) go out with the messages
+    // queued while reading
+    if (m_state == STATE_RUNNING)
+      run();
 
-  // if there is a body to recieve, wait for it
-  if (length > 1) {
-    // reallocate the msgBuf to the proper length
-    msgBuf = (char *)realloc(msgBuf, msgLength);
-    if ((status = recv(m_sock, msgBuf+5, msgLength-5, 0)) == -1) {
-      log("recv error");
-      perror("recv");
-      return -1;
+    if (m_state != STATE_CLOSED && (events & EPOLLOUT)) {
+      flushSendQueue();
+
+      // the blocks held back while the queue was full
+      if (m_state == STATE_RUNNING)
+        sendReadBlocks();
     }
   }
-
-  ConstBufferPtr cbf = std::make_shared<Buffer> (msgBuf, msgLength);
-
-  switch (id) {
-    case msg::MSG_ID_UNCHOKE:
-      handleUnchoke(cbf);
-      break;
-    case msg::MSG_ID_INTERESTED:
-      handleInterested(cbf);
-      break;
-    case msg::MSG_ID_HAVE:
-      handleHave(cbf);
-      break;
-    case msg::MSG_ID_BITFIELD:
-      handleBitfield(cbf);
-      break;
-    case msg::MSG_ID_REQUEST:
-      handleRequest(cbf);
-      break;
-    case msg::MSG_ID_PIECE:
-      handlePiece(cbf);
-      break;
-    case msg::MSG_ID_KEEP_ALIVE:
-      log("Unsupported: keep alive message");
-      break;
-    case msg::MSG_ID_CHOKE:
-      log("Unsupported: choke message");
-      break;
-    case msg::MSG_ID_NOT_INTERESTED:
-      log("Unsupported: not interested message");
-      break;
-    case msg::MSG_ID_CANCEL:
-      log("Unsupported: cancel message");
-      break;
-    case msg::MSG_ID_PORT:
-      log("Unsupported: port message");
-      break;
-    default:
-      log("Recieved unknown message, not doing anything");
-      break;
+  catch (const msg::Error& e) {
+    log("recieved malformed message: " + std::string(e.what()));
+    closeConnection();
+  }
+  catch (const std::exception& e) {
+    log("connection error: " + std::string(e.what()));
+    closeConnection();
   }
-
-  return 0;
 }
 
-// input: a bitfield (highest bit is first piece), 
-//        size: the number of BITS in the bf
-//        NOTE that this is not the amount of bytes
-//        in the bitfield nor the amount of bytes
-//        of the bitfield message
-// parses a bitfield into m_piecesDone
+// Drives the downloading side of the state machine. This
+// acquires pieces and keeps the pipeline of block requests
+// full, or tells the peer we are interested while choked.
+// Called after every event, and by the client when work was
+// released that this peer may pick up
 void
-Peer::setBitfield(char *bitfield, int size)
+Peer::run()
 {
-  if (size > 32) {
-    log("ERROR: can't yet handle bitfields of size > 32");
-    m_piecesDone = std::vector<bool> (size);
+  if (m_state != STATE_RUNNING)
+    return;
+
+  // blocks held back by our own upload limit
+  sendReadBlocks();
+
+  // check if all pieces are done
+  if (allPiecesDone())
     return;
-  }
 
-  m_piecesDone = std::vector<bool> (size);
+  if (!unchoked) {
+    // if we are not waiting on unchoke already, and the peer has
+    // something for us, send a interested msg
+    if (!interested) {
+      if (!hasPartialPiece(m_piecesDone) && pickPiece(m_piecesDone) < 0)
+        return;
 
-  for (int i=0; i < size; i++) {
-    if (*bitfield & (1 << (32-i))) {
-      m_piecesDone[i] = true; 
-    } else {
-      m_piecesDone[i] = false;
+      msg::Interested interest;
+      sendMessage(interest);
+
+      interested = true;
+      log("Sent interested message"); 
     }
+
+    // the allowed fast pieces can be downloaded meanwhile
+    if (!m_supportsFast || !m_allowedFast.intersects(m_piecesDone))
+      return;
+
+    Bitfield allowed(m_allowedFast);
+    allowed &= m_piecesDone;
+    requestBlocks(allowed);
+    return;
   }
-  
-  return;
 
-  // OLD LOGGING CODE
-  // // with a (full!) bitfield length of 23
-  // // bitfield = 1111 1111 1111 1111 1111 111|X XXXX XXXX
-  // // where X's are bits we don't care about
-  // uint32_t a = *(reinterpret_cast<uint32_t *> (bitfield));
-  //
-  // std::cout << "bitfield: ";
-  // for (int i=0; i<32; i++)
-  //   std::cout << ((a >> (31-i)) & 1);
-  // std::cout << std::endl;
-  // std::cout << "bitfield (as uint32_t): " << a << std::endl;
-  //
-  // // a >> 9 = 0000 0000 0|111 1111 1111 1111 1111 1111
-  // uint32_t b = a >> (32-size);
-}
+  // if this peer has none of the pieces in progress, try finding one
+  if (!hasPartialPiece(m_piecesDone) && pickPiece(m_piecesDone) < 0) {
+    // no active piece found
+    return;
+  }
 
-void 
-Peer::log(std::string msg)
-{
-  std::cout << "(" << m_peerId << "): " << msg << std::endl;
-  return;
+  requestBlocks(m_piecesDone);
 }
 
-void Peer::handleUnchoke(ConstBufferPtr cbf)
+// Sends requests for blocks of the @p candidates pieces until
+// the pipeline is full, or the download limits are reached
+void
+Peer::requestBlocks(const Bitfield& candidates)
 {
-  log("recieved unchoke");
+  while (m_requests.size() < m_pipelineDepth) {
+    // the blocks could not be written anyway
+    if (m_workers->isFull()) {
+      m_isWaitingOnWorkers = true;
+      break;
+    }
 
-  unchoked = true;
-  interested = false;
-  return;
-}
+    if (!acquireDownloadCredit())
+      break;
 
-void Peer::handleInterested(ConstBufferPtr cbf)
-{
-  log("recieved interested");
+    BlockRequest request;
 
-  msg::Unchoke unchoke;
-  ConstBufferPtr resp = unchoke.encode();
-  send(m_sock, resp->buf(), resp->size(), 0);
+    if (nextBlock(request, candidates)) {
+      sendRequest(request);
+      continue;
+    }
 
-  unchoking = true;
+    // all blocks of the pieces in progress are requested,
+    // start another piece
+    if (pickPiece(candidates) >= 0)
+      continue;
 
-  return;
+    // nothing left to pick, ask for the blocks that are
+    // still outstanding at other (possibly slow) peers too
+    if (!nextEndgameBlock(request, candidates))
+      break;
+
+    sendRequest(request);
+  }
 }
 
-void Peer::handleHave(ConstBufferPtr cbf)
+// Picks the rarest of the @p candidates pieces (that this
+// peer has) that nobody is downloading yet and starts
+// assembling it. If none are found, returns -1
+int
+Peer::pickPiece(const Bitfield& candidates)
 {
-  log("recieved have");
-
-  msg::Have have;
-  have.decode(cbf);
+  int index = m_picker->pick(candidates);
 
-  // set the piece 
-  m_piecesDone[have.getIndex()] = true;
+  if (index < 0) {
+    log("could not find piece from this peer");
+    return -1;
+  }
 
-  return;
+  (*m_partials)[index] = make_shared<PartialPiece>(index, getPieceSize(index));
+  return index;
 }
 
-
-void Peer::handleBitfield(ConstBufferPtr cbf)
+// true if one of the pieces in progress is a candidate
+bool
+Peer::hasPartialPiece(const Bitfield& candidates)
 {
-  log("Recieved bitfield out of order");
-  //pthread_exit(NULL);
-  return;
+  for (const auto& partial : *m_partials) {
+    if (candidates.test(partial.first))
+      return true;
+  }
+
+  return false;
 }
 
-void Peer::handleRequest(ConstBufferPtr cbf)
+// finds a block of the candidate pieces in progress that
+// nobody requested yet
+bool
+Peer::nextBlock(BlockRequest& request, const Bitfield& candidates)
 {
+  for (auto& partial : *m_partials) {
+    if (!candidates.test(partial.first))
+      continue;
 
-  msg::Request req;
-  req.decode(cbf);
+    if (partial.second->nextBlock(request.begin, request.length)) {
+      request.index = partial.first;
+      return true;
+    }
+  }
 
-  int index = req.getIndex();
-  int begin = req.getBegin();
-  int length = req.getLength();
+  return false;
+}
 
-  // TODO: sanity checks that above are valid?
+// In endgame, finds a block of the candidate pieces that is
+// requested from another peer but not yet from us
+bool
+Peer::nextEndgameBlock(BlockRequest& request, const Bitfield& candidates)
+{
+  bool isEndgame = m_picker->isEndgame();
 
-  log("recieved request with index: " + std::to_string(index) +
-      ", begin: " + std::to_string(begin) + ", length: " +
-      std::to_string(length));
+  if (!isEndgame)
+    return false;
 
-  if (unchoking) {
-    // read from file
-    char *rBuf = (char *) malloc (sizeof(char)*length);
+  for (auto& partial : *m_partials) {
+    if (!candidates.test(partial.first))
+      continue;
 
-    if (!m_clientFile) {
-      log("ERROR: file pointer closed");
-      return;
-    }
+    for (size_t i = 0; i < partial.second->getNumBlocks(); i++) {
+      if (isRequested(partial.first, i * PartialPiece::BLOCK_SIZE))
+        continue;
 
-    // critical section: seeking/writing to file
-    pthread_mutex_lock(fileLock);
-    fseek(m_clientFile, index * m_metaInfo->getPieceLength() + begin, SEEK_SET);
-    if (fread(rBuf, 1, length, m_clientFile) != length) {
-      log("fread error");
-      pthread_mutex_unlock(fileLock);
-      return;
+      if (partial.second->requestAgain(i, request.begin, request.length)) {
+        request.index = partial.first;
+        log("endgame: requesting piece " + std::to_string(request.index) +
+            " begin: " + std::to_string(request.begin) + " again");
+        return true;
+      }
     }
-    pthread_mutex_unlock(fileLock);
+  }
+
+  return false;
+}
 
-    // send off the piece
-    ConstBufferPtr block = std::make_shared<const Buffer> (rBuf, length);
-    msg::Piece piece(index, begin, block);
-    ConstBufferPtr resp = piece.encode();
-    send(m_sock, resp->buf(), resp->size(), 0);
+bool
+Peer::isRequested(int pieceIndex, uint32_t begin)
+{
+  for (const auto& request : m_requests) {
+    if (request.index == pieceIndex && request.begin == begin)
+      return true;
   }
 
-  return;
+  return false;
 }
 
-void Peer::handlePiece(ConstBufferPtr cbf)
+void
+Peer::sendRequest(const BlockRequest& request)
 {
-  msg::Piece piece;
-  piece.decode(cbf);
+  msg::Request req(request.index, request.begin, request.length); 
+  sendMessage(req);
+  m_requests.push_back(request);
+
+  // the request timeout starts with the first request
+  if (m_requests.size() == 1) {
+    m_lastBlock = std::chrono::steady_clock::now();
+    scheduleTimer();
+  }
 
-  log("recieved piece " + std::to_string(piece.getIndex()) + " length: " + std::to_string(piece.getBlock()->size()));
-  ConstBufferPtr pieceSha1 = util::sha1(piece.getBlock());
-  
-  if (!equal(pieceSha1, m_metaInfo->getHashOfPiece(piece.getIndex()))) {
-    log("difference in hash");
-  } else {
-    //TODO: check if we have the file?
-
-    //write to file
-    if (writeToFile(piece.getIndex(), piece.getBlock())) {
-      log("Problem writing to file");
-    } else {
-      log("Successfully wrote to file");
-      pthread_mutex_lock(pieceLock);
-      (*m_clientPiecesDone)[piece.getIndex()] = true;
-      (*m_clientPiecesLocked)[piece.getIndex()] = true; // just in case
-      pthread_mutex_unlock(pieceLock);
-
-      m_activePiece = -1;
-    }
+  m_hasDownloadCredit = false;
+  m_downloadBucket.consume(request.length);
 
-    // TODO: add pack
-    // send have to all peers
-    for (auto& peer : *m_peers) {
-      peer.sendHave(piece.getIndex());
-      log("sent have to " + peer.getPeerId());
-    }
+  log("Send request message for piece: " + std::to_string(request.index) +
+      " begin: " + std::to_string(request.begin) +
+      " with length: " + std::to_string(request.length));
+}
 
+// returns the length of a piece, the final piece
+// may be shorter than the others
+int
+Peer::getPieceSize(int pieceIndex)
+{
+  int pieceLength = m_metaInfo->getPieceLength(); 
+  // if it's the final piece, it's a diff length
+  if (pieceIndex == m_metaInfo->getNumPieces()-1) {
+    pieceLength = m_metaInfo->getLength() % m_metaInfo->getPieceLength();
+    if (pieceLength == 0)
+      pieceLength = m_metaInfo->getPieceLength();
   }
 
-  requested = false;
-
-  return;
+  return pieceLength;
 }
 
-// sends a "have" message to this peer with the pieceIndex
+// Sizes the pipeline to the bandwidth-delay product: once a
+// second the measured download rate is turned into the number
+// of blocks needed to cover REQUEST_QUEUE_TIME of round trip
 void
-Peer::sendHave(int pieceIndex)
+Peer::updatePipelineDepth(size_t bytes)
 {
-  msg::Have have(pieceIndex);
-  ConstBufferPtr cbf = have.encode();
-  send(m_sock, cbf->buf(), cbf->size(), 0);
-  return; 
+  using namespace std::chrono;
+
+  m_rateBytes += bytes;
+
+  steady_clock::time_point now = steady_clock::now();
+  double elapsed = duration_cast<duration<double>>(now - m_rateStart).count();
+  if (elapsed < 1.0)
+    return;
+
+  double rate = m_rateBytes / elapsed;
+  size_t depth = static_cast<size_t>(rate * REQUEST_QUEUE_TIME / PartialPiece::BLOCK_SIZE) + 1;
+  m_pipelineDepth = std::min(std::max(depth, m_minPipelineDepth), m_maxPipelineDepth);
+
+  m_rateBytes = 0;
+  m_rateStart = now;
 }
 
-// constructs a bitfield based on the client's current files
-msg::Bitfield
-Peer::constructBitfield()
+// drops all outstanding requests, e.g., after being choked
+// (the peer discards them), so the blocks can be requested again
+void
+Peer::abortRequests()
 {
+  if (!m_requests.empty())
+    m_picker->setWorkReleased();
 
-  // construct a bitfield
-  int64_t fileLength = m_metaInfo->getLength();
-  int64_t pieceLength = m_metaInfo->getPieceLength();
-  int numPieces = fileLength / pieceLength + (fileLength % pieceLength == 0 ? 0 : 1);
-  int numBytes = numPieces/8 + (numPieces%8 == 0 ? 0 : 1);
+  for (const auto& request : m_requests) {
+    auto partial = m_partials->find(request.index);
+    if (partial != m_partials->end())
+      partial->second->abortBlock(request.begin);
+  }
 
-  char *bitfield = (char *) malloc(numBytes);
-  memset(bitfield, 0, numBytes);
+  m_requests.clear();
+}
 
-  int byteNum, bitNum;
-  for (int count=0; count < numPieces; count++)
-  {
-    byteNum = count / 8;    
-    bitNum = count % 8;
+// Gives up the requests of a peer that stopped sending blocks,
+// so that other peers can download them, and lets it have a
+// single request until it recovers its rate
+void
+Peer::timeoutRequests()
+{
+  log("requests timed out");
 
-    if (m_clientPiecesDone->at(count)) {
-      *(bitfield+byteNum) |= 1 << (7-bitNum);
-    } 
+  for (const auto& request : m_requests) {
+    msg::Cancel cancel(request.index, request.begin, request.length);
+    sendMessage(cancel);
   }
 
-  OBufferStream bfstream;
-  bfstream.write(bitfield, numBytes);
-  msg::Bitfield bf_struct(bfstream.buf());
-
-  return bf_struct;
+  abortRequests();
+  m_pipelineDepth = 1;
 }
 
-// writes the piece index to the file
+// Starts connecting the (non-blocking) socket. The address
+// is numeric, so nothing blocks on a resolver. Returns 0 if
+// connected, 1 if the connect is in progress and -1 on error
 int
-Peer::writeToFile(int pieceIndex, ConstBufferPtr piece)
+Peer::connectSocket() 
 {
-  if (!m_clientFile) {
-    log("File pointer not open, returning");
-    return -1;
-  }
-
-  // sanity check: piece length
-  int pieceLength = m_metaInfo->getPieceLength(); 
-  // if it's the final piece, it's a diff length
-  if (pieceIndex == m_metaInfo->getNumPieces()-1) {
-    pieceLength = m_metaInfo->getLength() % m_metaInfo->getPieceLength();
-    if (pieceLength == 0)
-      pieceLength = m_metaInfo->getPieceLength();
-  }
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET; // IPv4
+  addr.sin_port = htons(getPort());
 
-  if (piece->size() != pieceLength) {
-    log("Incorrect piece length in writeToFile");
+  if (inet_pton(AF_INET, getIp().c_str(), &addr.sin_addr) != 1) {
+    log("Could not parse IP " + getIp());
     return -1;
   }
 
-  int piecePosStart = pieceIndex * m_metaInfo->getPieceLength();
+  int status = connect(getSock(), reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
 
-  // fseek
-  pthread_mutex_lock(fileLock);
-  fseek(m_clientFile, piecePosStart, SEEK_SET);
-  // write the buffer
-  fwrite(piece->buf(), 1, piece->size(), m_clientFile);
-  pthread_mutex_unlock(fileLock);
+  if (status == -1) {
+    if (errno == EINPROGRESS)
+      return 1;
 
-  // update bytes downloaded
-  // TODO: critical section inside here
-  m_metaInfo->increaseBytesDownloaded(pieceLength);
+    perror("connect");
+    return -1;
+  }
 
   return 0;
 }
 
-bool
-Peer::allPiecesDone()
+// Makes room after the received data in m_recvBuf. The bytes
+// before m_recvBegin may still be viewed by handled messages
+// (e.g., a block being written), they are only overwritten
+// once nobody else holds the buffer, otherwise the partial
+// message moves to a new buffer
+void
+Peer::makeRecvSpace()
 {
-  for (int i=0; i<m_metaInfo->getNumPieces(); i++) 
-  {
-    if (!m_clientPiecesDone->at(i)) {
-      return false;
+  size_t capacity = std::max(RECV_BUFFER_SIZE, getMaxMessageLength() + 4);
+  size_t pending = m_recvEnd - m_recvBegin;
+  bool hasRoom = m_recvBuf->size() == capacity && m_recvEnd < capacity;
+
+  if (m_recvBuf.use_count() == 1 && m_recvBuf->size() == capacity) {
+    // move the partial message to the front when we run
+    // out of room, or for free when there is none
+    if (m_recvBegin > 0 && (pending == 0 || !hasRoom)) {
+      memmove(m_recvBuf->buf(), m_recvBuf->buf() + m_recvBegin, pending);
+      m_recvBegin = 0;
+      m_recvEnd = pending;
     }
+    return;
   }
 
-  return true;
+  if (hasRoom)
+    return;
+
+  BufferPtr buffer = make_shared<Buffer>(capacity);
+  std::copy(m_recvBuf->begin() + m_recvBegin, m_recvBuf->begin() + m_recvEnd,
+            buffer->begin());
+  m_recvBuf = buffer;
+  m_recvBegin = 0;
+  m_recvEnd = pending;
+}
+
+// the longest message we accept: a block we requested, or the
+// bitfield of a large torrent
+size_t
+Peer::getMaxMessageLength()
+{
+  size_t pieceLength = msg::Piece::HEADER_LENGTH - 4 + PartialPiece::BLOCK_SIZE;
+  size_t bitfieldLength = 1 + (m_metaInfo->getNumPieces() + 7) / 8;
+
+  return std::max(pieceLength, bitfieldLength);
+}
+
+// Reads as much as fits into m_recvBuf with every recv() and
+// handles the complete messages right after, a partial one
+// stays for the next read. The socket is edge triggered so we
+// read until EAGAIN
+void
+Peer::readSocket()
+{
+  // the messages left in the buffer while waiting on the workers
+  processRecvBuffer();
+
+  while (m_state != STATE_CLOSED && !m_isWaitingOnWorkers) {
+    makeRecvSpace();
+
+    ssize_t n = recv(m_sock, m_recvBuf->buf() + m_recvEnd,
+                     m_recvBuf->size() - m_recvEnd, 0);
+
+    if (n > 0) {
+      m_recvEnd += n;
+      m_lastReceived = std::chrono::steady_clock::now();
+      processRecvBuffer();
+      continue;
+    }
+
+    if (n == 0) {
+      log("connection closed by peer");
+      closeConnection();
+      return;
+    }
+
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return;
+
+    log("recv error");
+    perror("recv");
+    closeConnection();
+    return;
+  }
+}
+
+// Parses as many complete handshakes/messages out of
+// m_recvBuf as are available, leaving partial ones. The
+// messages are handled in place as views of m_recvBuf
+void
+Peer::processRecvBuffer()
+{
+  static const size_t HANDSHAKE_LENGTH = 68;
+
+  while (m_state == STATE_HANDSHAKE || m_state == STATE_BITFIELD ||
+         m_state == STATE_RUNNING) {
+    size_t offset = m_recvBegin;
+    size_t available = m_recvEnd - offset;
+
+    if (m_state == STATE_HANDSHAKE) {
+      // handshake is always length 68
+      if (available < HANDSHAKE_LENGTH)
+        break;
+
+      m_recvBegin += HANDSHAKE_LENGTH;
+      handleHandshake(BufferView(m_recvBuf, offset, HANDSHAKE_LENGTH).copy());
+      continue;
+    }
+
+    // first 4 bytes are the length
+    if (available < 4)
+      break;
+
+    uint32_t length = ntohl(*reinterpret_cast<const uint32_t *> (m_recvBuf->buf() + offset));
+    if (length > getMaxMessageLength()) {
+      log("recieved message of length " + std::to_string(length) + ", too long");
+      closeConnection();
+      break;
+    }
+
+    uint32_t msgLength = length+4;
+    if (available < msgLength)
+      break;
+
+    // requests and blocks go through the workers, leave them in the
+    // buffer (and the rest on the socket) until there is room
+    if (m_state == STATE_RUNNING && length > 0 &&
+        ((*m_recvBuf)[offset + 4] == msg::MSG_ID_REQUEST ||
+         (*m_recvBuf)[offset + 4] == msg::MSG_ID_PIECE) &&
+        m_workers->isFull()) {
+      m_isWaitingOnWorkers = true;
+      break;
+    }
+
+    BufferView cbf(m_recvBuf, offset, msgLength);
+    m_recvBegin += msgLength;
+
+    if (m_state == STATE_BITFIELD) {
+      int numPieces = m_metaInfo->getNumPieces();
+
+      // this parses the bitfield into m_piecesDone. A peer with no
+      // pieces may skip the bitfield, then this is a regular msg
+      if (length > 1 && cbf[4] == msg::MSG_ID_BITFIELD) {
+        if (length - 1 < static_cast<uint32_t>((numPieces + 7) / 8)) {
+          log("bitfield is too short");
+          closeConnection();
+          break;
+        }
+
+        setBitfield(cbf.data() + 5, numPieces);
+        cbf = BufferView();
+      }
+      else if (m_supportsFast && length == 1 && cbf[4] == msg::MSG_ID_HAVE_ALL) {
+        m_piecesDone = Bitfield(numPieces);
+        for (int i = 0; i < numPieces; i++)
+          m_piecesDone.set(i);
+
+        m_picker->addPeer(m_piecesDone);
+        cbf = BufferView();
+      }
+      else {
+        if (m_supportsFast && length == 1 && cbf[4] == msg::MSG_ID_HAVE_NONE)
+          cbf = BufferView();
+
+        m_piecesDone = Bitfield(numPieces);
+      }
+
+      log("bitfield exchange successfull");
+
+      m_state = STATE_RUNNING;
+      m_rateStart = std::chrono::steady_clock::now();
+
+      m_allowedFast = Bitfield(numPieces);
+      m_allowedFastForPeer = Bitfield(numPieces);
+      if (m_supportsFast)
+        sendAllowedFast();
+
+      if (!cbf)
+        continue;
+    }
+
+    handleMessage(cbf);
+  }
+}
+
+// Handles the remote handshake, closes the connection
+// if the handshake has the wrong hash
+void
+Peer::handleHandshake(ConstBufferPtr cbf)
+{
+  msg::HandShake hs;
+  hs.decode(cbf);
+
+  // update the peer ID
+  setPeerId(hs.getPeerId());
+
+  // we always announce the fast extension
+  m_supportsFast = hs.supportsFastExtension();
+
+  // check the info hashes match. 
+  if (memcmp(m_metaInfo->getHash()->buf(), 
+             hs.getInfoHash()->buf(), 
+             20) != 0) {
+    log("detected incorrect hash on handshake");
+    closeConnection();
+    return;
+  }
+
+  log("handshake exchange successfull");
+
+  if (m_isIncoming) {
+    // send our handshake and bitfield, then wait on their bitfield,
+    // which usually came with their handshake already. Our interest
+    // follows it, before the messages are sent
+    sendMessage(constructHandshake().encode());
+    sendBitfield();
+  }
+
+  m_state = STATE_BITFIELD;
+}
+
+void
+Peer::handleMessage(const BufferView& cbf)
+{
+  // first 4 bytes are the length, next byte is the ID 
+  uint32_t length = ntohl(*reinterpret_cast<const uint32_t *> (cbf.data()));
+  uint8_t id = (length == 0 ? msg::MSG_ID_KEEP_ALIVE : cbf[4]);
+
+  if (id >= msg::MSG_ID_SUGGEST_PIECE && id <= msg::MSG_ID_ALLOWED_FAST &&
+      !m_supportsFast) {
+    log("recieved fast extension message, but it was not negotiated");
+    closeConnection();
+    return;
+  }
+
+  switch (id) {
+    case msg::MSG_ID_UNCHOKE:
+      handleUnchoke(cbf);
+      break;
+    case msg::MSG_ID_INTERESTED:
+      handleInterested(cbf);
+      break;
+    case msg::MSG_ID_HAVE:
+      handleHave(cbf);
+      break;
+    case msg::MSG_ID_BITFIELD:
+      handleBitfield(cbf);
+      break;
+    case msg::MSG_ID_REQUEST:
+      handleRequest(cbf);
+      break;
+    case msg::MSG_ID_PIECE:
+      handlePiece(cbf);
+      break;
+    case msg::MSG_ID_KEEP_ALIVE:
+      // only keeps the connection from timing out
+      break;
+    case msg::MSG_ID_CHOKE:
+      handleChoke(cbf);
+      break;
+    case msg::MSG_ID_NOT_INTERESTED:
+      handleNotInterested(cbf);
+      break;
+    case msg::MSG_ID_CANCEL:
+      handleCancel(cbf);
+      break;
+    case msg::MSG_ID_PORT:
+      log("Unsupported: port message");
+      break;
+    case msg::MSG_ID_SUGGEST_PIECE:
+      handleSuggestPiece(cbf);
+      break;
+    case msg::MSG_ID_HAVE_ALL:
+    case msg::MSG_ID_HAVE_NONE:
+      handleBitfield(cbf);
+      break;
+    case msg::MSG_ID_REJECT_REQUEST:
+      handleRejectRequest(cbf);
+      break;
+    case msg::MSG_ID_ALLOWED_FAST:
+      handleAllowedFast(cbf);
+      break;
+    default:
+      log("Recieved unknown message, not doing anything");
+      break;
+  }
+}
+
+// queues an encoded message, e.g., one that is shared or
+// has to stay a separate item
+void
+Peer::sendMessage(ConstBufferPtr cbf)
+{
+  if (m_state == STATE_CLOSED)
+    return;
+
+  SendItem item;
+  item.buffer = cbf;
+  item.fileOffset = 0;
+  item.length = cbf->size();
+  pushSendItem(item);
+}
+
+// encodes a (small) message right behind the messages queued
+// before it, so they take neither a buffer nor a syscall each
+void
+Peer::sendMessage(msg::MsgBase& message)
+{
+  if (m_state == STATE_CLOSED)
+    return;
+
+  if (!m_sendBatch) {
+    m_sendBatch = make_shared<Buffer>();
+
+    SendItem item;
+    item.buffer = m_sendBatch;
+    item.fileOffset = 0;
+    item.length = 0;
+    m_sendQueue.push_back(item);
+  }
+
+  size_t size = m_sendBatch->size();
+  message.encodeTo(*m_sendBatch);
+  m_sendQueue.back().length = m_sendBatch->size();
+  m_sendQueueSize += m_sendBatch->size() - size;
+  m_lastSent = std::chrono::steady_clock::now();
+
+  scheduleFlush();
+}
+
+// queues a range of the client file, which is sent
+// straight from the page cache to the socket
+void
+Peer::sendFileRange(uint64_t offset, size_t length)
+{
+  if (m_state == STATE_CLOSED)
+    return;
+
+  SendItem item;
+  item.fileOffset = offset;
+  item.length = length;
+  pushSendItem(item);
+}
+
+void
+Peer::pushSendItem(const SendItem& item)
+{
+  // messages after it go into a new batch
+  m_sendBatch.reset();
+
+  m_sendQueue.push_back(item);
+  m_sendQueueSize += item.length;
+  m_lastSent = std::chrono::steady_clock::now();
+
+  scheduleFlush();
+}
+
+// Sends the queue once the events at hand are handled, so the
+// messages queued meanwhile (e.g., haves to all the peers) go
+// out together. Enough data is sent right away
+void
+Peer::scheduleFlush()
+{
+  if (m_sendQueueSize >= SEND_FLUSH_SIZE) {
+    flushSendQueue();
+    return;
+  }
+
+  if (m_isFlushScheduled)
+    return;
+
+  // the peer may be closed and dropped by the client before
+  // the end of the iteration
+  shared_ptr<Peer> self = shared_from_this();
+  m_isFlushScheduled = true;
+  m_loop->defer([self] {
+      self->m_isFlushScheduled = false;
+      self->flushSendQueue();
+    });
+}
+
+// Sends as much of the queue as the socket takes, the rest is
+// sent when the socket becomes writable again. The buffers up
+// to the next file range go out with a single sendmsg()
+void
+Peer::flushSendQueue()
+{
+  static const size_t MAX_IOV = 64;
+
+  if (m_state == STATE_CONNECTING || m_state == STATE_CLOSED)
+    return;
+
+  while (!m_sendQueue.empty()) {
+    const SendItem& front = m_sendQueue.front();
+
+    ssize_t n;
+    if (front.buffer) {
+      struct iovec iov[MAX_IOV];
+      size_t numIov = 0;
+      size_t offset = m_sendOffset;
+
+      for (auto it = m_sendQueue.begin();
+           it != m_sendQueue.end() && it->buffer && numIov < MAX_IOV; ++it) {
+        iov[numIov].iov_base = const_cast<uint8_t*>(it->buffer->buf()) + offset;
+        iov[numIov].iov_len = it->length - offset;
+        numIov++;
+        offset = 0;
+      }
+
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = numIov;
+
+      n = sendmsg(m_sock, &msg, MSG_NOSIGNAL);
+    }
+    else {
+      off_t offset = front.fileOffset + m_sendOffset;
+      n = sendfile(m_sock, m_clientStorage->getFd(), &offset,
+                   front.length - m_sendOffset);
+
+      // the file shrank under us, nothing more will come
+      if (n == 0) {
+        log("sendfile reached end of file");
+        closeConnection();
+        return;
+      }
+    }
+
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+
+      perror(front.buffer ? "sendmsg" : "sendfile");
+      closeConnection();
+      return;
+    }
+
+    m_sendQueueSize -= n;
+
+    // drop the items sent completely
+    size_t sent = n;
+    while (sent > 0) {
+      size_t left = m_sendQueue.front().length - m_sendOffset;
+      if (sent < left) {
+        m_sendOffset += sent;
+        break;
+      }
+
+      sent -= left;
+      m_sendQueue.pop_front();
+      m_sendOffset = 0;
+    }
+
+    // the batch was the last item
+    if (m_sendQueue.empty())
+      m_sendBatch.reset();
+  }
+}
+
+// closes the socket and gives back the requested blocks
+// so that other peers can download them
+void
+Peer::closeConnection()
+{
+  if (m_state == STATE_CLOSED)
+    return;
+
+  if (m_sock >= 0) {
+    m_loop->remove(m_sock);
+    close(m_sock);
+    m_sock = -1;
+  }
+
+  if (m_timer != 0) {
+    m_loop->cancel(m_timer);
+    m_timer = 0;
+  }
+
+  if (m_bucketTimer != 0) {
+    m_loop->cancel(m_bucketTimer);
+    m_bucketTimer = 0;
+  }
+
+  abortRequests();
+
+  // the pieces of the peer only count while it is connected, a
+  // reconnect starts over from its bitfield
+  m_picker->removePeer(m_piecesDone);
+  m_piecesDone = Bitfield();
+  unchoked = false;
+  interested = false;
+
+  // free the upload slot
+  if (m_isPeerInterested || unchoking)
+    m_choker->requestRechoke();
+  m_isPeerInterested = false;
+  unchoking = false;
+
+  m_state = STATE_CLOSED;
+  m_recvBuf = make_shared<Buffer>();
+  m_recvBegin = 0;
+  m_recvEnd = 0;
+  m_sendQueue.clear();
+  m_sendBatch.reset();
+  m_sendQueueSize = 0;
+  m_sendOffset = 0;
+  m_pendingReads.clear();
+  m_readBlocks.clear();
+  m_isWaitingOnWorkers = false;
+
+  log("connection closed");
+
+  if (m_onClosed)
+    m_onClosed();
+}
+
+void
+Peer::setBitfield(const uint8_t *bitfield, int size)
+{
+  m_piecesDone = Bitfield(bitfield, size);
+
+  // count the peer's pieces towards their availability
+  m_picker->addPeer(m_piecesDone);
+}
+
+void 
+Peer::log(std::string msg)
+{
+  std::cout << "(" << m_peerId << "): " << msg << std::endl;
+  return;
+}
+
+void Peer::handleChoke(const BufferView& cbf)
+{
+  log("recieved choke");
+
+  // a choking peer discards our requests. With the fast
+  // extension it rejects the ones it drops instead
+  unchoked = false;
+  if (!m_supportsFast)
+    abortRequests();
+  return;
+}
+
+void Peer::handleUnchoke(const BufferView& cbf)
+{
+  log("recieved unchoke");
+
+  unchoked = true;
+  interested = false;
+  return;
+}
+
+// the choker decides whether the peer gets unchoked
+void Peer::handleInterested(const BufferView& cbf)
+{
+  log("recieved interested");
+
+  if (!m_isPeerInterested) {
+    m_isPeerInterested = true;
+    m_choker->requestRechoke();
+  }
+
+  return;
+}
+
+void Peer::handleNotInterested(const BufferView& cbf)
+{
+  log("recieved not interested");
+
+  if (m_isPeerInterested) {
+    m_isPeerInterested = false;
+    m_choker->requestRechoke();
+  }
+
+  return;
+}
+
+void
+Peer::choke()
+{
+  if (!unchoking)
+    return;
+
+  msg::Choke choke;
+  sendMessage(choke);
+  unchoking = false;
+
+  // a choked peer has to request again, blocks not
+  // queued for sending yet are dropped
+  rejectRequests(m_pendingReads);
+  rejectRequests(m_readBlocks);
+
+  log("sent choke");
+}
+
+void
+Peer::unchoke()
+{
+  if (unchoking)
+    return;
+
+  msg::Unchoke unchoke;
+  sendMessage(unchoke);
+  unchoking = true;
+
+  log("sent unchoke");
+}
+
+void
+Peer::updateRates(double elapsed)
+{
+  if (elapsed <= 0)
+    return;
+
+  m_downloadRate = (m_downloaded - m_lastDownloaded) / elapsed;
+  m_uploadRate = (m_uploaded - m_lastUploaded) / elapsed;
+  m_lastDownloaded = m_downloaded;
+  m_lastUploaded = m_uploaded;
+}
+
+void Peer::handleHave(const BufferView& cbf)
+{
+  log("recieved have");
+
+  msg::Have have;
+  have.decode(cbf);
+
+  uint32_t index = have.getIndex();
+  if (index >= m_piecesDone.size()) {
+    log("recieved have for invalid piece");
+    return;
+  }
+
+  // set the piece 
+  if (!m_piecesDone.test(index)) {
+    m_piecesDone.set(index);
+
+    m_picker->incrementAvailability(index);
+  }
+
+  return;
+}
+
+
+void Peer::handleBitfield(const BufferView& cbf)
+{
+  log("Recieved bitfield out of order");
+  //pthread_exit(NULL);
+  return;
+}
+
+void Peer::handleRequest(const BufferView& cbf)
+{
+
+  msg::Request req;
+  req.decode(cbf);
+
+  // a peer asking for nothing, or for more than a block at once,
+  // is not one we want to serve
+  if (req.getLength() == 0 || req.getLength() > MAX_REQUEST_LENGTH) {
+    log("recieved request of length " + std::to_string(req.getLength()));
+    closeConnection();
+    return;
+  }
+
+  int index = req.getIndex();
+  int begin = req.getBegin();
+  int length = req.getLength();
+
+  if (index < 0 || index >= m_metaInfo->getNumPieces() ||
+      begin < 0 || static_cast<int64_t>(begin) + length > getPieceSize(index)) {
+    log("recieved invalid request");
+    rejectRequest(index, begin, length);
+    return;
+  }
+
+  // blocks of pieces in progress are in the file, but
+  // not verified yet
+  if (!m_clientPiecesDone->test(index)) {
+    log("recieved request for piece we don't have");
+    rejectRequest(index, begin, length);
+    return;
+  }
+
+  log("recieved request with index: " + std::to_string(index) +
+      ", begin: " + std::to_string(begin) + ", length: " +
+      std::to_string(length));
+
+  // a choked peer may still download its allowed fast pieces
+  if (!unchoking && !m_allowedFastForPeer.test(index)) {
+    rejectRequest(index, begin, length);
+    return;
+  }
+
+  // a worker brings the block into the page cache, then it is
+  // sent from there
+  BlockRequest request;
+  request.index = index;
+  request.begin = begin;
+  request.length = length;
+  m_pendingReads.push_back(request);
+
+  uint64_t offset = static_cast<uint64_t>(index) * m_metaInfo->getPieceLength() + begin;
+  shared_ptr<Storage> storage = m_clientStorage;
+  EventLoop* loop = m_loop;
+  // the peer outlives the work done for it, also once it is closed
+  // and dropped by the client
+  shared_ptr<Peer> self = shared_from_this();
+
+  bool isPosted = m_workers->tryPost([=] {
+    storage->prefetch(offset, length);
+    loop->post(std::bind(&Peer::onBlockRead, self, index, begin, length));
+  });
+
+  // the room was checked before the request was parsed
+  if (!isPosted) {
+    log("dropped request, workers are busy");
+    m_pendingReads.pop_back();
+    rejectRequest(index, begin, length);
+  }
+
+  return;
+}
+
+// queues a block that has been read to be sent, unless the
+// request was cancelled in the meantime
+void
+Peer::onBlockRead(int pieceIndex, uint32_t begin, uint32_t length)
+{
+  if (!eraseRequest(m_pendingReads, pieceIndex, begin))
+    return;
+
+  BlockRequest block;
+  block.index = pieceIndex;
+  block.begin = begin;
+  block.length = length;
+  m_readBlocks.push_back(block);
+
+  sendReadBlocks();
+}
+
+// sends the blocks that are read as far as the upload limits
+// allow. If the shared limit is reached, we wait for our turn
+// and continue from onUploadGranted()
+void
+Peer::sendReadBlocks()
+{
+  while (!m_readBlocks.empty() && !m_isUploadWaiting) {
+    // the socket does not keep up, continue once the queue
+    // drained (with the next writable event)
+    if (m_sendQueueSize >= MAX_SEND_QUEUE_SIZE)
+      return;
+
+    // our own limit, retried once the bucket refilled
+    if (!m_uploadBucket.hasTokens()) {
+      scheduleBucketTimer(m_uploadBucket);
+      return;
+    }
+
+    if (!m_uploadLimiter->request(m_readBlocks.front().length,
+                                  std::bind(&Peer::onUploadGranted, shared_from_this()))) {
+      m_isUploadWaiting = true;
+      return;
+    }
+
+    sendReadBlock();
+  }
+}
+
+// sends the front read block, the block goes from the file
+// to the socket without being copied
+void
+Peer::sendReadBlock()
+{
+  if (m_readBlocks.empty())
+    return;
+
+  BlockRequest block = m_readBlocks.front();
+  m_readBlocks.pop_front();
+
+  uint64_t offset = static_cast<uint64_t>(block.index) * m_metaInfo->getPieceLength() + block.begin;
+
+  sendMessage(msg::Piece::encodeHeader(block.index, block.begin, block.length));
+  sendFileRange(offset, block.length);
+
+  m_uploadBucket.consume(block.length);
+  m_uploaded += block.length;
+}
+
+// the shared limiter took the bandwidth of our front block,
+// more blocks queue up behind the other peers
+void
+Peer::onUploadGranted()
+{
+  m_isUploadWaiting = false;
+
+  sendReadBlock();
+  sendReadBlocks();
+}
+
+// Takes a block's worth of download bandwidth, kept until a
+// request is sent. If the shared limit is reached, we wait for
+// our turn and continue from onDownloadGranted()
+bool
+Peer::acquireDownloadCredit()
+{
+  if (m_hasDownloadCredit)
+    return true;
+
+  if (m_isDownloadWaiting)
+    return false;
+
+  if (!m_downloadBucket.hasTokens()) {
+    scheduleBucketTimer(m_downloadBucket);
+    return false;
+  }
+
+  if (!m_downloadLimiter->request(PartialPiece::BLOCK_SIZE,
+                                  std::bind(&Peer::onDownloadGranted, shared_from_this()))) {
+    m_isDownloadWaiting = true;
+    return false;
+  }
+
+  m_hasDownloadCredit = true;
+  return true;
+}
+
+void
+Peer::onDownloadGranted()
+{
+  m_isDownloadWaiting = false;
+  m_hasDownloadCredit = true;
+
+  run();
+}
+
+// Wakes us up when @p bucket has tokens again.  One timer serves
+// both buckets, run() sets it again for the one still empty
+void
+Peer::scheduleBucketTimer(TokenBucket& bucket)
+{
+  if (m_bucketTimer != 0)
+    return;
+
+  m_bucketTimer = m_loop->schedule(bucket.getWaitTime(),
+                                   std::bind(&Peer::onBucketTimer, this));
+}
+
+void
+Peer::onBucketTimer()
+{
+  m_bucketTimer = 0;
+
+  run();
+}
+
+// removes the request for a block from @p requests
+bool
+Peer::eraseRequest(std::deque<BlockRequest>& requests, int pieceIndex, uint32_t begin)
+{
+  auto request = std::find_if(requests.begin(), requests.end(),
+                              [=] (const BlockRequest& r) {
+                                return r.index == pieceIndex && r.begin == begin;
+                              });
+  if (request == requests.end())
+    return false;
+
+  requests.erase(request);
+  return true;
+}
+
+// tells the peer we won't send a block, if it supports the fast
+// extension. Otherwise the request is silently dropped
+void
+Peer::rejectRequest(int pieceIndex, uint32_t begin, uint32_t length)
+{
+  if (!m_supportsFast)
+    return;
+
+  msg::RejectRequest reject(pieceIndex, begin, length);
+  sendMessage(reject);
+}
+
+// drops @p requests of a peer we choke, except the ones for
+// the allowed fast pieces, which are still sent
+void
+Peer::rejectRequests(std::deque<BlockRequest>& requests)
+{
+  std::deque<BlockRequest> allowed;
+
+  for (const auto& request : requests) {
+    if (m_allowedFastForPeer.test(request.index))
+      allowed.push_back(request);
+    else
+      rejectRequest(request.index, request.begin, request.length);
+  }
+
+  requests.swap(allowed);
+}
+
+void Peer::handlePiece(const BufferView& cbf)
+{
+  msg::Piece piece;
+  piece.decode(cbf);
+
+  int index = piece.getIndex();
+  uint32_t begin = piece.getBegin();
+  const BufferView& block = piece.getBlock();
+
+  // match the block with one of our outstanding requests
+  auto request = std::find_if(m_requests.begin(), m_requests.end(),
+                              [=] (const BlockRequest& r) {
+                                return r.index == index && r.begin == begin;
+                              });
+  if (request == m_requests.end()) {
+    log("recieved unrequested block of piece " + std::to_string(index));
+    return;
+  }
+  m_requests.erase(request);
+  m_lastBlock = std::chrono::steady_clock::now();
+
+  m_downloaded += block.size();
+  updatePipelineDepth(block.size());
+
+  auto it = m_partials->find(index);
+  if (it == m_partials->end() ||
+      !it->second->receiveBlock(begin, block.size())) {
+    log("recieved bad block of piece " + std::to_string(index));
+    return;
+  }
+  shared_ptr<PartialPiece> partial = it->second;
+
+  // the block goes to the file right away, the piece is only
+  // marked done once the hash of all its blocks checks out.
+  // If the workers are busy after all, it is requested again
+  if (!writeBlock(partial, begin, block)) {
+    log("dropped block of piece " + std::to_string(index) + ", workers are busy");
+    partial->dropBlock(begin);
+    return;
+  }
+
+  // in endgame the block may be outstanding at other peers
+  bool isEndgame = m_picker->isEndgame();
+
+  if (isEndgame) {
+    for (auto& peer : *m_peers) {
+      if (peer.get() != this)
+        peer->cancelRequest(index, begin);
+    }
+  }
+
+  return;
+}
+
+// Called on the loop thread once the worker has written and
+// hashed the last block of a piece
+void
+Peer::onPieceHashed(shared_ptr<PartialPiece> partial)
+{
+  int index = partial->getIndex();
+
+  log("recieved piece " + std::to_string(index) + " length: " + std::to_string(partial->getLength()));
+
+  if (partial->hasWriteError()) {
+    log("Problem writing to file");
+    partial->reset();
+    m_picker->setWorkReleased();
+    return;
+  }
+
+  // hashed while the blocks came in
+  if (!equal(partial->getHash(), m_metaInfo->getPieceHash(index))) {
+    log("difference in hash");
+    // download it again
+    partial->reset();
+    m_picker->setWorkReleased();
+    return;
+  }
+
+  // TODO: critical section inside here
+  m_metaInfo->increaseBytesDownloaded(partial->getLength());
+
+  log("Successfully wrote to file");
+  m_clientPiecesDone->set(index);
+  m_picker->setHave(index);
+  m_clientResume->setPiece(index, partial->getChecksum());
+
+  m_partials->erase(index);
+
+  // TODO: add pack
+  // send have to all peers
+  for (auto& peer : *m_peers) {
+    if (peer->getState() != STATE_RUNNING)
+      continue;
+
+    peer->sendHave(index);
+    log("sent have to " + peer->getPeerId());
+  }
+
+  // nothing left to download, free our upload slots at the peers
+  if (allPiecesDone()) {
+    msg::NotInterested notInterested;
+    for (auto& peer : *m_peers) {
+      if (peer->getState() == STATE_RUNNING)
+        peer->sendMessage(notInterested);
+    }
+  }
+
+  return;
+}
+
+// sends a "have" message to this peer with the pieceIndex
+void
+Peer::sendHave(int pieceIndex)
+{
+  msg::Have have(pieceIndex);
+  sendMessage(have);
+
+  // a piece of the allowed fast set that we only have now
+  if (m_supportsFast && m_allowedFastForPeer.test(pieceIndex) &&
+      !m_piecesDone.test(pieceIndex)) {
+    msg::AllowedFast allowedFast(pieceIndex);
+    sendMessage(allowedFast);
+  }
+  return; 
+}
+
+// sends a "cancel" message if we have requested the block
+// from this peer
+void
+Peer::cancelRequest(int pieceIndex, uint32_t begin)
+{
+  auto request = std::find_if(m_requests.begin(), m_requests.end(),
+                              [=] (const BlockRequest& r) {
+                                return r.index == pieceIndex && r.begin == begin;
+                              });
+  if (request == m_requests.end())
+    return;
+
+  msg::Cancel cancel(request->index, request->begin, request->length);
+  sendMessage(cancel);
+  m_requests.erase(request);
+
+  log("sent cancel for piece: " + std::to_string(pieceIndex) +
+      " begin: " + std::to_string(begin));
+}
+
+// drops a requested block that is still being read or waiting
+// for bandwidth, or (the piece header and the file range after
+// it) from the send queue if it has not started going out yet,
+// otherwise the cancel came too late
+void
+Peer::handleCancel(const BufferView& cbf)
+{
+  msg::Cancel cancel;
+  cancel.decode(cbf);
+
+  log("recieved cancel for piece: " + std::to_string(cancel.getIndex()) +
+      " begin: " + std::to_string(cancel.getBegin()));
+
+  // with the fast extension, every request is answered with
+  // either the block or a reject
+  if (eraseRequest(m_pendingReads, cancel.getIndex(), cancel.getBegin()) ||
+      eraseRequest(m_readBlocks, cancel.getIndex(), cancel.getBegin())) {
+    rejectRequest(cancel.getIndex(), cancel.getBegin(), cancel.getLength());
+    return;
+  }
+
+  // the front message may be partially sent already
+  auto it = m_sendQueue.begin();
+  if (it != m_sendQueue.end() && m_sendOffset > 0)
+    ++it;
+
+  for (; it != m_sendQueue.end(); ++it) {
+    if (!it->buffer)
+      continue;
+
+    // length, id, index and begin of a piece message
+    const Buffer& queued = *it->buffer;
+    if (queued.size() != msg::Piece::HEADER_LENGTH || queued[4] != msg::MSG_ID_PIECE)
+      continue;
+
+    uint32_t index = ntohl(*reinterpret_cast<const uint32_t *> (queued.buf() + 5));
+    uint32_t begin = ntohl(*reinterpret_cast<const uint32_t *> (queued.buf() + 9));
+    if (index == cancel.getIndex() && begin == cancel.getBegin()) {
+      auto end = it + 1;
+      if (end != m_sendQueue.end() && !end->buffer)
+        ++end;
+
+      for (auto erased = it; erased != end; ++erased)
+        m_sendQueueSize -= erased->length;
+      m_sendQueue.erase(it, end);
+      rejectRequest(cancel.getIndex(), cancel.getBegin(), cancel.getLength());
+      return;
+    }
+  }
+}
+
+// the peer may suggest pieces to download, e.g., ones that it
+// has in its cache, but we pick the rarest ones anyway
+void
+Peer::handleSuggestPiece(const BufferView& cbf)
+{
+  msg::SuggestPiece suggest;
+  suggest.decode(cbf);
+
+  log("recieved suggestion of piece " + std::to_string(suggest.getIndex()));
+}
+
+// the peer won't send a block we have requested, so it can be
+// requested again, from this peer or another one
+void
+Peer::handleRejectRequest(const BufferView& cbf)
+{
+  msg::RejectRequest reject;
+  reject.decode(cbf);
+
+  int index = reject.getIndex();
+  uint32_t begin = reject.getBegin();
+
+  log("recieved reject for piece: " + std::to_string(index) +
+      " begin: " + std::to_string(begin));
+
+  // e.g., one we have cancelled
+  if (!eraseRequest(m_requests, index, begin))
+    return;
+
+  auto partial = m_partials->find(index);
+  if (partial != m_partials->end())
+    partial->second->abortBlock(begin);
+
+  // while choked, the piece is no longer allowed fast
+  if (!unchoked)
+    m_allowedFast.reset(index);
+}
+
+void
+Peer::handleAllowedFast(const BufferView& cbf)
+{
+  msg::AllowedFast allowedFast;
+  allowedFast.decode(cbf);
+
+  uint32_t index = allowedFast.getIndex();
+  if (index >= m_allowedFast.size()) {
+    log("recieved allowed fast for invalid piece");
+    return;
+  }
+
+  log("recieved allowed fast for piece " + std::to_string(index));
+  m_allowedFast.set(index);
+}
+
+// our handshake, which always announces the fast extension
+msg::HandShake
+Peer::constructHandshake()
+{
+  msg::HandShake hs(m_metaInfo->getHash(), "SIMPLEBT.TEST.PEERID");
+  hs.setFastExtension(true);
+  return hs;
+}
+
+// constructs a bitfield based on the client's current files,
+// the client's pieces are already in wire format
+msg::Bitfield
+Peer::constructBitfield()
+{
+  return msg::Bitfield(m_clientPiecesDone->getBytes());
+}
+
+// sends our pieces, as a single have all or have none message
+// instead of the bitfield when the fast extension allows it
+void
+Peer::sendBitfield()
+{
+  if (m_supportsFast && m_clientPiecesDone->all()) {
+    msg::HaveAll haveAll;
+    sendMessage(haveAll);
+  }
+  else if (m_supportsFast && m_clientPiecesDone->none()) {
+    msg::HaveNone haveNone;
+    sendMessage(haveNone);
+  }
+  else {
+    sendMessage(constructBitfield().encode());
+  }
+}
+
+// Lets the peer download a few pieces before we unchoke it, so
+// that it has something to trade. The set depends only on its
+// network, so reconnecting doesn't give it more pieces
+void
+Peer::sendAllowedFast()
+{
+  // a seed has nothing to download
+  if (m_piecesDone.all())
+    return;
+
+  std::vector<uint32_t> pieces =
+    msg::AllowedFast::generateSet(m_ip, m_metaInfo->getHash(),
+                                  m_metaInfo->getNumPieces(), ALLOWED_FAST_SIZE);
+
+  for (uint32_t index : pieces) {
+    m_allowedFastForPeer.set(index);
+
+    // pieces we don't have yet are served once we do
+    if (!m_clientPiecesDone->test(index) || m_piecesDone.test(index))
+      continue;
+
+    msg::AllowedFast allowedFast(index);
+    sendMessage(allowedFast);
+  }
+}
+
+// Has a worker write a received block of the piece to the file
+// and hash it. The view keeps the received data alive until then.
+// The worker that completes the hash reports back to the loop.
+// Returns false if the worker queue is full
+bool
+Peer::writeBlock(shared_ptr<PartialPiece> partial, uint32_t begin, const BufferView& block)
+{
+  uint64_t blockPosStart = static_cast<uint64_t>(partial->getIndex()) * m_metaInfo->getPieceLength() + begin;
+  shared_ptr<Storage> storage = m_clientStorage;
+  EventLoop* loop = m_loop;
+  shared_ptr<Peer> self = shared_from_this();
+
+  return m_workers->tryPost([=] {
+    if (!storage->write(blockPosStart, block.data(), block.size()))
+      partial->setWriteError();
+
+    if (partial->hashBlock(begin, block.data(), block.size()))
+      loop->post(std::bind(&Peer::onPieceHashed, self, partial));
+  });
+}
+
+void
+Peer::onWorkersReady()
+{
+  if (!m_isWaitingOnWorkers)
+    return;
+
+  // the socket won't signal the data that arrived meanwhile again
+  m_isWaitingOnWorkers = false;
+  handleEvent(EPOLLIN);
+}
+
+bool
+Peer::allPiecesDone()
+{
+  return m_picker->isComplete();
 }
 
 } // namespace sbt
@@ -7,11 +7,40 @@
 #include "meta-info.hpp"
 #include "tracker-response.hpp"
 #include "msg/msg-base.hpp"
+#include "msg/handshake.hpp"
+#include "util/buffer-view.hpp"
+#include "event-loop.hpp"
+#include "partial-piece.hpp"
+#include "piece-picker.hpp"
+#include "bitfield.hpp"
+#include "storage.hpp"
+#include "worker-pool.hpp"
+#include "choker.hpp"
+#include "rate-limiter.hpp"
+#include "resume-data.hpp"
+#include "peer-registry.hpp"
+
+#include <deque>
+#include <map>
+#include <chrono>
+#include <algorithm>
 
 namespace sbt {
 
-class Peer 
+class Peer : public enable_shared_from_this<Peer>
 {
+public:
+  // a peer is a per-connection state machine driven by
+  // readiness events from the client's EventLoop
+  enum State {
+    STATE_IDLE,        // not connected yet
+    STATE_CONNECTING,  // non-blocking connect in progress
+    STATE_HANDSHAKE,   // waiting on the remote handshake
+    STATE_BITFIELD,    // waiting on the remote bitfield
+    STATE_RUNNING,     // bitfields exchanged, exchanging messages
+    STATE_CLOSED
+  };
+
 public:
   Peer (std::string peerId,
         std::string ip,
@@ -20,19 +49,28 @@ public:
   Peer (int sockfd);
    
   void
-  handshakeAndRun();
+  handshakeAndRun(EventLoop& loop);
 
   void
-  respondAndRun();
+  respondAndRun(EventLoop& loop);
 
   void
   run();
 
   void
-  setBitfield(char *bitfield, int size);
+  handleEvent(uint32_t events);
+
+  void
+  setBitfield(const uint8_t *bitfield, int size);
 
 public:
 
+  State
+  getState()
+  {
+    return m_state;
+  }
+
   int
   getSock()
   {
@@ -63,6 +101,12 @@ public:
     return m_ip;
   }
 
+  void
+  setIp(const std::string& ip)
+  {
+    m_ip = ip;
+  }
+
   uint16_t
   getPort()
   {
@@ -75,52 +119,220 @@ public:
     m_port = port;
   }
 
+  // identifies the peer to the choker, never reused by another peer
+  int
+  getId() const
+  {
+    return m_id;
+  }
+
+  void
+  setId(int id)
+  {
+    m_id = id;
+  }
+
+  /** @brief Call @p onClosed once the connection is closed, e.g., for
+   *         the client to drop the peer
+   */
+  void
+  setCloseCallback(const function<void()>& onClosed)
+  {
+    m_onClosed = onClosed;
+  }
+
+  int
+  getNumConnectFailures()
+  {
+    return m_numConnectFailures;
+  }
+
+  // the backoff after the failed connection attempts is over
+  bool
+  isConnectDue(std::chrono::steady_clock::time_point now)
+  {
+    return now >= m_nextConnect;
+  }
+
   bool
   hasPiece(int pieceNum)
   {
-    return m_piecesDone.at(pieceNum);
+    return m_piecesDone.test(pieceNum);
   }
 
-  int
-  getActivePiece()
+  size_t
+  getPipelineDepth()
   {
-    return m_activePiece;
+    return m_pipelineDepth;
   }
 
+  // bounds for the number of outstanding block requests,
+  // the actual depth is tuned between them
   void
-  setActivePiece(int pieceNum)
+  setPipelineLimits(size_t minDepth, size_t maxDepth)
+  {
+    m_minPipelineDepth = minDepth;
+    m_maxPipelineDepth = maxDepth;
+    m_pipelineDepth = std::min(std::max(m_pipelineDepth, minDepth), maxDepth);
+  }
+
+  // the peer wants to download from us
+  bool
+  isPeerInterested()
   {
-    m_activePiece = pieceNum;
+    return m_isPeerInterested;
+  }
+
+  // we don't upload to the peer
+  bool
+  isChoking()
+  {
+    return !unchoking;
+  }
+
+  // payload rates over the last choke interval, in bytes/s
+  double
+  getDownloadRate()
+  {
+    return m_downloadRate;
+  }
+
+  double
+  getUploadRate()
+  {
+    return m_uploadRate;
   }
 
   void 
-  setClientData(std::vector<bool>* clientPiecesDone,
-                    std::vector<bool>* clientPiecesLocked,
+  setClientData(Bitfield* clientPiecesDone,
+                    PiecePicker* picker,
+                    PartialPieceMap* partials,
                     MetaInfo *metaInfo,
-                    std::vector<Peer>* peers,
-                    FILE *clientFile,
-                    pthread_mutex_t *clientPieceLock,
-                    pthread_mutex_t *clientFileLock);
+                    PeerRegistry* peers,
+                    shared_ptr<Storage> clientStorage,
+                    WorkerPool* workers,
+                    Choker* choker,
+                    RateLimiter* uploadLimiter,
+                    RateLimiter* downloadLimiter,
+                    ResumeData *clientResume);
+
+  // caps the rates of this peer in bytes/s, 0 for unlimited,
+  // on top of the limits shared by all peers
+  void
+  setRateLimits(uint64_t upload, uint64_t download)
+  {
+    m_uploadBucket.setRate(upload);
+    m_downloadBucket.setRate(download);
+  }
 
   void sendHave(int pieceIndex);
 
+  void choke();
+  void unchoke();
+
+  // turns the bytes exchanged since the last call
+  // into the rates, @p elapsed seconds later
+  void updateRates(double elapsed);
+
+  // withdraws our request for a block that arrived from
+  // another peer (endgame)
+  void cancelRequest(int pieceIndex, uint32_t begin);
+
+  // the workers have room again, continues reading and
+  // requesting if we held back for them
+  void onWorkersReady();
+
 private:
   std::string m_peerId;    
   std::string m_ip;
   uint16_t m_port;
+  int m_id;
+  function<void()> m_onClosed;
 
   int m_sock;
 
-  // the piece we are pining after from this peer
-  int m_activePiece;
+  State m_state;
+  bool m_isIncoming;
+  EventLoop* m_loop;
+
+  // bytes received but not yet parsed into messages are
+  // [m_recvBegin, m_recvEnd) of m_recvBuf, which is shared
+  // with the views of the messages being handled
+  BufferPtr m_recvBuf;
+  size_t m_recvBegin;
+  size_t m_recvEnd;
+
+  // data waiting for the socket to become writable: either an
+  // encoded message, or a range of the file that is sent with
+  // sendfile() without copying it through user space
+  struct SendItem
+  {
+    ConstBufferPtr buffer;
+    uint64_t fileOffset;
+    size_t length;
+  };
+
+  // m_sendOffset bytes of the front item are already sent,
+  // m_sendQueueSize bytes are left. Small messages are encoded
+  // into m_sendBatch while it is the last item
+  std::deque<SendItem> m_sendQueue;
+  BufferPtr m_sendBatch;
+  size_t m_sendQueueSize;
+  size_t m_sendOffset;
+
+  // the queue is sent at the end of the loop iteration
+  bool m_isFlushScheduled;
+
+  // the worker queue is full, so we neither read (the blocks we
+  // receive and the requests we serve go through the workers) nor
+  // request until onWorkersReady()
+  bool m_isWaitingOnWorkers;
+
+  // outgoing connection attempts that failed in a row, and
+  // when to try again
+  int m_numConnectFailures;
+  std::chrono::steady_clock::time_point m_connectStart;
+  std::chrono::steady_clock::time_point m_nextConnect;
+
+  // fires at the earliest of the deadlines below (or the connect
+  // timeout), which only move later in between, so the timer is
+  // only set again once it fires
+  EventLoop::TimerId m_timer;
+  std::chrono::steady_clock::time_point m_lastReceived;
+  std::chrono::steady_clock::time_point m_lastSent;
+  // the last block received, or the first request sent since
+  std::chrono::steady_clock::time_point m_lastBlock;
+
+  // a block request we have sent, not yet answered
+  struct BlockRequest
+  {
+    int index;
+    uint32_t begin;
+    uint32_t length;
+  };
+
 
   // we have sent an interested msg, not yet recieved
   // an unchoke msg
   bool interested;
 
-  // we have sent a request msg, have not yet
-  // recieved the corresponding piece
-  bool requested;
+  // requests we have recieved, waiting for their blocks to be
+  // read from the disk, and then for the bandwidth to send them
+  std::deque<BlockRequest> m_pendingReads;
+  std::deque<BlockRequest> m_readBlocks;
+
+  // requests we have sent, have not yet recieved the
+  // corresponding blocks. We keep m_pipelineDepth of them
+  // outstanding so that the link never idles for a RTT
+  std::deque<BlockRequest> m_requests;
+  size_t m_pipelineDepth;
+  size_t m_minPipelineDepth;
+  size_t m_maxPipelineDepth;
+
+  // bytes received since m_rateStart, to measure the
+  // download rate the pipeline depth is tuned from
+  uint64_t m_rateBytes;
+  std::chrono::steady_clock::time_point m_rateStart;
 
   // we can recieve pieces from this peer
   bool unchoked;
@@ -129,50 +341,158 @@ private:
   // we have already sent them "unchoke"
   bool unchoking;
 
+  // the peer has sent "interested", and not
+  // "not interested" since
+  bool m_isPeerInterested;
+
+  // both handshakes announced the fast extension (BEP 6): requests
+  // are rejected instead of dropped, and the allowed fast pieces
+  // can be requested while choked (by us from the peer in
+  // m_allowedFast, by the peer from us in m_allowedFastForPeer)
+  bool m_supportsFast;
+  Bitfield m_allowedFast;
+  Bitfield m_allowedFastForPeer;
+
+  // payload bytes recieved from and sent to the peer, and
+  // the counts the rates were last computed from
+  uint64_t m_downloaded;
+  uint64_t m_uploaded;
+  uint64_t m_lastDownloaded;
+  uint64_t m_lastUploaded;
+  double m_downloadRate;
+  double m_uploadRate;
+
   // the pieces that this peer has done
-  std::vector<bool> m_piecesDone;
+  Bitfield m_piecesDone;
   ConstBufferPtr m_bitfield;
 
   // client references
   MetaInfo *m_metaInfo;
 
   // client pieces that are DONE
-  std::vector<bool>* m_clientPiecesDone;
+  Bitfield* m_clientPiecesDone;
+
+  // picks the pieces to download, shared by all peers
+  PiecePicker* m_picker;
 
-  // client pieces that are LOCKED
-  // where LOCKED is either DONE or DOWNLOADING
-  std::vector<bool>* m_clientPiecesLocked;
+  // the pieces being downloaded, assembled block by block.
+  // Any peer that has a piece helps finishing it
+  PartialPieceMap* m_partials;
 
   // keep track of all the other peers,
   // to send them have messages;
-  std::vector<Peer>* m_peers;
+  PeerRegistry* m_peers;
+
+  // the downloaded file, safe to access without a lock
+  shared_ptr<Storage> m_clientStorage;
+
+  // writes and hashes the received blocks, reads the requested
+  // ones, so that the loop never waits on the disk
+  WorkerPool* m_workers;
 
-  std::string m_clientFileName;
-  FILE *m_clientFile;
+  // decides whom we upload to, told when interest changes
+  Choker* m_choker;
+
+  // the limits of this peer, and the ones shared by all peers.
+  // A block is sent (requested) once both allow it
+  TokenBucket m_uploadBucket;
+  TokenBucket m_downloadBucket;
+  RateLimiter* m_uploadLimiter;
+  RateLimiter* m_downloadLimiter;
+
+  // waiting on the shared limiter for the bandwidth of a
+  // block, a block's worth of download bandwidth is ours
+  bool m_isUploadWaiting;
+  bool m_isDownloadWaiting;
+  bool m_hasDownloadCredit;
+  // wakes us up once our own buckets refilled
+  EventLoop::TimerId m_bucketTimer;
+
+  // records the verified pieces for fast resume
+  ResumeData *m_clientResume;
 
 private:
   int connectSocket();
 
-  void getFirstAvailablePiece();
+  void failConnect();
+  void onConnected();
+  void scheduleTimer();
+  void onTimer();
+  void scheduleBucketTimer(TokenBucket& bucket);
+  void onBucketTimer();
+  void makeRecvSpace();
+  size_t getMaxMessageLength();
+  void readSocket();
+  void processRecvBuffer();
+  void handleHandshake(ConstBufferPtr cbf);
+  void handleMessage(const BufferView& cbf);
+  void sendMessage(ConstBufferPtr cbf);
+  void sendMessage(msg::MsgBase& message);
+  void sendFileRange(uint64_t offset, size_t length);
+  void pushSendItem(const SendItem& item);
+  void scheduleFlush();
+  void flushSendQueue();
+  void closeConnection();
+
+  void requestBlocks(const Bitfield& candidates);
+  int pickPiece(const Bitfield& candidates);
+  bool hasPartialPiece(const Bitfield& candidates);
+  bool nextBlock(BlockRequest& request, const Bitfield& candidates);
+  bool nextEndgameBlock(BlockRequest& request, const Bitfield& candidates);
+  bool isRequested(int pieceIndex, uint32_t begin);
+  void sendRequest(const BlockRequest& request);
+  int getPieceSize(int pieceIndex);
+  void updatePipelineDepth(size_t bytes);
+  void abortRequests();
+  void timeoutRequests();
 
   void log(std::string msg);
 
-  void handleUnchoke(ConstBufferPtr cbf);
-  void handleInterested(ConstBufferPtr cbf);
-  void handleHave(ConstBufferPtr cbf);
-  void handleBitfield(ConstBufferPtr cbf);
-  void handleRequest(ConstBufferPtr cbf);
-  void handlePiece(ConstBufferPtr cbf);
-
+  void handleChoke(const BufferView& cbf);
+  void handleUnchoke(const BufferView& cbf);
+  void handleInterested(const BufferView& cbf);
+  void handleNotInterested(const BufferView& cbf);
+  void handleHave(const BufferView& cbf);
+  void handleBitfield(const BufferView& cbf);
+  void handleRequest(const BufferView& cbf);
+  void handlePiece(const BufferView& cbf);
+  void handleCancel(const BufferView& cbf);
+  void handleSuggestPiece(const BufferView& cbf);
+  void handleRejectRequest(const BufferView& cbf);
+  void handleAllowedFast(const BufferView& cbf);
+
+  void onBlockRead(int pieceIndex, uint32_t begin, uint32_t length);
+  void sendReadBlocks();
+  void sendReadBlock();
+  void onUploadGranted();
+  bool acquireDownloadCredit();
+  void onDownloadGranted();
+  static bool eraseRequest(std::deque<BlockRequest>& requests, int pieceIndex, uint32_t begin);
+  void rejectRequest(int pieceIndex, uint32_t begin, uint32_t length);
+  void rejectRequests(std::deque<BlockRequest>& requests);
+
+  msg::HandShake constructHandshake();
   msg::Bitfield constructBitfield();
-  int waitOnBitfield(int size);
-  int waitOnMessage();
-  int waitOnHandshake();
-  int writeToFile(int pieceIndex, ConstBufferPtr piece);
+  void sendBitfield();
+  void sendAllowedFast();
+  bool writeBlock(shared_ptr<PartialPiece> partial, uint32_t begin, const BufferView& block);
+  void onPieceHashed(shared_ptr<PartialPiece> partial);
   bool allPiecesDone();
 
-  pthread_mutex_t *pieceLock;
-  pthread_mutex_t *fileLock;
+  static const size_t MIN_PIPELINE_DEPTH;
+  static const size_t MAX_PIPELINE_DEPTH;
+  static const double REQUEST_QUEUE_TIME;
+  static const size_t RECV_BUFFER_SIZE;
+  static const size_t SEND_FLUSH_SIZE;
+  static const size_t MAX_SEND_QUEUE_SIZE;
+  static const int CONNECT_TIMEOUT;
+  static const int CONNECT_BACKOFF;
+  static const int MAX_CONNECT_BACKOFF;
+  static const int KEEP_ALIVE_INTERVAL;
+  static const int IDLE_TIMEOUT;
+  static const int REQUEST_TIMEOUT;
+  static const size_t ALLOWED_FAST_SIZE;
+  static const uint32_t MAX_REQUEST_LENGTH;
 };
 
 } // namespace sbt
@@ -0,0 +1,218 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "piece-picker.hpp"
+
+#include <stdlib.h>
+
+namespace sbt {
+
+const int PiecePicker::RANDOM_PIECES = 4;
+
+PiecePicker::PiecePicker()
+  : m_randomPieces(RANDOM_PIECES)
+  , m_isWorkReleased(false)
+{
+}
+
+void
+PiecePicker::reset(int numPieces)
+{
+  m_availability = std::vector<int>(numPieces, 0);
+  m_pieces.reset(numPieces);
+  m_buckets = std::vector<std::vector<int>>(1);
+  m_pos = std::vector<int>(numPieces, -1);
+  m_pickable = Bitfield(numPieces);
+
+  for (int i = 0; i < numPieces; i++)
+    insertPiece(i);
+}
+
+void
+PiecePicker::insertPiece(int index)
+{
+  size_t availability = m_availability[index];
+  if (m_buckets.size() <= availability)
+    m_buckets.resize(availability + 1);
+
+  std::vector<int>& bucket = m_buckets[availability];
+  m_pos[index] = bucket.size();
+  bucket.push_back(index);
+  m_pickable.set(index);
+}
+
+void
+PiecePicker::erasePiece(int index)
+{
+  // move the last piece of the bucket into the hole
+  std::vector<int>& bucket = m_buckets[m_availability[index]];
+  int last = bucket.back();
+
+  bucket[m_pos[index]] = last;
+  m_pos[last] = m_pos[index];
+  bucket.pop_back();
+
+  m_pos[index] = -1;
+  m_pickable.reset(index);
+}
+
+void
+PiecePicker::addPeer(const Bitfield& bitfield)
+{
+  for (size_t i = bitfield.findFirst(); i < m_availability.size(); i = bitfield.findNext(i + 1))
+    incrementAvailability(i);
+}
+
+void
+PiecePicker::removePeer(const Bitfield& bitfield)
+{
+  for (size_t i = bitfield.findFirst(); i < m_availability.size(); i = bitfield.findNext(i + 1))
+    decrementAvailability(i);
+}
+
+void
+PiecePicker::incrementAvailability(int index)
+{
+  if (m_pos[index] < 0) {
+    m_availability[index]++;
+    return;
+  }
+
+  erasePiece(index);
+  m_availability[index]++;
+  insertPiece(index);
+}
+
+void
+PiecePicker::decrementAvailability(int index)
+{
+  if (m_availability[index] == 0)
+    return;
+
+  if (m_pos[index] < 0) {
+    m_availability[index]--;
+    return;
+  }
+
+  erasePiece(index);
+  m_availability[index]--;
+  insertPiece(index);
+}
+
+int
+PiecePicker::pick(const Bitfield& peerHas)
+{
+  // nothing for us at this peer
+  if (!peerHas.intersects(m_pickable))
+    return -1;
+
+  if (getNumHave() < m_randomPieces)
+    return pickRandom(peerHas);
+
+  // rarest first, starting at a random position inside each
+  // bucket so that peers don't all converge on the same piece.
+  // Nobody connected has the pieces of bucket 0, this peer neither
+  for (size_t availability = 1; availability < m_buckets.size(); availability++) {
+    const std::vector<int>& bucket = m_buckets[availability];
+    if (bucket.empty())
+      continue;
+
+    size_t start = rand() % bucket.size();
+    for (size_t k = 0; k < bucket.size(); k++) {
+      int index = bucket[(start + k) % bucket.size()];
+      if (peerHas.test(index) && claimPiece(index))
+        return index;
+    }
+  }
+
+  return -1;
+}
+
+int
+PiecePicker::pickRandom(const Bitfield& peerHas)
+{
+  if (m_pos.empty())
+    return -1;
+
+  Bitfield candidates(peerHas);
+  candidates &= m_pickable;
+
+  // the first candidate from a random position on, wrapping around
+  size_t start = rand() % m_pos.size();
+  for (size_t index = candidates.findNext(start); index != Bitfield::npos;
+       index = candidates.findNext(index + 1)) {
+    if (claimPiece(index))
+      return index;
+  }
+
+  for (size_t index = candidates.findFirst(); index < start;
+       index = candidates.findNext(index + 1)) {
+    if (claimPiece(index))
+      return index;
+  }
+
+  return -1;
+}
+
+bool
+PiecePicker::claimPiece(int index)
+{
+  // the table has the final say, the buckets are only the
+  // order to try the pieces in
+  if (!m_pieces.claim(index))
+    return false;
+
+  erasePiece(index);
+
+  // the blocks outstanding at other peers may be requested now
+  if (m_pieces.isEndgame())
+    m_isWorkReleased = true;
+  return true;
+}
+
+void
+PiecePicker::setChecking(int index)
+{
+  if (!m_pieces.setChecking(index))
+    return;
+
+  erasePiece(index);
+}
+
+void
+PiecePicker::release(int index)
+{
+  if (!m_pieces.release(index))
+    return;
+
+  insertPiece(index);
+  m_isWorkReleased = true;
+}
+
+void
+PiecePicker::setHave(int index)
+{
+  if (!m_pieces.setVerified(index))
+    return;
+
+  if (m_pos[index] >= 0)
+    erasePiece(index);
+}
+
+} // namespace sbt
@@ -0,0 +1,196 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_PIECE_PICKER_HPP
+#define SBT_PIECE_PICKER_HPP
+
+#include "common.hpp"
+#include "bitfield.hpp"
+#include "piece-table.hpp"
+
+#include <vector>
+
+namespace sbt {
+
+/**
+ * @brief Rarest-first piece picker shared by all peers of a client
+ *
+ * Keeps the number of connected peers that have each piece.  Pieces
+ * we still miss and nobody is downloading are kept in buckets by that
+ * availability, so moving a piece between buckets on have/bitfield
+ * is O(1) and picking starts at the rarest bucket.  Ties are broken
+ * randomly, and the first pieces are picked completely at random so
+ * that we quickly have something to trade.
+ *
+ * The buckets belong to the loop thread.  The state of the pieces is
+ * kept in a PieceTable, so claiming a piece is a compare-and-swap and
+ * the state can be read from any thread without a lock.
+ */
+class PiecePicker
+{
+public:
+  static const int RANDOM_PIECES;
+
+public:
+  PiecePicker();
+
+  /** @brief Start over with @p numPieces missing pieces nobody has
+   */
+  void
+  reset(int numPieces);
+
+  /** @brief Pick at random until we have @p numPieces pieces
+   */
+  void
+  setRandomPieces(int numPieces)
+  {
+    m_randomPieces = numPieces;
+  }
+
+  /** @brief Account for the pieces of a peer
+   */
+  void
+  addPeer(const Bitfield& bitfield);
+
+  /** @brief Remove the pieces of a disconnected peer
+   */
+  void
+  removePeer(const Bitfield& bitfield);
+
+  void
+  incrementAvailability(int index);
+
+  void
+  decrementAvailability(int index);
+
+  int
+  getAvailability(int index) const
+  {
+    return m_availability.at(index);
+  }
+
+  /** @brief Pick a piece that the peer has, we miss and nobody is
+   *         downloading, and claim it
+   *  @return the piece index, or -1 if there is none
+   */
+  int
+  pick(const Bitfield& peerHas);
+
+  /** @brief Keep a missing piece from being picked while the data we
+   *         have of it is checked, followed by setHave() or release()
+   */
+  void
+  setChecking(int index);
+
+  /** @brief Give back a claimed (or checked) piece that was not completed
+   */
+  void
+  release(int index);
+
+  /** @brief Mark a piece as completed (and verified)
+   */
+  void
+  setHave(int index);
+
+  bool
+  isClaimed(int index) const
+  {
+    return m_pieces.getState(index) == PieceTable::PIECE_CLAIMED;
+  }
+
+  int
+  getNumHave() const
+  {
+    return m_pieces.getNumVerified();
+  }
+
+  bool
+  isComplete() const
+  {
+    return m_pieces.isComplete();
+  }
+
+  /** @brief Every piece we miss is being downloaded already, so
+   *         outstanding blocks may be requested from several peers
+   */
+  bool
+  isEndgame() const
+  {
+    return m_pieces.isEndgame();
+  }
+
+  const PieceTable&
+  getPieces() const
+  {
+    return m_pieces;
+  }
+
+  /** @brief Blocks of the pieces in progress were given back, e.g.,
+   *         by a peer that went away.  Giving back a piece and the
+   *         start of the endgame count as well
+   */
+  void
+  setWorkReleased()
+  {
+    m_isWorkReleased = true;
+  }
+
+  /** @return true if work was released since the last call, so
+   *          that the peers with nothing to download look again
+   */
+  bool
+  takeWorkReleased()
+  {
+    bool isWorkReleased = m_isWorkReleased;
+    m_isWorkReleased = false;
+    return isWorkReleased;
+  }
+
+private:
+  void
+  insertPiece(int index);
+
+  void
+  erasePiece(int index);
+
+  bool
+  claimPiece(int index);
+
+  int
+  pickRandom(const Bitfield& peerHas);
+
+private:
+  std::vector<int> m_availability;
+  PieceTable m_pieces;
+
+  // m_buckets[a] holds the missing pieces that a peers have, m_pos is
+  // the position of a missing piece inside its bucket (-1 otherwise)
+  std::vector<std::vector<int>> m_buckets;
+  std::vector<int> m_pos;
+
+  // the pieces in m_buckets, i.e., the ones that can be picked
+  Bitfield m_pickable;
+
+  int m_randomPieces;
+  bool m_isWorkReleased;
+};
+
+} // namespace sbt
+
+#endif // SBT_PIECE_PICKER_HPP
@@ -0,0 +1,98 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "piece-table.hpp"
+
+namespace sbt {
+
+PieceTable::PieceTable()
+  : m_size(0)
+  , m_numVerified(0)
+  , m_numClaimed(0)
+{
+}
+
+void
+PieceTable::reset(size_t numPieces)
+{
+  m_states.reset(new std::atomic<uint8_t>[numPieces]);
+  m_size = numPieces;
+
+  for (size_t i = 0; i < numPieces; i++)
+    m_states[i].store(PIECE_MISSING, std::memory_order_relaxed);
+
+  m_numVerified.store(0);
+  m_numClaimed.store(0);
+}
+
+bool
+PieceTable::transition(size_t index, PieceState from, PieceState to)
+{
+  if (index >= m_size)
+    throw std::out_of_range("Piece is out of the table");
+
+  uint8_t expected = from;
+  return m_states[index].compare_exchange_strong(expected, to, std::memory_order_acq_rel);
+}
+
+bool
+PieceTable::claim(size_t index)
+{
+  if (!transition(index, PIECE_MISSING, PIECE_CLAIMED))
+    return false;
+
+  m_numClaimed.fetch_add(1, std::memory_order_acq_rel);
+  return true;
+}
+
+bool
+PieceTable::setChecking(size_t index)
+{
+  return transition(index, PIECE_MISSING, PIECE_CHECKING);
+}
+
+bool
+PieceTable::release(size_t index)
+{
+  if (transition(index, PIECE_CLAIMED, PIECE_MISSING)) {
+    m_numClaimed.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+  }
+
+  return transition(index, PIECE_CHECKING, PIECE_MISSING);
+}
+
+bool
+PieceTable::setVerified(size_t index)
+{
+  if (index >= m_size)
+    throw std::out_of_range("Piece is out of the table");
+
+  uint8_t old = m_states[index].exchange(PIECE_VERIFIED, std::memory_order_acq_rel);
+  if (old == PIECE_VERIFIED)
+    return false;
+
+  if (old == PIECE_CLAIMED)
+    m_numClaimed.fetch_sub(1, std::memory_order_acq_rel);
+
+  m_numVerified.fetch_add(1, std::memory_order_acq_rel);
+  return true;
+}
+
+} // namespace sbt
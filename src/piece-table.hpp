@@ -0,0 +1,139 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_PIECE_TABLE_HPP
+#define SBT_PIECE_TABLE_HPP
+
+#include "common.hpp"
+
+#include <atomic>
+
+namespace sbt {
+
+/**
+ * @brief State of every piece, safe to use from any thread without a lock
+ *
+ * Each piece has an atomic state, and every transition is a
+ * compare-and-swap from the state it expects.  Of two threads claiming
+ * the same piece only one succeeds.  The numbers of claimed and
+ * verified pieces are kept alongside, so isComplete() and isEndgame()
+ * don't have to go through the pieces.
+ */
+class PieceTable
+{
+public:
+  enum PieceState {
+    PIECE_MISSING,
+    PIECE_CLAIMED,   // being downloaded
+    PIECE_CHECKING,  // data from an earlier run being hashed
+    PIECE_VERIFIED
+  };
+
+public:
+  PieceTable();
+
+  /** @brief Start over with @p numPieces missing pieces, not thread-safe
+   */
+  void
+  reset(size_t numPieces);
+
+  size_t
+  size() const
+  {
+    return m_size;
+  }
+
+  PieceState
+  getState(size_t index) const
+  {
+    return static_cast<PieceState>(m_states[index].load(std::memory_order_acquire));
+  }
+
+  bool
+  isVerified(size_t index) const
+  {
+    return getState(index) == PIECE_VERIFIED;
+  }
+
+  /** @brief Claim a missing piece for downloading
+   *  @return false if the piece is not missing (e.g., claimed already)
+   */
+  bool
+  claim(size_t index);
+
+  /** @brief Claim a missing piece for checking the data we have of it
+   *  @return false if the piece is not missing
+   */
+  bool
+  setChecking(size_t index);
+
+  /** @brief Give back a claimed or checked piece
+   *  @return false if the piece was neither
+   */
+  bool
+  release(size_t index);
+
+  /** @brief Mark a piece as verified, whatever its state
+   *  @return false if it was verified already
+   */
+  bool
+  setVerified(size_t index);
+
+  size_t
+  getNumVerified() const
+  {
+    return m_numVerified.load(std::memory_order_acquire);
+  }
+
+  size_t
+  getNumClaimed() const
+  {
+    return m_numClaimed.load(std::memory_order_acquire);
+  }
+
+  bool
+  isComplete() const
+  {
+    return getNumVerified() == m_size;
+  }
+
+  /** @brief Every piece we miss is being downloaded already
+   */
+  bool
+  isEndgame() const
+  {
+    size_t numVerified = getNumVerified();
+    return numVerified < m_size && numVerified + getNumClaimed() == m_size;
+  }
+
+private:
+  bool
+  transition(size_t index, PieceState from, PieceState to);
+
+private:
+  unique_ptr<std::atomic<uint8_t>[]> m_states;
+  size_t m_size;
+
+  std::atomic<size_t> m_numVerified;
+  std::atomic<size_t> m_numClaimed;
+};
+
+} // namespace sbt
+
+#endif // SBT_PIECE_TABLE_HPP
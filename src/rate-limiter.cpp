@@ -0,0 +1,120 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rate-limiter.hpp"
+
+#include <algorithm>
+
+namespace sbt {
+
+TokenBucket::TokenBucket(uint64_t rate)
+  : m_rate(rate)
+  , m_tokens(rate)
+  , m_lastRefill(Clock::now())
+{
+}
+
+void
+TokenBucket::setRate(uint64_t rate, Clock::time_point now)
+{
+  refill(now);
+
+  m_rate = rate;
+  m_tokens = std::min(m_tokens, static_cast<double>(rate));
+}
+
+void
+TokenBucket::refill(Clock::time_point now)
+{
+  double elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(now - m_lastRefill).count();
+  m_lastRefill = now;
+
+  if (elapsed <= 0)
+    return;
+
+  // at most one second worth of tokens
+  m_tokens = std::min(m_tokens + elapsed * m_rate, static_cast<double>(m_rate));
+}
+
+bool
+TokenBucket::hasTokens(Clock::time_point now)
+{
+  if (!isLimited())
+    return true;
+
+  refill(now);
+  return m_tokens > 0;
+}
+
+void
+TokenBucket::consume(size_t bytes, Clock::time_point now)
+{
+  if (!isLimited())
+    return;
+
+  refill(now);
+  m_tokens -= bytes;
+}
+
+TokenBucket::Clock::duration
+TokenBucket::getWaitTime(Clock::time_point now)
+{
+  if (hasTokens(now))
+    return Clock::duration::zero();
+
+  // rounded up, so that there are tokens once it is over
+  std::chrono::duration<double> wait(-m_tokens / m_rate);
+  return std::chrono::duration_cast<Clock::duration>(wait) + std::chrono::microseconds(1);
+}
+
+RateLimiter::RateLimiter(uint64_t rate)
+  : m_bucket(rate)
+{
+}
+
+bool
+RateLimiter::request(size_t bytes, const Callback& onGranted)
+{
+  // the ones waiting go first
+  if (m_waiting.empty() && m_bucket.hasTokens()) {
+    m_bucket.consume(bytes);
+    return true;
+  }
+
+  Request request;
+  request.bytes = bytes;
+  request.onGranted = onGranted;
+  m_waiting.push_back(request);
+  return false;
+}
+
+void
+RateLimiter::tick()
+{
+  // a granted peer may queue up again, behind the others
+  while (!m_waiting.empty() && m_bucket.hasTokens()) {
+    Request request = m_waiting.front();
+    m_waiting.pop_front();
+
+    m_bucket.consume(request.bytes);
+    request.onGranted();
+  }
+}
+
+} // namespace sbt
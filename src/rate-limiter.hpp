@@ -0,0 +1,157 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_RATE_LIMITER_HPP
+#define SBT_RATE_LIMITER_HPP
+
+#include "common.hpp"
+
+#include <deque>
+#include <chrono>
+
+namespace sbt {
+
+/**
+ * @brief Token bucket limiting a transfer to a rate in bytes/s
+ *
+ * Tokens accumulate at the rate, up to one second worth of them.  A
+ * transfer may be started as long as there are tokens left and takes
+ * the bucket into debt if it is larger, so a rate below a block size
+ * still lets blocks through.  A rate of 0 means unlimited.
+ */
+class TokenBucket
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+public:
+  explicit
+  TokenBucket(uint64_t rate = 0);
+
+  /** @brief Change the rate, the tokens saved up are kept up to
+   *         the new burst size
+   */
+  void
+  setRate(uint64_t rate, Clock::time_point now = Clock::now());
+
+  uint64_t
+  getRate() const
+  {
+    return m_rate;
+  }
+
+  bool
+  isLimited() const
+  {
+    return m_rate > 0;
+  }
+
+  /** @return true if a transfer may start
+   */
+  bool
+  hasTokens(Clock::time_point now = Clock::now());
+
+  void
+  consume(size_t bytes, Clock::time_point now = Clock::now());
+
+  /** @return how long until a transfer may start, zero if it may
+   *          now
+   */
+  Clock::duration
+  getWaitTime(Clock::time_point now = Clock::now());
+
+private:
+  void
+  refill(Clock::time_point now);
+
+private:
+  uint64_t m_rate;
+  double m_tokens;
+  Clock::time_point m_lastRefill;
+};
+
+/**
+ * @brief Token bucket shared by all the peers, handing out its tokens
+ *        in the order they were asked for
+ *
+ * A peer asks for the bytes of a transfer with request().  If the
+ * bucket is empty, or other peers are waiting already, the request
+ * is queued and granted by a later tick().  Each grant covers one
+ * transfer, a peer with more to do asks again and queues behind the
+ * others, so a low limit is shared round robin instead of going to
+ * whoever asks first.
+ */
+class RateLimiter
+{
+public:
+  typedef function<void()> Callback;
+
+public:
+  explicit
+  RateLimiter(uint64_t rate = 0);
+
+  /** @brief Change the rate, 0 for unlimited.  Takes effect with the
+   *         next request or tick()
+   */
+  void
+  setRate(uint64_t rate)
+  {
+    m_bucket.setRate(rate);
+  }
+
+  uint64_t
+  getRate() const
+  {
+    return m_bucket.getRate();
+  }
+
+  /** @brief Take @p bytes for a transfer
+   *  @return true if the transfer may start now, otherwise
+   *          @p onGranted is called once it may (with the bytes
+   *          taken already)
+   */
+  bool
+  request(size_t bytes, const Callback& onGranted);
+
+  /** @brief Grant the waiting requests the tokens that were added
+   *         since the last call allow
+   */
+  void
+  tick();
+
+  size_t
+  getNumWaiting() const
+  {
+    return m_waiting.size();
+  }
+
+private:
+  struct Request
+  {
+    size_t bytes;
+    Callback onGranted;
+  };
+
+  TokenBucket m_bucket;
+  std::deque<Request> m_waiting;
+};
+
+} // namespace sbt
+
+#endif // SBT_RATE_LIMITER_HPP
@@ -0,0 +1,168 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resume-data.hpp"
+
+#include <fstream>
+#include <boost/crc.hpp>
+
+#include <stdio.h>
+
+namespace sbt {
+
+const std::string ResumeData::INFO_HASH("info hash");
+const std::string ResumeData::LENGTH("length");
+const std::string ResumeData::MTIME("mtime");
+const std::string ResumeData::PIECES("pieces");
+const std::string ResumeData::CHECKSUMS("checksums");
+
+ResumeData::ResumeData()
+  : m_infoHash(make_shared<Buffer>())
+  , m_length(0)
+  , m_mtime(0)
+  , m_isDirty(false)
+{
+}
+
+void
+ResumeData::reset(ConstBufferPtr infoHash, int numPieces)
+{
+  m_infoHash = infoHash;
+  m_length = 0;
+  m_mtime = 0;
+  m_pieces = Bitfield(numPieces);
+  m_checksums = std::vector<uint32_t>(numPieces, 0);
+  m_isDirty = true;
+}
+
+void
+ResumeData::setPiece(int index, uint32_t checksum)
+{
+  m_pieces.set(index);
+  m_checksums.at(index) = checksum;
+  m_isDirty = true;
+}
+
+uint32_t
+ResumeData::checksum(const uint8_t* buf, size_t size)
+{
+  boost::crc_32_type crc;
+  crc.process_bytes(buf, size);
+  return crc.checksum();
+}
+
+void
+ResumeData::wireEncode(std::ostream& os) const
+{
+  size_t numPieces = m_pieces.size();
+
+  std::vector<uint8_t> checksums(numPieces * 4, 0);
+  for (size_t i = 0; i < numPieces; i++) {
+    checksums[i * 4] = m_checksums[i] >> 24;
+    checksums[i * 4 + 1] = m_checksums[i] >> 16;
+    checksums[i * 4 + 2] = m_checksums[i] >> 8;
+    checksums[i * 4 + 3] = m_checksums[i];
+  }
+
+  bencoding::Dictionary dict;
+  dict.insert(INFO_HASH, make_shared<bencoding::String>(m_infoHash->buf(), m_infoHash->size()));
+  dict.insert(LENGTH, make_shared<bencoding::Integer>(m_length));
+  dict.insert(MTIME, make_shared<bencoding::Integer>(m_mtime));
+  ConstBufferPtr pieces = m_pieces.getBytes();
+  dict.insert(PIECES, make_shared<bencoding::String>(pieces->buf(), pieces->size()));
+  dict.insert(CHECKSUMS, make_shared<bencoding::String>(checksums.data(), checksums.size()));
+
+  dict.wireEncode(os);
+}
+
+void
+ResumeData::wireDecode(std::istream& is)
+{
+  bencoding::Dictionary dict;
+  dict.wireDecode(is);
+
+  auto infoHash = dynamic_pointer_cast<bencoding::String>(dict.get(INFO_HASH));
+  auto length = dynamic_pointer_cast<bencoding::Integer>(dict.get(LENGTH));
+  auto mtime = dynamic_pointer_cast<bencoding::Integer>(dict.get(MTIME));
+  auto pieces = dynamic_pointer_cast<bencoding::String>(dict.get(PIECES));
+  auto checksums = dynamic_pointer_cast<bencoding::String>(dict.get(CHECKSUMS));
+
+  if (!infoHash || !length || !mtime || !pieces || !checksums)
+    throw Error("missing field in resume data");
+
+  if (checksums->size() % 4 != 0 ||
+      pieces->size() != (checksums->size() / 4 + 7) / 8)
+    throw Error("inconsistent pieces in resume data");
+
+  size_t numPieces = checksums->size() / 4;
+  const uint8_t* crc = checksums->value();
+
+  m_infoHash = make_shared<Buffer>(infoHash->value(), infoHash->size());
+  m_length = length->getValue();
+  m_mtime = mtime->getValue();
+  m_pieces = Bitfield(pieces->value(), numPieces);
+  m_checksums = std::vector<uint32_t>(numPieces);
+  for (size_t i = 0; i < numPieces; i++) {
+    m_checksums[i] = (static_cast<uint32_t>(crc[i * 4]) << 24) |
+                     (static_cast<uint32_t>(crc[i * 4 + 1]) << 16) |
+                     (static_cast<uint32_t>(crc[i * 4 + 2]) << 8) |
+                     static_cast<uint32_t>(crc[i * 4 + 3]);
+  }
+
+  m_isDirty = false;
+}
+
+bool
+ResumeData::load(const std::string& path)
+{
+  std::ifstream is(path, std::ios::binary);
+  if (!is)
+    return false;
+
+  try {
+    wireDecode(is);
+  }
+  catch (const bencoding::Error& e) {
+    return false;
+  }
+
+  return true;
+}
+
+bool
+ResumeData::save(const std::string& path)
+{
+  // write aside and rename, so a crash never leaves a torn sidecar
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream os(tmpPath, std::ios::binary | std::ios::trunc);
+    wireEncode(os);
+    os.flush();
+    if (!os)
+      return false;
+  }
+
+  if (rename(tmpPath.c_str(), path.c_str()) != 0)
+    return false;
+
+  m_isDirty = false;
+  return true;
+}
+
+} // namespace sbt
@@ -0,0 +1,166 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_RESUME_DATA_HPP
+#define SBT_RESUME_DATA_HPP
+
+#include "common.hpp"
+#include "bitfield.hpp"
+#include "util/bencoding.hpp"
+
+namespace sbt {
+
+/**
+ * @brief Fast-resume state of a download, kept in a sidecar file
+ *
+ * Records which pieces are done together with the size and modification
+ * time of the file at the time it was saved, so that an unchanged file
+ * does not need to be hashed again on restart.  Every done piece also
+ * has a CRC-32 of its data, which is much cheaper to check than SHA-1
+ * when the file was touched since.
+ *
+ * The sidecar is a bencoded dictionary:
+ *
+ *     info hash: 20 byte SHA-1 of the info dictionary
+ *     length:    file size
+ *     mtime:     file modification time in nanoseconds
+ *     pieces:    bitfield of the done pieces, as on the wire
+ *     checksums: big-endian CRC-32 of every piece, 0 if not done
+ */
+class ResumeData
+{
+public:
+  class Error : public bencoding::Error
+  {
+  public:
+    explicit
+    Error(const std::string& what)
+      : bencoding::Error(what)
+    {
+    }
+  };
+
+public:
+  ResumeData();
+
+  /** @brief Start over with no done pieces
+   */
+  void
+  reset(ConstBufferPtr infoHash, int numPieces);
+
+  void
+  wireEncode(std::ostream& os) const;
+
+  /** @throws ResumeData::Error if the data is malformed
+   */
+  void
+  wireDecode(std::istream& is);
+
+  /** @brief Read the sidecar at @p path
+   *  @return false if it is missing or malformed
+   */
+  bool
+  load(const std::string& path);
+
+  /** @brief Replace the sidecar at @p path atomically
+   *  @return false on I/O error
+   */
+  bool
+  save(const std::string& path);
+
+  ConstBufferPtr
+  getInfoHash() const
+  {
+    return m_infoHash;
+  }
+
+  int
+  getNumPieces() const
+  {
+    return m_pieces.size();
+  }
+
+  uint64_t
+  getLength() const
+  {
+    return m_length;
+  }
+
+  int64_t
+  getMtime() const
+  {
+    return m_mtime;
+  }
+
+  /** @brief Record the state of the file the pieces are stored in
+   */
+  void
+  setFileInfo(uint64_t length, int64_t mtime)
+  {
+    m_length = length;
+    m_mtime = mtime;
+  }
+
+  bool
+  hasPiece(int index) const
+  {
+    return m_pieces.test(index);
+  }
+
+  uint32_t
+  getChecksum(int index) const
+  {
+    return m_checksums.at(index);
+  }
+
+  /** @brief Mark a verified piece as done, with the CRC-32 of its data
+   */
+  void
+  setPiece(int index, uint32_t checksum);
+
+  /** @brief There are changes that are not saved yet
+   */
+  bool
+  isDirty() const
+  {
+    return m_isDirty;
+  }
+
+  static uint32_t
+  checksum(const uint8_t* buf, size_t size);
+
+public:
+  static const std::string INFO_HASH;
+  static const std::string LENGTH;
+  static const std::string MTIME;
+  static const std::string PIECES;
+  static const std::string CHECKSUMS;
+
+private:
+  ConstBufferPtr m_infoHash;
+  uint64_t m_length;
+  int64_t m_mtime;
+  Bitfield m_pieces;
+  std::vector<uint32_t> m_checksums;
+  bool m_isDirty;
+};
+
+} // namespace sbt
+
+#endif // SBT_RESUME_DATA_HPP
@@ -0,0 +1,210 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "storage.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace sbt {
+
+// keep the address space use modest on 32-bit hosts
+const uint64_t Storage::MMAP_LIMIT = sizeof(void*) >= 8 ? (1ULL << 32) : (1ULL << 28);
+
+shared_ptr<Storage>
+Storage::open(const std::string& path, uint64_t length)
+{
+  if (length <= MMAP_LIMIT)
+    return make_shared<MmapStorage>(path, length);
+  else
+    return make_shared<FileStorage>(path, length);
+}
+
+Storage::Storage(const std::string& path, uint64_t length)
+  : m_fd(-1)
+  , m_length(length)
+  , m_hasExistingData(false)
+{
+  m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (m_fd == -1)
+    throw Error("cannot open " + path + ": " + strerror(errno));
+
+  struct stat st;
+  if (fstat(m_fd, &st) == -1) {
+    ::close(m_fd);
+    throw Error("cannot stat " + path + ": " + strerror(errno));
+  }
+
+  if (static_cast<uint64_t>(st.st_size) == length) {
+    m_hasExistingData = true;
+    return;
+  }
+
+  // not the right length, start over with an empty (sparse) file
+  if (ftruncate(m_fd, 0) == -1 || ftruncate(m_fd, length) == -1) {
+    ::close(m_fd);
+    throw Error("cannot allocate " + path + ": " + strerror(errno));
+  }
+}
+
+Storage::~Storage()
+{
+  if (m_fd != -1)
+    ::close(m_fd);
+}
+
+int64_t
+Storage::getModificationTime() const
+{
+  struct stat st;
+  if (fstat(m_fd, &st) == -1)
+    return -1;
+
+  return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool
+Storage::prefetch(uint64_t offset, size_t size)
+{
+  if (!isInBounds(offset, size))
+    return false;
+
+  return readahead(m_fd, offset, size) == 0;
+}
+
+MmapStorage::MmapStorage(const std::string& path, uint64_t length)
+  : Storage(path, length)
+  , m_data(nullptr)
+{
+  // an empty file cannot be mapped, there is nothing to access anyway
+  if (m_length == 0)
+    return;
+
+  // A write to a hole of a sparse mapping that finds the disk full
+  // raises SIGBUS instead of failing, so the blocks are allocated
+  // up front. A file without holes is left alone, which keeps its
+  // modification time for the resume data
+  struct stat st;
+  if (fstat(m_fd, &st) == -1 || static_cast<uint64_t>(st.st_blocks) * 512 < m_length) {
+    int error = posix_fallocate(m_fd, 0, m_length);
+    if (error != 0)
+      throw Error("cannot allocate " + path + ": " + strerror(error));
+  }
+
+  void* data = mmap(nullptr, m_length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (data == MAP_FAILED)
+    throw Error("cannot map " + path + ": " + strerror(errno));
+
+  m_data = static_cast<uint8_t*>(data);
+}
+
+MmapStorage::~MmapStorage()
+{
+  if (m_data != nullptr)
+    munmap(m_data, m_length);
+}
+
+bool
+MmapStorage::read(uint64_t offset, uint8_t* buf, size_t size)
+{
+  if (!isInBounds(offset, size))
+    return false;
+
+  memcpy(buf, m_data + offset, size);
+  return true;
+}
+
+bool
+MmapStorage::write(uint64_t offset, const uint8_t* buf, size_t size)
+{
+  if (!isInBounds(offset, size))
+    return false;
+
+  memcpy(m_data + offset, buf, size);
+  return true;
+}
+
+void
+MmapStorage::sync()
+{
+  if (m_data != nullptr)
+    msync(m_data, m_length, MS_ASYNC);
+}
+
+FileStorage::FileStorage(const std::string& path, uint64_t length)
+  : Storage(path, length)
+{
+}
+
+bool
+FileStorage::read(uint64_t offset, uint8_t* buf, size_t size)
+{
+  if (!isInBounds(offset, size))
+    return false;
+
+  while (size > 0) {
+    ssize_t n = pread(m_fd, buf, size, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+
+    buf += n;
+    offset += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+bool
+FileStorage::write(uint64_t offset, const uint8_t* buf, size_t size)
+{
+  if (!isInBounds(offset, size))
+    return false;
+
+  while (size > 0) {
+    ssize_t n = pwrite(m_fd, buf, size, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+
+    buf += n;
+    offset += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+void
+FileStorage::sync()
+{
+  // start the write-back of the whole file without waiting for it,
+  // like msync(MS_ASYNC) does for the mapping
+  sync_file_range(m_fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+}
+
+} // namespace sbt
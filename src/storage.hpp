@@ -0,0 +1,179 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_STORAGE_HPP
+#define SBT_STORAGE_HPP
+
+#include "common.hpp"
+
+namespace sbt {
+
+/**
+ * @brief Random access storage of the downloaded file
+ *
+ * Reads and writes are positional and do not share any state, so
+ * different pieces can be accessed concurrently without a lock.  Use
+ * Storage::open() to get the backend suited to the file size.
+ */
+class Storage
+{
+public:
+  class Error : public std::runtime_error
+  {
+  public:
+    explicit
+    Error(const std::string& what)
+      : std::runtime_error(what)
+    {
+    }
+  };
+
+  // larger files are accessed with pread/pwrite instead of being mapped
+  static const uint64_t MMAP_LIMIT;
+
+public:
+  virtual
+  ~Storage();
+
+  /** @brief Open @p path, creating it or resizing it to @p length
+   *         bytes if needed
+   *  @throws Storage::Error if the file cannot be opened
+   */
+  static shared_ptr<Storage>
+  open(const std::string& path, uint64_t length);
+
+  uint64_t
+  getLength() const
+  {
+    return m_length;
+  }
+
+  /** @brief Descriptor of the file, e.g., to sendfile() from it.  Written
+   *         data is visible through it right away with every backend
+   */
+  int
+  getFd() const
+  {
+    return m_fd;
+  }
+
+  /** @brief The file was there already with the right size, so it may
+   *         hold pieces from an earlier run
+   */
+  bool
+  hasExistingData() const
+  {
+    return m_hasExistingData;
+  }
+
+  /** @brief Modification time of the file in nanoseconds, -1 on error
+   */
+  int64_t
+  getModificationTime() const;
+
+  /** @brief Bring @p size bytes at @p offset into the page cache,
+   *         waiting for the disk.  Sending the range with sendfile()
+   *         afterwards does not block on it
+   *  @return false if the range is out of bounds or on an I/O error
+   */
+  bool
+  prefetch(uint64_t offset, size_t size);
+
+  /** @brief Copy @p size bytes at @p offset into @p buf
+   *  @return false if the range is out of bounds or on an I/O error
+   */
+  virtual bool
+  read(uint64_t offset, uint8_t* buf, size_t size) = 0;
+
+  /** @brief Copy @p size bytes from @p buf to @p offset
+   *  @return false if the range is out of bounds or on an I/O error
+   */
+  virtual bool
+  write(uint64_t offset, const uint8_t* buf, size_t size) = 0;
+
+  /** @brief Schedule the written data to be flushed to the disk
+   */
+  virtual void
+  sync() = 0;
+
+protected:
+  Storage(const std::string& path, uint64_t length);
+
+  bool
+  isInBounds(uint64_t offset, size_t size) const
+  {
+    return offset <= m_length && size <= m_length - offset;
+  }
+
+protected:
+  int m_fd;
+  uint64_t m_length;
+  bool m_hasExistingData;
+};
+
+/**
+ * @brief Storage backed by a shared memory mapping of the whole file
+ *
+ * The file is allocated on the disk before it is mapped, so running
+ * out of space is reported when opening it rather than by a SIGBUS
+ * on a write.
+ */
+class MmapStorage : public Storage
+{
+public:
+  MmapStorage(const std::string& path, uint64_t length);
+
+  virtual
+  ~MmapStorage();
+
+  virtual bool
+  read(uint64_t offset, uint8_t* buf, size_t size);
+
+  virtual bool
+  write(uint64_t offset, const uint8_t* buf, size_t size);
+
+  virtual void
+  sync();
+
+private:
+  uint8_t* m_data;
+};
+
+/**
+ * @brief Storage accessed with pread/pwrite, for files too large to
+ *        map comfortably
+ */
+class FileStorage : public Storage
+{
+public:
+  FileStorage(const std::string& path, uint64_t length);
+
+  virtual bool
+  read(uint64_t offset, uint8_t* buf, size_t size);
+
+  virtual bool
+  write(uint64_t offset, const uint8_t* buf, size_t size);
+
+  virtual void
+  sync();
+};
+
+} // namespace sbt
+
+#endif // SBT_STORAGE_HPP
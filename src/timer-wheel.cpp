@@ -0,0 +1,237 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timer-wheel.hpp"
+
+#include <algorithm>
+
+namespace sbt {
+
+// 64 slots of 10 ms, 0.64 s, 41 s, 44 min and 1.9 days per level
+const TimerWheel::Clock::duration TimerWheel::TICK = std::chrono::milliseconds(10);
+const size_t TimerWheel::SLOTS = 64;
+const size_t TimerWheel::NUM_LEVELS = 4;
+
+static const unsigned SLOT_BITS = 6;
+static const uint64_t SLOT_MASK = (1 << SLOT_BITS) - 1;
+
+// the end of a list, and the list of a free node
+static const uint32_t NIL = 0xFFFFFFFF;
+
+TimerWheel::TimerWheel(Clock::time_point now)
+  : m_start(now)
+  , m_tick(0)
+  , m_heads(SLOTS * NUM_LEVELS, NIL)
+  , m_size(0)
+{
+}
+
+uint64_t
+TimerWheel::getTick(Clock::time_point time) const
+{
+  if (time <= m_start)
+    return 0;
+
+  return (time - m_start) / TICK;
+}
+
+TimerWheel::TimerId
+TimerWheel::schedule(Clock::duration delay, const Callback& callback,
+                     Clock::time_point now)
+{
+  // the tick at or after the expiry, and never the tick that is
+  // done already
+  uint64_t expiry = getTick(now + delay + TICK - Clock::duration(1));
+  expiry = std::max(expiry, m_tick + 1);
+  expiry = std::min<uint64_t>(expiry, m_tick + (1ULL << (SLOT_BITS * NUM_LEVELS)) - 1);
+
+  uint32_t node = 0;
+  if (!m_freeNodes.empty()) {
+    node = m_freeNodes.back();
+    m_freeNodes.pop_back();
+  }
+  else {
+    node = m_nodes.size();
+    m_nodes.push_back(Node());
+    m_nodes[node].generation = 1;
+  }
+
+  m_nodes[node].expiry = expiry;
+  m_nodes[node].callback = callback;
+  insert(node);
+  m_size++;
+
+  return (static_cast<uint64_t>(m_nodes[node].generation) << 32) | node;
+}
+
+bool
+TimerWheel::cancel(TimerId id)
+{
+  uint32_t node = id & 0xFFFFFFFF;
+  if (node >= m_nodes.size() ||
+      m_nodes[node].generation != (id >> 32) ||
+      m_nodes[node].list == NIL)
+    return false;
+
+  unlink(node);
+  release(node);
+  return true;
+}
+
+size_t
+TimerWheel::advance(Clock::time_point now)
+{
+  uint64_t target = getTick(now);
+
+  if (m_size == 0) {
+    m_tick = std::max(m_tick, target);
+    return 0;
+  }
+
+  size_t numRun = 0;
+  while (m_tick < target) {
+    m_tick++;
+
+    // when a level wraps around, the timers of the next slot of
+    // the level above move down
+    for (size_t level = 1; level < NUM_LEVELS; level++) {
+      if (((m_tick >> (SLOT_BITS * (level - 1))) & SLOT_MASK) != 0)
+        break;
+      cascade(level);
+    }
+
+    // the timers scheduled by the callbacks expire later, so they
+    // never end up in this slot
+    uint32_t& head = m_heads[m_tick & SLOT_MASK];
+    while (head != NIL) {
+      uint32_t node = head;
+      unlink(node);
+
+      Callback callback;
+      callback.swap(m_nodes[node].callback);
+      release(node);
+
+      callback();
+      numRun++;
+    }
+  }
+
+  return numRun;
+}
+
+int
+TimerWheel::getTimeout(Clock::time_point now) const
+{
+  if (m_size == 0)
+    return -1;
+
+  // the first busy slot of each level, a slot above the first
+  // level is due when the wheel gets to it and moves its timers
+  uint64_t next = std::numeric_limits<uint64_t>::max();
+  for (size_t level = 0; level < NUM_LEVELS; level++) {
+    unsigned shift = SLOT_BITS * level;
+    uint64_t current = m_tick >> shift;
+
+    for (uint64_t d = 1; d <= SLOTS; d++) {
+      if (m_heads[level * SLOTS + ((current + d) & SLOT_MASK)] != NIL) {
+        next = std::min(next, (current + d) << shift);
+        break;
+      }
+    }
+  }
+
+  Clock::time_point due = m_start + TICK * next;
+  if (due <= now)
+    return 0;
+
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count() + 1;
+  return static_cast<int>(std::min<int64_t>(ms, std::numeric_limits<int>::max()));
+}
+
+void
+TimerWheel::insert(uint32_t node)
+{
+  // the lowest level that reaches the expiry
+  uint64_t delta = m_nodes[node].expiry - std::min(m_nodes[node].expiry, m_tick);
+  size_t level = 0;
+  while (level + 1 < NUM_LEVELS && delta >> (SLOT_BITS * (level + 1)) != 0)
+    level++;
+
+  uint64_t slot = (m_nodes[node].expiry >> (SLOT_BITS * level)) & SLOT_MASK;
+  link(node, level * SLOTS + slot);
+}
+
+void
+TimerWheel::link(uint32_t node, uint32_t list)
+{
+  Node& n = m_nodes[node];
+  n.prev = NIL;
+  n.next = m_heads[list];
+  n.list = list;
+
+  if (n.next != NIL)
+    m_nodes[n.next].prev = node;
+  m_heads[list] = node;
+}
+
+void
+TimerWheel::unlink(uint32_t node)
+{
+  Node& n = m_nodes[node];
+
+  if (n.prev != NIL)
+    m_nodes[n.prev].next = n.next;
+  else
+    m_heads[n.list] = n.next;
+
+  if (n.next != NIL)
+    m_nodes[n.next].prev = n.prev;
+
+  n.list = NIL;
+}
+
+void
+TimerWheel::release(uint32_t node)
+{
+  Node& n = m_nodes[node];
+  n.callback = nullptr;
+
+  // the ids of the node's timers so far are stale now
+  if (++n.generation == 0)
+    n.generation = 1;
+
+  m_freeNodes.push_back(node);
+  m_size--;
+}
+
+void
+TimerWheel::cascade(size_t level)
+{
+  uint32_t& head = m_heads[level * SLOTS + ((m_tick >> (SLOT_BITS * level)) & SLOT_MASK)];
+
+  // the timers are due within a slot of the level above, so they
+  // move to a lower level
+  while (head != NIL) {
+    uint32_t node = head;
+    unlink(node);
+    insert(node);
+  }
+}
+
+} // namespace sbt
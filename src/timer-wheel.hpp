@@ -0,0 +1,138 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_TIMER_WHEEL_HPP
+#define SBT_TIMER_WHEEL_HPP
+
+#include "common.hpp"
+
+#include <vector>
+#include <chrono>
+
+namespace sbt {
+
+/**
+ * @brief Hierarchical timer wheel
+ *
+ * Time is cut into ticks of TICK.  The first level has a slot for each
+ * of the next SLOTS ticks, every further level a slot for SLOTS slots
+ * of the level below, so NUM_LEVELS levels cover SLOTS^NUM_LEVELS
+ * ticks; later timers are clamped to that.  A timer is put in the slot
+ * of the lowest level that reaches its expiry, and moved down a level
+ * when the wheel gets to its slot, so scheduling and cancelling are
+ * O(1), and the timers of a slot in the first level are all due.
+ *
+ * The timers live in a slab of nodes linked into the slots, an id
+ * carries the generation of its node so that cancelling a timer that
+ * ran already does nothing.  Callbacks may schedule and cancel timers.
+ */
+class TimerWheel
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+  typedef function<void()> Callback;
+
+  // 0 is never the id of a timer
+  typedef uint64_t TimerId;
+
+  static const Clock::duration TICK;
+  static const size_t SLOTS;
+  static const size_t NUM_LEVELS;
+
+public:
+  explicit
+  TimerWheel(Clock::time_point now = Clock::now());
+
+  /** @brief Run @p callback once @p delay has passed, at the first
+   *         advance() after that
+   */
+  TimerId
+  schedule(Clock::duration delay, const Callback& callback,
+           Clock::time_point now = Clock::now());
+
+  /** @return false if the timer ran or was cancelled already
+   */
+  bool
+  cancel(TimerId id);
+
+  /** @brief Run the timers that are due
+   *  @return the number of timers run
+   */
+  size_t
+  advance(Clock::time_point now = Clock::now());
+
+  /** @return milliseconds until advance() has something to do (a
+   *          timer is due, or has to move down a level), -1 if there
+   *          are no timers
+   */
+  int
+  getTimeout(Clock::time_point now = Clock::now()) const;
+
+  size_t
+  size() const
+  {
+    return m_size;
+  }
+
+private:
+  uint64_t
+  getTick(Clock::time_point time) const;
+
+  void
+  insert(uint32_t node);
+
+  void
+  link(uint32_t node, uint32_t list);
+
+  void
+  unlink(uint32_t node);
+
+  void
+  release(uint32_t node);
+
+  void
+  cascade(size_t level);
+
+private:
+  struct Node
+  {
+    uint32_t prev;
+    uint32_t next;
+    // the slot the node is linked into
+    uint32_t list;
+    uint32_t generation;
+    uint64_t expiry;
+    Callback callback;
+  };
+
+  Clock::time_point m_start;
+  // the last tick advanced to, the slots of the ticks up to it are done
+  uint64_t m_tick;
+
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_freeNodes;
+
+  // the first node of every slot, level by level
+  std::vector<uint32_t> m_heads;
+  size_t m_size;
+};
+
+} // namespace sbt
+
+#endif // SBT_TIMER_WHEEL_HPP
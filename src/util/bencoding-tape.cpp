@@ -0,0 +1,301 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bencoding-tape.hpp"
+#include "bencoding.hpp"
+
+#include <limits>
+#include <string.h>
+
+namespace sbt {
+namespace bencoding {
+
+static bool
+isDigit(uint8_t c)
+{
+  return c >= '0' && c <= '9';
+}
+
+Tape::Tape()
+  : m_data(nullptr)
+  , m_size(0)
+{
+}
+
+size_t
+Tape::parse(const uint8_t* data, size_t size)
+{
+  m_data = data;
+  m_size = size;
+  m_tokens.clear();
+  m_open.clear();
+
+  size_t pos = 0;
+  try {
+    do {
+      if (pos >= m_size)
+        throw Error("Bad encoding: truncated");
+
+      uint8_t c = m_data[pos];
+
+      // keys and values alternate in a dictionary, keys are strings
+      if (!m_open.empty()) {
+        const Token& container = m_tokens[m_open.back()];
+        if (container.type == TYPE_DICTIONARY && container.size % 2 == 0 &&
+            c != 'e' && !isDigit(c))
+          throw Error("Bad map encoding: key is not a string");
+      }
+
+      if (c == 'e') {
+        if (m_open.empty())
+          throw Error("Bad encoding: unexpected end");
+
+        Token& container = m_tokens[m_open.back()];
+        if (container.type == TYPE_DICTIONARY) {
+          if (container.size % 2 != 0)
+            throw Error("Bad map encoding: key without value");
+          container.size /= 2;
+        }
+
+        pos++;
+        container.end = pos;
+        container.next = m_tokens.size();
+        m_open.pop_back();
+        addItem();
+      }
+      else if (c == 'l' || c == 'd') {
+        m_open.push_back(m_tokens.size());
+        m_tokens.push_back({c == 'l' ? TYPE_LIST : TYPE_DICTIONARY, pos, 0, 0, 0, 0});
+        pos++;
+      }
+      else if (c == 'i') {
+        parseInteger(pos);
+        addItem();
+      }
+      else if (isDigit(c)) {
+        parseString(pos);
+        addItem();
+      }
+      else {
+        throw Error("Bad encoding");
+      }
+    } while (!m_open.empty());
+  }
+  catch (const Error&) {
+    m_tokens.clear();
+    m_open.clear();
+    throw;
+  }
+
+  return pos;
+}
+
+void
+Tape::addItem()
+{
+  if (!m_open.empty())
+    m_tokens[m_open.back()].size++;
+}
+
+void
+Tape::parseInteger(size_t& pos)
+{
+  size_t begin = pos;
+  size_t i = pos + 1;
+
+  bool isNegative = i < m_size && m_data[i] == '-';
+  if (isNegative)
+    i++;
+
+  size_t digits = i;
+  uint64_t value = 0;
+  bool isOverflow = false;
+  for (; i < m_size && isDigit(m_data[i]); i++) {
+    uint64_t digit = m_data[i] - '0';
+    if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+      isOverflow = true;
+    value = value * 10 + digit;
+  }
+
+  // no leading zeros, and no negative zero
+  uint64_t limit = std::numeric_limits<int64_t>::max();
+  bool isValid = i < m_size && m_data[i] == 'e' && i > digits &&
+                 !(m_data[digits] == '0' && (i - digits > 1 || isNegative)) &&
+                 !isOverflow && value <= limit + (isNegative ? 1 : 0);
+
+  // the text is only copied for the message
+  if (!isValid)
+    throw Error("Bad integer: " + std::string(m_data + begin, m_data + std::min(i + 1, m_size)));
+
+  int64_t integer = isNegative ? -static_cast<int64_t>(value - 1) - 1 : static_cast<int64_t>(value);
+
+  pos = i + 1;
+  m_tokens.push_back({TYPE_INTEGER, begin, pos, m_tokens.size() + 1, 0, integer});
+}
+
+void
+Tape::parseString(size_t& pos)
+{
+  size_t begin = pos;
+  size_t i = pos;
+
+  uint64_t length = 0;
+  for (; i < m_size && isDigit(m_data[i]); i++) {
+    length = length * 10 + (m_data[i] - '0');
+
+    // cannot fit anyway, stop before it overflows
+    if (length > m_size)
+      throw Error("Bad size: " + std::string(m_data + begin, m_data + i + 1));
+  }
+
+  if (i >= m_size || m_data[i] != ':')
+    throw Error("Bad encoding");
+
+  if (m_data[begin] == '0' && i - begin > 1)
+    throw Error("Bad size: " + std::string(m_data + begin, m_data + i));
+
+  i++;
+  if (length > m_size - i)
+    throw Error("Bad encoding: truncated string");
+
+  pos = i + length;
+  m_tokens.push_back({TYPE_STRING, begin, pos, m_tokens.size() + 1, length, 0});
+}
+
+Value
+Tape::getRoot() const
+{
+  if (m_tokens.empty())
+    return Value();
+
+  return Value(this, 0, m_tokens.size());
+}
+
+Value::Value()
+  : m_tape(nullptr)
+  , m_index(0)
+  , m_limit(0)
+{
+}
+
+Value::Value(const Tape* tape, size_t index, size_t limit)
+  : m_tape(tape)
+  , m_index(index)
+  , m_limit(limit)
+{
+}
+
+void
+Value::checkType(Type type) const
+{
+  if (getToken().type != type)
+    throw Error("Unexpected type of value");
+}
+
+const uint8_t*
+Value::getStringData() const
+{
+  checkType(TYPE_STRING);
+  return m_tape->getData() + getToken().end - getToken().size;
+}
+
+size_t
+Value::getStringSize() const
+{
+  checkType(TYPE_STRING);
+  return getToken().size;
+}
+
+std::string
+Value::toString() const
+{
+  const uint8_t* data = getStringData();
+  return std::string(data, data + getStringSize());
+}
+
+int64_t
+Value::getInteger() const
+{
+  checkType(TYPE_INTEGER);
+  return getToken().integer;
+}
+
+size_t
+Value::getNumItems() const
+{
+  if (getType() != TYPE_LIST && getType() != TYPE_DICTIONARY)
+    throw Error("Unexpected type of value");
+
+  return getToken().size;
+}
+
+Value
+Value::getFirst() const
+{
+  if (getType() != TYPE_LIST && getType() != TYPE_DICTIONARY)
+    throw Error("Unexpected type of value");
+
+  return Value(m_tape, m_index + 1, getToken().next);
+}
+
+Value
+Value::getNext() const
+{
+  return Value(m_tape, getToken().next, m_limit);
+}
+
+Value
+Value::get(const std::string& key) const
+{
+  checkType(TYPE_DICTIONARY);
+
+  for (Value k = getFirst(); k; k = k.getNext().getNext()) {
+    if (k.getStringSize() == key.size() &&
+        memcmp(k.getStringData(), key.data(), key.size()) == 0)
+      return k.getNext();
+  }
+
+  return Value();
+}
+
+std::shared_ptr<Base>
+Value::materialize() const
+{
+  std::shared_ptr<Base> base;
+  switch (getType()) {
+  case TYPE_STRING:
+    base = std::make_shared<String>();
+    break;
+  case TYPE_INTEGER:
+    base = std::make_shared<Integer>();
+    break;
+  case TYPE_LIST:
+    base = std::make_shared<List>();
+    break;
+  case TYPE_DICTIONARY:
+    base = std::make_shared<Dictionary>();
+    break;
+  }
+
+  base->decode(*this);
+  return base;
+}
+
+} // namespace bencoding
+} // namespace sbt
@@ -0,0 +1,239 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_BENCODING_TAPE_HPP
+#define SBT_BENCODING_TAPE_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <stdexcept>
+
+#include "buffer.hpp"
+
+namespace sbt {
+namespace bencoding {
+
+class Error : public std::runtime_error
+{
+public:
+  explicit
+  Error(const std::string& what)
+    : std::runtime_error(what)
+  {
+  }
+};
+
+enum Type {
+  TYPE_STRING = 1,
+  TYPE_INTEGER = 2,
+  TYPE_LIST = 3,
+  TYPE_DICTIONARY = 4
+};
+
+class Base;
+class Value;
+
+/**
+ * @brief One decoded value on a Tape, in the order of the encoding
+ *
+ * A list or dictionary is followed by its items (keys and values
+ * alternating for a dictionary), @p next skips over all of them.
+ */
+struct Token
+{
+  Type type;
+  size_t begin;     // offset of the encoded value
+  size_t end;       // offset right after the encoded value
+  size_t next;      // index of the token after the value and its items
+  size_t size;      // length of a string, number of items of a container
+  int64_t integer;  // value of an integer
+};
+
+/**
+ * @brief Flat index of a bencoded value, parsed in one pass
+ *
+ * The buffer is scanned once and every value becomes a Token with the
+ * offsets of its bytes, strings are not copied and containers are not
+ * built.  The tape refers to the parsed buffer, which has to outlive
+ * it.  Values are then read through Value, or materialized into the
+ * Dictionary/List/String/Integer classes where they are kept around.
+ */
+class Tape
+{
+public:
+  Tape();
+
+  /** @brief Parse the value at the start of @p data
+   *  @return the length of the value, @p data may go on after it
+   *  @throws Error if the value is not well formed
+   */
+  size_t
+  parse(const uint8_t* data, size_t size);
+
+  const uint8_t*
+  getData() const
+  {
+    return m_data;
+  }
+
+  size_t
+  size() const
+  {
+    return m_tokens.size();
+  }
+
+  const Token&
+  operator[](size_t index) const
+  {
+    return m_tokens[index];
+  }
+
+  /** @brief The parsed value, invalid if nothing is parsed
+   */
+  Value
+  getRoot() const;
+
+private:
+  void
+  parseInteger(size_t& pos);
+
+  void
+  parseString(size_t& pos);
+
+  void
+  addItem();
+
+private:
+  const uint8_t* m_data;
+  size_t m_size;
+  std::vector<Token> m_tokens;
+
+  // the containers being parsed, innermost last
+  std::vector<size_t> m_open;
+};
+
+/**
+ * @brief Lazy accessor to a value on a Tape
+ *
+ * Cheap to copy, it is only a position on the tape.  A default
+ * constructed value, or one that is looked up but missing, is invalid.
+ */
+class Value
+{
+public:
+  Value();
+
+  Value(const Tape* tape, size_t index, size_t limit);
+
+  explicit
+  operator bool() const
+  {
+    return m_tape != nullptr && m_index < m_limit;
+  }
+
+  Type
+  getType() const
+  {
+    return getToken().type;
+  }
+
+  /** @throws Error if this is not a string
+   */
+  const uint8_t*
+  getStringData() const;
+
+  /** @throws Error if this is not a string
+   */
+  size_t
+  getStringSize() const;
+
+  /** @throws Error if this is not a string
+   */
+  std::string
+  toString() const;
+
+  /** @throws Error if this is not an integer
+   */
+  int64_t
+  getInteger() const;
+
+  /** @return the number of elements of a list or entries of a dictionary
+   */
+  size_t
+  getNumItems() const;
+
+  /** @return the first element of a list or key of a dictionary, the
+   *          items are walked with getNext()
+   */
+  Value
+  getFirst() const;
+
+  /** @return the value after this one in the same container
+   */
+  Value
+  getNext() const;
+
+  /** @return the value of @p key in a dictionary, invalid if missing
+   */
+  Value
+  get(const std::string& key) const;
+
+  /** @brief The encoded bytes of the value, e.g., to hash them
+   */
+  const uint8_t*
+  getRawData() const
+  {
+    return m_tape->getData() + getToken().begin;
+  }
+
+  size_t
+  getRawSize() const
+  {
+    return getToken().end - getToken().begin;
+  }
+
+  /** @brief Copy the value into a tree of Base objects
+   */
+  std::shared_ptr<Base>
+  materialize() const;
+
+private:
+  const Token&
+  getToken() const
+  {
+    if (!*this)
+      throw Error("Missing value");
+
+    return (*m_tape)[m_index];
+  }
+
+  void
+  checkType(Type type) const;
+
+private:
+  const Tape* m_tape;
+  size_t m_index;
+  size_t m_limit;
+};
+
+} // namespace bencoding
+} // namespace sbt
+
+#endif // SBT_BENCODING_TAPE_HPP
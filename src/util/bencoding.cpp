@@ -21,7 +21,7 @@
 
 #include "bencoding.hpp"
 
-#include <boost/lexical_cast.hpp>
+#include <iterator>
 
 using std::string;
 using std::vector;
@@ -42,6 +42,32 @@ Base::~Base()
 {
 }
 
+void
+Base::wireDecode(std::istream& is)
+{
+  // the value is parsed out of the rest of the stream, which
+  // is then rewound to right after the value
+  std::streampos start = is.tellg();
+  std::string rest((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+
+  size_t length = wireDecode(reinterpret_cast<const uint8_t*>(rest.data()), rest.size());
+
+  if (start != std::streampos(-1)) {
+    is.clear();
+    is.seekg(start + std::streamoff(length));
+  }
+}
+
+size_t
+Base::wireDecode(const uint8_t* data, size_t size)
+{
+  Tape tape;
+  size_t length = tape.parse(data, size);
+  decode(tape.getRoot());
+
+  return length;
+}
+
 String::String()
   : Base(TYPE_STRING)
 {
@@ -72,44 +98,10 @@ String::wireEncode(ostream& os) const
 }
 
 void
-String::wireDecode(istream& is)
-{
-  char c;
-  string size;
-  bool hasColon = false;
-  while (is.get(c)) {
-    if (c == ':') {
-      hasColon = true;
-      break;
-    }
-    size += c;
-  }
-
-  if (!hasColon)
-    throw Error("Bad encoding");
-
-  int s = 0;
-  try {
-    s = boost::lexical_cast<int>(size);
-  }
-  catch(const boost::bad_lexical_cast &) {
-    throw Error("Bad size: " + size);
-  }
-
-  if (s > 0 && size[0] == '0')
-    throw Error("Bad size: " + size);
-
-  if (s == 0 && size.size() != 1)
-    throw Error("Bad size: " + size);
-
-  if (s < 0)
-    throw Error("Bad size: " + size);
-
-  m_value = vector<uint8_t>(s, 0);
-  int readSize = is.readsome(reinterpret_cast<char*>(&m_value.front()), s);
-
-  if (readSize != s)
-    throw Error("Bad encoding");
+String::decode(const Value& value)
+{
+  const uint8_t* data = value.getStringData();
+  m_value.assign(data, data + value.getStringSize());
 }
 
 string
@@ -148,47 +140,9 @@ Integer::wireEncode(std::ostream& os) const
 }
 
 void
-Integer::wireDecode(std::istream& is)
+Integer::decode(const Value& value)
 {
-  char c;
-
-  is.get(c);
-  if (c != 'i')
-    throw Error("Bad integer encoding 0");
-
-
-  string size;
-  bool hasEnd = false;
-  while (is.get(c)) {
-    if (c == 'e') {
-      hasEnd = true;
-      break;
-    }
-    size += c;
-  }
-
-  if (!hasEnd)
-    throw Error("Bad integer encoding 1");
-
-  int s = 0;
-  try {
-    s = boost::lexical_cast<int>(size);
-  }
-  catch(const boost::bad_lexical_cast &) {
-    throw Error("Bad integer: " + size);
-  }
-
-  if (s > 0 && size[0] == '0')
-    throw Error("Bad integer: " + size);
-
-  if (s == 0 && size.size() != 1)
-    throw Error("Bad integer: " + size);
-
-  if (s < 0 && size[1] == '0')
-    throw Error("Bad integer: " + size);
-
-
-  m_value = s;
+  m_value = value.getInteger();
 }
 
 void
@@ -219,60 +173,14 @@ List::wireEncode(std::ostream& os) const
 }
 
 void
-List::wireDecode(std::istream& is)
+List::decode(const Value& value)
 {
-  m_list.clear();
-
-  char c;
-
-  is.get(c);
-  if (c != 'l')
+  if (value.getType() != TYPE_LIST)
     throw Error("Bad list encoding");
 
-  bool hasEnd = false;
-  c = is.peek();
-  while (c != EOF) {
-    if (c == 'e') {
-      is.get(c);
-      hasEnd = true;
-      break;
-    }
-
-    switch (c) {
-    case 'i':
-      {
-        auto i = make_shared<Integer>();
-        i->wireDecode(is);
-        m_list.push_back(i);
-        break;
-      }
-    case 'l':
-      {
-        auto l = make_shared<List>();
-        l->wireDecode(is);
-        m_list.push_back(l);
-        break;
-      }
-    case 'd':
-      {
-        auto d = make_shared<Dictionary>();
-        d->wireDecode(is);
-        m_list.push_back(d);
-        break;
-      }
-    default:
-      {
-        auto s = make_shared<String>();
-        s->wireDecode(is);
-        m_list.push_back(s);
-        break;
-      }
-    }
-    c = is.peek();
-  }
-
-  if (!hasEnd)
-    throw Error("Bad list encoding");
+  m_list.clear();
+  for (Value item = value.getFirst(); item; item = item.getNext())
+    m_list.push_back(item.materialize());
 }
 
 void
@@ -340,64 +248,14 @@ Dictionary::wireEncode(std::ostream& os) const
 }
 
 void
-Dictionary::wireDecode(std::istream& is)
+Dictionary::decode(const Value& value)
 {
-  m_map.clear();
-
-  char c;
-
-  is.get(c);
-  if (c != 'd')
-    throw Error("Bad dictionary encoding");
-
-  bool hasEnd = false;
-  c = is.peek();
-  while (c != EOF) {
-    if (c == 'e') {
-      is.get(c);
-      hasEnd = true;
-      break;
-    }
-
-    String key;
-    key.wireDecode(is);
-
-    c = is.peek();
-    switch (c) {
-    case 'i':
-      {
-        auto i = make_shared<Integer>();
-        i->wireDecode(is);
-        m_map[key.toString()] = i;
-        break;
-      }
-    case 'l':
-      {
-        auto l = make_shared<List>();
-        l->wireDecode(is);
-        m_map[key.toString()] = l;
-        break;
-      }
-    case 'd':
-      {
-        auto d = make_shared<Dictionary>();
-        d->wireDecode(is);
-        m_map[key.toString()] = d;
-        break;
-      }
-    default:
-      {
-        auto s = make_shared<String>();
-        s->wireDecode(is);
-        m_map[key.toString()] = s;
-        break;
-      }
-    }
-    c = is.peek();
-  }
-
-  if (!hasEnd)
+  if (value.getType() != TYPE_DICTIONARY)
     throw Error("Bad map encoding");
+
+  m_map.clear();
+  for (Value key = value.getFirst(); key; key = key.getNext().getNext())
+    m_map[key.toString()] = key.getNext().materialize();
 }
 
 void
@@ -29,27 +29,11 @@
 #include <map>
 
 #include "buffer.hpp"
+#include "bencoding-tape.hpp"
 
 namespace sbt {
 namespace bencoding {
 
-class Error : public std::runtime_error
-{
-public:
-  explicit
-  Error(const std::string& what)
-    : std::runtime_error(what)
-  {
-  }
-};
-
-enum Type {
-  TYPE_STRING = 1,
-  TYPE_INTEGER = 2,
-  TYPE_LIST = 3,
-  TYPE_DICTIONARY = 4
-};
-
 class Base
 {
 public:
@@ -61,8 +45,23 @@ public:
   virtual void
   wireEncode(std::ostream& os) const = 0;
 
+  /** @brief Decode the value at the position of @p is, which is left
+   *         right after it
+   */
+  void
+  wireDecode(std::istream& is);
+
+  /** @brief Decode the value at the start of @p data
+   *  @return the length of the value
+   */
+  size_t
+  wireDecode(const uint8_t* data, size_t size);
+
+  /** @brief Take the value from a parsed Tape
+   *  @throws Error if @p value is of another type
+   */
   virtual void
-  wireDecode(std::istream& is) = 0;
+  decode(const Value& value) = 0;
 
   Type
   getType()
@@ -94,7 +93,7 @@ public:
   wireEncode(std::ostream& os) const;
 
   virtual void
-  wireDecode(std::istream& is);
+  decode(const Value& value);
 
   const std::vector<uint8_t>&
   getValue()
@@ -142,7 +141,7 @@ public:
   wireEncode(std::ostream& os) const;
 
   virtual void
-  wireDecode(std::istream& is);
+  decode(const Value& value);
 
   int64_t
   getValue()
@@ -173,7 +172,7 @@ public:
   wireEncode(std::ostream& os) const;
 
   virtual void
-  wireDecode(std::istream& is);
+  decode(const Value& value);
 
   void
   append(std::shared_ptr<Base> item);
@@ -219,7 +218,7 @@ public:
   wireEncode(std::ostream& os) const;
 
   virtual void
-  wireDecode(std::istream& is);
+  decode(const Value& value);
 
   void
   insert(const std::string& key, std::shared_ptr<Base> value);
@@ -0,0 +1,155 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_UTIL_BUFFER_VIEW_HPP
+#define SBT_UTIL_BUFFER_VIEW_HPP
+
+#include "buffer.hpp"
+
+#include <algorithm>
+
+namespace sbt {
+
+/**
+ * @brief Slice of a Buffer that shares ownership of it instead of copying
+ *
+ * Used to refer to a part of a received message (e.g., the block of a
+ * piece message) all the way to where it is consumed.  The viewed bytes
+ * must not be modified while a view of them exists.
+ */
+class BufferView
+{
+public:
+  /** @brief Creates an empty view
+   */
+  BufferView()
+    : m_data(nullptr)
+    , m_size(0)
+  {
+  }
+
+  /** @brief Creates a view of the whole @p buffer
+   */
+  explicit
+  BufferView(ConstBufferPtr buffer)
+    : m_buffer(buffer)
+    , m_data(buffer->empty() ? nullptr : buffer->buf())
+    , m_size(buffer->size())
+  {
+  }
+
+  /** @brief Creates a view of @p size bytes of @p buffer at @p offset
+   *  @throws std::out_of_range if the range is not inside @p buffer
+   */
+  BufferView(ConstBufferPtr buffer, size_t offset, size_t size)
+    : m_buffer(buffer)
+    , m_data(nullptr)
+    , m_size(size)
+  {
+    if (offset > buffer->size() || size > buffer->size() - offset)
+      throw std::out_of_range("BufferView is out of the buffer");
+
+    if (size > 0)
+      m_data = buffer->buf() + offset;
+  }
+
+  /** @brief Creates a view of @p size bytes of this view at @p offset
+   *  @throws std::out_of_range if the range is not inside this view
+   */
+  BufferView
+  slice(size_t offset, size_t size) const
+  {
+    if (offset > m_size || size > m_size - offset)
+      throw std::out_of_range("BufferView slice is out of the view");
+
+    BufferView view(*this);
+    view.m_data = size > 0 ? m_data + offset : nullptr;
+    view.m_size = size;
+    return view;
+  }
+
+  /** @brief Copies the viewed bytes into a buffer of their own
+   */
+  ConstBufferPtr
+  copy() const
+  {
+    return make_shared<Buffer>(begin(), end());
+  }
+
+  /** @return false if this view does not refer to any buffer
+   */
+  explicit
+  operator bool() const
+  {
+    return static_cast<bool>(m_buffer);
+  }
+
+  const uint8_t*
+  data() const
+  {
+    return m_data;
+  }
+
+  size_t
+  size() const
+  {
+    return m_size;
+  }
+
+  bool
+  empty() const
+  {
+    return m_size == 0;
+  }
+
+  const uint8_t*
+  begin() const
+  {
+    return m_data;
+  }
+
+  const uint8_t*
+  end() const
+  {
+    return m_data + m_size;
+  }
+
+  uint8_t
+  operator[](size_t i) const
+  {
+    return m_data[i];
+  }
+
+private:
+  ConstBufferPtr m_buffer;
+  const uint8_t* m_data;
+  size_t m_size;
+};
+
+/** @brief Compare the bytes of a buffer with the bytes of a view
+ */
+inline bool
+equal(ConstBufferPtr a, const BufferView& b)
+{
+  return a->size() == b.size() && std::equal(b.begin(), b.end(), a->begin());
+}
+
+} // namespace sbt
+
+#endif // SBT_UTIL_BUFFER_VIEW_HPP
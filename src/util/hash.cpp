@@ -68,5 +68,20 @@ sha1(ConstBufferPtr input)
   return result;
 }
 
+void
+Sha1::update(const uint8_t* data, size_t size)
+{
+  m_hash.Update(data, size);
+}
+
+ConstBufferPtr
+Sha1::finalize()
+{
+  auto result = make_shared<Buffer>(20, 0);
+  m_hash.Final(result->buf());
+
+  return result;
+}
+
 } // namespace util
 } // namespace sbt
@@ -37,6 +37,28 @@ sha1(const std::vector<uint8_t>& input);
 ConstBufferPtr
 sha1(ConstBufferPtr input);
 
+/**
+ * @brief Incremental SHA-1, for data that arrives in pieces
+ *
+ * Feeding the data through update() in order and calling finalize()
+ * gives the same digest as sha1() over all of it.
+ */
+class Sha1
+{
+public:
+  void
+  update(const uint8_t* data, size_t size);
+
+  /** @brief Get the digest of the data since the last finalize(),
+   *         and start over
+   */
+  ConstBufferPtr
+  finalize();
+
+private:
+  CryptoPP::SHA1 m_hash;
+};
+
 } // namespace util
 } // namespace sbt
 
@@ -0,0 +1,158 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "worker-pool.hpp"
+
+#include <unistd.h>
+
+namespace sbt {
+
+// a few pieces worth of blocks in flight
+const size_t WorkerPool::MAX_TASKS = 1024;
+
+WorkerPool::WorkerPool(size_t numThreads, size_t maxTasks)
+  : m_maxTasks(maxTasks > 0 ? maxTasks : 1)
+  , m_isStopping(false)
+  , m_isReadyWanted(false)
+{
+  if (numThreads == 0) {
+    long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    numThreads = numCpus > 0 ? numCpus : 1;
+  }
+
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_cond, NULL);
+  pthread_cond_init(&m_notFull, NULL);
+
+  for (size_t i = 0; i < numThreads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &WorkerPool::threadMain, this) != 0)
+      break;
+    m_threads.push_back(thread);
+  }
+
+  if (m_threads.empty())
+    throw Error("Cannot start worker threads");
+}
+
+WorkerPool::~WorkerPool()
+{
+  pthread_mutex_lock(&m_lock);
+  m_isStopping = true;
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_lock);
+
+  for (pthread_t thread : m_threads)
+    pthread_join(thread, NULL);
+
+  pthread_cond_destroy(&m_notFull);
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_lock);
+}
+
+void
+WorkerPool::post(const Task& task)
+{
+  pthread_mutex_lock(&m_lock);
+  while (m_tasks.size() >= m_maxTasks)
+    pthread_cond_wait(&m_notFull, &m_lock);
+
+  m_tasks.push_back(task);
+  pthread_cond_signal(&m_cond);
+  pthread_mutex_unlock(&m_lock);
+}
+
+bool
+WorkerPool::tryPost(const Task& task)
+{
+  pthread_mutex_lock(&m_lock);
+  if (m_tasks.size() >= m_maxTasks) {
+    m_isReadyWanted = true;
+    pthread_mutex_unlock(&m_lock);
+    return false;
+  }
+
+  m_tasks.push_back(task);
+  pthread_cond_signal(&m_cond);
+  pthread_mutex_unlock(&m_lock);
+  return true;
+}
+
+bool
+WorkerPool::isFull()
+{
+  pthread_mutex_lock(&m_lock);
+  bool isFull = m_tasks.size() >= m_maxTasks;
+  if (isFull)
+    m_isReadyWanted = true;
+  pthread_mutex_unlock(&m_lock);
+
+  return isFull;
+}
+
+void
+WorkerPool::setReadyCallback(const Task& callback)
+{
+  pthread_mutex_lock(&m_lock);
+  m_onReady = callback;
+  pthread_mutex_unlock(&m_lock);
+}
+
+void*
+WorkerPool::threadMain(void* pool)
+{
+  static_cast<WorkerPool*>(pool)->work();
+  return NULL;
+}
+
+void
+WorkerPool::work()
+{
+  while (true) {
+    pthread_mutex_lock(&m_lock);
+    while (m_tasks.empty() && !m_isStopping)
+      pthread_cond_wait(&m_cond, &m_lock);
+
+    if (m_tasks.empty()) {
+      // stopping and nothing left to do
+      pthread_mutex_unlock(&m_lock);
+      return;
+    }
+
+    Task task = m_tasks.front();
+    m_tasks.pop_front();
+    pthread_cond_signal(&m_notFull);
+
+    // wait for some room, so that the producers are not woken
+    // up for every single task
+    Task onReady;
+    if (m_isReadyWanted && m_tasks.size() <= m_maxTasks / 2) {
+      m_isReadyWanted = false;
+      onReady = m_onReady;
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    if (onReady)
+      onReady();
+
+    task();
+  }
+}
+
+} // namespace sbt
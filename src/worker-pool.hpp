@@ -0,0 +1,136 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SBT_WORKER_POOL_HPP
+#define SBT_WORKER_POOL_HPP
+
+#include "common.hpp"
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+namespace sbt {
+
+/**
+ * @brief Fixed set of threads running tasks off a shared queue
+ *
+ * Used for blocking or CPU heavy work (disk reads and writes, hashing)
+ * that must not stall the event loop.  Tasks hand their results back
+ * to the loop thread with EventLoop::post().
+ *
+ * The queue is bounded, so a disk that cannot keep up slows down the
+ * producers instead of piling up their data in memory.  post() waits
+ * for room once maxTasks tasks are queued.  The loop thread must not
+ * wait, it uses tryPost() instead and holds back its producers until
+ * the ready callback tells it there is room again.  Any thread may
+ * post.
+ */
+class WorkerPool
+{
+public:
+  class Error : public std::runtime_error
+  {
+  public:
+    explicit
+    Error(const std::string& what)
+      : std::runtime_error(what)
+    {
+    }
+  };
+
+  typedef function<void()> Task;
+
+  static const size_t MAX_TASKS;
+
+public:
+  /** @brief Start @p numThreads threads, or one per CPU if 0, with
+   *         room for @p maxTasks queued tasks
+   */
+  explicit
+  WorkerPool(size_t numThreads = 0, size_t maxTasks = MAX_TASKS);
+
+  /** @brief Run the queued tasks to completion and join the threads
+   */
+  ~WorkerPool();
+
+  /** @brief Queue @p task to run on one of the threads, waiting
+   *         while the queue is full
+   */
+  void
+  post(const Task& task);
+
+  /** @brief Queue @p task to run on one of the threads, unless the
+   *         queue is full
+   *  @return false if the queue is full, the ready callback is then
+   *          called once the queue has drained to half
+   */
+  bool
+  tryPost(const Task& task);
+
+  /** @brief Check whether tryPost() would fail, if so the ready
+   *         callback is called once the queue has drained to half
+   */
+  bool
+  isFull();
+
+  /** @brief Set the callback for tryPost() and isFull(), it is called
+   *         on a worker thread
+   */
+  void
+  setReadyCallback(const Task& callback);
+
+  size_t
+  getNumThreads() const
+  {
+    return m_threads.size();
+  }
+
+  size_t
+  getMaxTasks() const
+  {
+    return m_maxTasks;
+  }
+
+private:
+  static void*
+  threadMain(void* pool);
+
+  void
+  work();
+
+private:
+  std::vector<pthread_t> m_threads;
+  std::deque<Task> m_tasks;
+  size_t m_maxTasks;
+  bool m_isStopping;
+
+  // a producer found the queue full and waits on m_onReady
+  bool m_isReadyWanted;
+  Task m_onReady;
+
+  // m_cond wakes the workers, m_notFull the waiting producers
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_cond;
+  pthread_cond_t m_notFull;
+};
+
+} // namespace sbt
+
+#endif // SBT_WORKER_POOL_HPP
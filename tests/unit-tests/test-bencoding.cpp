@@ -21,6 +21,7 @@
 
 #include "util/bencoding.hpp"
 #include <sstream>
+#include <limits>
 
 #include "boost-test.hpp"
 
@@ -289,6 +290,72 @@ BOOST_AUTO_TEST_CASE(TestDictionary)
   BOOST_CHECK_THROW(Dictionary().wireDecode(ss), bencoding::Error);
 }
 
+BOOST_AUTO_TEST_CASE(TestTape)
+{
+  std::string encoded("d4:key0i-12e4:key1li0e3:abce4:key2d1:xi1eeetrailing");
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(encoded.data());
+
+  Tape tape;
+  BOOST_CHECK_EQUAL(tape.parse(data, encoded.size()), encoded.size() - 8);
+  BOOST_CHECK_EQUAL(tape.size(), 11);
+
+  Value root = tape.getRoot();
+  BOOST_CHECK_EQUAL(root.getType(), TYPE_DICTIONARY);
+  BOOST_CHECK_EQUAL(root.getNumItems(), 3);
+  BOOST_CHECK_EQUAL(root.get("key0").getInteger(), -12);
+  BOOST_CHECK(!root.get("key3"));
+  BOOST_CHECK_THROW(root.get("key0").toString(), bencoding::Error);
+
+  // strings point into the parsed buffer
+  Value list = root.get("key1");
+  BOOST_CHECK_EQUAL(list.getNumItems(), 2);
+  Value item = list.getFirst();
+  BOOST_CHECK_EQUAL(item.getInteger(), 0);
+  item = item.getNext();
+  BOOST_CHECK_EQUAL(item.toString(), "abc");
+  BOOST_CHECK(item.getStringData() >= data && item.getStringData() < data + encoded.size());
+  BOOST_CHECK(!item.getNext());
+
+  // the raw bytes of a value
+  Value inner = root.get("key2");
+  BOOST_CHECK_EQUAL(std::string(inner.getRawData(), inner.getRawData() + inner.getRawSize()),
+                    "d1:xi1ee");
+  BOOST_CHECK_EQUAL(inner.get("x").getInteger(), 1);
+
+  auto dict = std::dynamic_pointer_cast<Dictionary>(root.materialize());
+  BOOST_REQUIRE(static_cast<bool>(dict));
+  BOOST_CHECK_EQUAL(std::dynamic_pointer_cast<Integer>(dict->get("key0"))->getValue(), -12);
+
+  std::string bad[] = {"", "e", "i1", "l", "d1:ae", "di1ei2ee", "5:abc", "x",
+                       "i9223372036854775808e", "99999999999999999999999:a"};
+  for (const auto& b : bad) {
+    BOOST_CHECK_THROW(tape.parse(reinterpret_cast<const uint8_t*>(b.data()), b.size()),
+                      bencoding::Error);
+  }
+  BOOST_CHECK(!tape.getRoot());
+
+  std::string min("i-9223372036854775808e");
+  tape.parse(reinterpret_cast<const uint8_t*>(min.data()), min.size());
+  BOOST_CHECK_EQUAL(tape.getRoot().getInteger(), std::numeric_limits<int64_t>::min());
+}
+
+BOOST_AUTO_TEST_CASE(TestStreamPosition)
+{
+  // values decoded from a stream one after the other
+  std::stringstream ss("i1e3:abcle");
+
+  Integer i;
+  i.wireDecode(ss);
+  BOOST_CHECK_EQUAL(i.getValue(), 1);
+
+  String s;
+  s.wireDecode(ss);
+  BOOST_CHECK_EQUAL(s.toString(), "abc");
+
+  List l;
+  l.wireDecode(ss);
+  BOOST_CHECK(l.getList().empty());
+}
 
 BOOST_AUTO_TEST_SUITE_END()
 
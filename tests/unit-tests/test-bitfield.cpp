@@ -0,0 +1,121 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bitfield.hpp"
+
+#include "boost-test.hpp"
+
+namespace sbt {
+namespace test {
+
+BOOST_AUTO_TEST_SUITE(TestBitfield)
+
+BOOST_AUTO_TEST_CASE(Wire)
+{
+  // pieces 0, 9 and 10, the spare bits of the last byte are dropped
+  uint8_t bytes[] = {0x80, 0x60 | 0x1f};
+  Bitfield bitfield(bytes, 11);
+
+  BOOST_CHECK_EQUAL(bitfield.size(), 11);
+  BOOST_CHECK(bitfield.test(0));
+  BOOST_CHECK(!bitfield.test(1));
+  BOOST_CHECK(bitfield.test(9));
+  BOOST_CHECK(bitfield.test(10));
+  BOOST_CHECK(!bitfield.test(11));
+  BOOST_CHECK_EQUAL(bitfield.count(), 3);
+
+  uint8_t expected[] = {0x80, 0x60};
+  ConstBufferPtr encoded = bitfield.getBytes();
+  BOOST_CHECK_EQUAL_COLLECTIONS(encoded->begin(), encoded->end(),
+                                expected, expected + sizeof(expected));
+
+  BOOST_CHECK_THROW(bitfield.set(11), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(Find)
+{
+  // spans several words
+  Bitfield bitfield(200);
+  BOOST_CHECK(bitfield.none());
+  BOOST_CHECK_EQUAL(bitfield.findFirst(), Bitfield::npos);
+
+  bitfield.set(3);
+  bitfield.set(64);
+  bitfield.set(199);
+
+  BOOST_CHECK_EQUAL(bitfield.findFirst(), 3);
+  BOOST_CHECK_EQUAL(bitfield.findNext(4), 64);
+  BOOST_CHECK_EQUAL(bitfield.findNext(64), 64);
+  BOOST_CHECK_EQUAL(bitfield.findNext(65), 199);
+  BOOST_CHECK_EQUAL(bitfield.findNext(200), Bitfield::npos);
+
+  bitfield.reset(199);
+  BOOST_CHECK_EQUAL(bitfield.findNext(65), Bitfield::npos);
+  BOOST_CHECK_EQUAL(bitfield.count(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(SetOperations)
+{
+  Bitfield peer(100);
+  Bitfield ours(100);
+  for (size_t i = 0; i < 100; i += 2)
+    peer.set(i);
+  for (size_t i = 0; i < 100; i += 3)
+    ours.set(i);
+
+  BOOST_CHECK(peer.intersects(ours));
+
+  // what the peer has and we lack
+  Bitfield wanted(peer);
+  wanted.andNot(ours);
+  BOOST_CHECK_EQUAL(wanted.findFirst(), 2);
+  BOOST_CHECK_EQUAL(wanted.count(), 50 - 17);
+  BOOST_CHECK(!wanted.intersects(ours));
+
+  // the copy did not change the original
+  BOOST_CHECK_EQUAL(peer.count(), 50);
+
+  Bitfield both(peer);
+  both &= ours;
+  BOOST_CHECK_EQUAL(both.count(), 17);
+  BOOST_CHECK_EQUAL(both.findNext(1), 6);
+
+  Bitfield all(100);
+  for (size_t i = 0; i < 100; i++)
+    all.set(i);
+  BOOST_CHECK(all.all());
+  BOOST_CHECK(!peer.all());
+}
+
+BOOST_AUTO_TEST_CASE(SharedBytes)
+{
+  Bitfield bitfield(16);
+  bitfield.set(1);
+
+  // bytes handed out are not changed afterwards
+  ConstBufferPtr bytes = bitfield.getBytes();
+  bitfield.set(2);
+  BOOST_CHECK_EQUAL((*bytes)[0], 0x40);
+  BOOST_CHECK_EQUAL((*bitfield.getBytes())[0], 0x60);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
@@ -0,0 +1,70 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/buffer-view.hpp"
+
+#include "boost-test.hpp"
+
+namespace sbt {
+namespace test {
+
+BOOST_AUTO_TEST_SUITE(TestBufferView)
+
+BOOST_AUTO_TEST_CASE(Slice)
+{
+  std::string digits("0123456789");
+  ConstBufferPtr buffer = make_shared<Buffer>(digits.begin(), digits.end());
+
+  BufferView view(buffer, 2, 6);
+  BOOST_CHECK_EQUAL(view.size(), 6);
+  BOOST_CHECK_EQUAL(view[0], '2');
+  BOOST_CHECK(view.data() == buffer->buf() + 2);
+
+  // a slice still points into the original buffer
+  BufferView slice = view.slice(4, 2);
+  BOOST_CHECK_EQUAL(slice.size(), 2);
+  BOOST_CHECK(slice.data() == buffer->buf() + 6);
+
+  BOOST_CHECK(view.slice(6, 0).empty());
+  BOOST_CHECK_THROW(view.slice(5, 2), std::out_of_range);
+  BOOST_CHECK_THROW(BufferView(buffer, 8, 3), std::out_of_range);
+
+  BOOST_CHECK_EQUAL(BufferView().size(), 0);
+  BOOST_CHECK_EQUAL(static_cast<bool>(BufferView()), false);
+}
+
+BOOST_AUTO_TEST_CASE(Ownership)
+{
+  std::string letters("abcdef");
+  BufferPtr buffer = make_shared<Buffer>(letters.begin(), letters.end());
+  BufferView view(buffer, 1, 3);
+
+  // the view keeps the buffer alive
+  buffer.reset();
+  BOOST_CHECK_EQUAL(view[0], 'b');
+
+  ConstBufferPtr copy = view.copy();
+  BOOST_CHECK_EQUAL(std::string(copy->begin(), copy->end()), "bcd");
+  BOOST_CHECK(copy->buf() != view.data());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
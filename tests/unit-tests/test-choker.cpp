@@ -0,0 +1,131 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "choker.hpp"
+
+#include "boost-test.hpp"
+
+#include <algorithm>
+
+namespace sbt {
+namespace test {
+
+static std::vector<Choker::Candidate>
+makeCandidates(std::initializer_list<double> rates)
+{
+  std::vector<Choker::Candidate> candidates;
+
+  int id = 0;
+  for (double rate : rates) {
+    Choker::Candidate candidate;
+    candidate.id = id++;
+    candidate.rate = rate;
+    candidates.push_back(candidate);
+  }
+
+  return candidates;
+}
+
+static bool
+contains(const std::vector<int>& ids, int id)
+{
+  return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+
+BOOST_AUTO_TEST_SUITE(TestChoker)
+
+BOOST_AUTO_TEST_CASE(RegularSlots)
+{
+  Choker choker;
+  choker.setNumSlots(2);
+
+  // peers 1 and 3 upload the fastest
+  std::vector<Choker::Candidate> candidates = makeCandidates({10, 50, 20, 40, 0});
+  std::vector<int> unchoked = choker.rechoke(candidates, true);
+
+  BOOST_REQUIRE_EQUAL(unchoked.size(), 3);
+  BOOST_CHECK_EQUAL(unchoked[0], 1);
+  BOOST_CHECK_EQUAL(unchoked[1], 3);
+
+  // plus one of the others
+  int optimistic = choker.getOptimistic();
+  BOOST_CHECK_EQUAL(unchoked[2], optimistic);
+  BOOST_CHECK(optimistic == 0 || optimistic == 2 || optimistic == 4);
+
+  // room for everybody
+  choker.setNumSlots(Choker::NUM_SLOTS);
+  unchoked = choker.rechoke(makeCandidates({1, 2}), true);
+  BOOST_CHECK_EQUAL(unchoked.size(), 2);
+  BOOST_CHECK_EQUAL(choker.getOptimistic(), -1);
+
+  BOOST_CHECK(choker.rechoke(std::vector<Choker::Candidate>(), true).empty());
+}
+
+BOOST_AUTO_TEST_CASE(OptimisticRotation)
+{
+  Choker choker;
+  choker.setNumSlots(1);
+
+  std::vector<Choker::Candidate> candidates = makeCandidates({100, 0, 0, 0, 0, 0, 0, 0});
+  std::vector<int> unchoked = choker.rechoke(candidates, false);
+  int optimistic = choker.getOptimistic();
+  BOOST_REQUIRE(optimistic > 0);
+  BOOST_CHECK(contains(unchoked, optimistic));
+
+  // kept while the interested peers change and for the next rounds
+  for (int round = 0; round < Choker::OPTIMISTIC_ROUNDS - 1; round++) {
+    choker.rechoke(candidates, false);
+    choker.rechoke(candidates, true);
+    BOOST_CHECK_EQUAL(choker.getOptimistic(), optimistic);
+  }
+
+  // moves on if it is no longer interested
+  std::vector<Choker::Candidate> others;
+  for (const auto& candidate : candidates) {
+    if (candidate.id != optimistic)
+      others.push_back(candidate);
+  }
+  unchoked = choker.rechoke(others, false);
+  BOOST_CHECK(choker.getOptimistic() != optimistic);
+  BOOST_CHECK(choker.getOptimistic() > 0);
+  BOOST_CHECK(!contains(unchoked, optimistic));
+
+  // or once it earned a regular slot
+  candidates[choker.getOptimistic()].rate = 1000;
+  unchoked = choker.rechoke(candidates, false);
+  BOOST_CHECK_EQUAL(unchoked.size(), 2);
+  BOOST_CHECK(choker.getOptimistic() != unchoked[0]);
+}
+
+BOOST_AUTO_TEST_CASE(RechokeNeeded)
+{
+  Choker choker;
+  BOOST_CHECK_EQUAL(choker.isRechokeNeeded(), false);
+
+  choker.requestRechoke();
+  BOOST_CHECK(choker.isRechokeNeeded());
+
+  choker.rechoke(makeCandidates({1}), false);
+  BOOST_CHECK_EQUAL(choker.isRechokeNeeded(), false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
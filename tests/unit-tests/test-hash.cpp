@@ -52,6 +52,28 @@ BOOST_AUTO_TEST_CASE(Basic)
                                   result3->begin(), result3->end());
 }
 
+BOOST_AUTO_TEST_CASE(Incremental)
+{
+  std::string input("The quick brown fox jumps over the lazy dog");
+  std::vector<uint8_t> expected = sha1(std::vector<uint8_t>(input.begin(), input.end()));
+
+  Sha1 hash;
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(input.data());
+  hash.update(data, 10);
+  hash.update(data + 10, 0);
+  hash.update(data + 10, input.size() - 10);
+
+  ConstBufferPtr result = hash.finalize();
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(expected.begin(), expected.end(),
+                                  result->begin(), result->end());
+
+  // finalize() starts over
+  hash.update(data, input.size());
+  result = hash.finalize();
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(expected.begin(), expected.end(),
+                                  result->begin(), result->end());
+}
+
 BOOST_AUTO_TEST_CASE(Tmp)
 {
   // {
@@ -20,6 +20,7 @@
  */
 
 #include "meta-info.hpp"
+#include "util/hash.hpp"
 #include <sstream>
 #include <fstream>
 #include <boost/filesystem.hpp>
@@ -196,6 +197,71 @@ BOOST_AUTO_TEST_CASE(EncodeDecode)
 
 }
 
+BOOST_AUTO_TEST_CASE(Fields)
+{
+  MetaInfo info;
+  BOOST_CHECK_EQUAL(info.getNumPieces(), 0);
+
+  info.setName("sample");
+  info.setPieceLength(4);
+  info.setLength(7);
+
+  std::vector<uint8_t> pieces(40, 0x41);
+  std::fill(pieces.begin() + 20, pieces.end(), 0x61);
+  info.setPieces(pieces);
+
+  BOOST_CHECK_EQUAL(info.getNumPieces(), 2);
+
+  BufferView hash = info.getPieceHash(1);
+  BOOST_CHECK_EQUAL(hash.size(), 20);
+  BOOST_CHECK_EQUAL(hash[0], 0x61);
+  BOOST_CHECK_THROW(info.getPieceHash(2), std::out_of_range);
+
+  // the fields are taken again from a decoded file
+  std::stringstream ss;
+  info.wireEncode(ss);
+
+  MetaInfo info2;
+  info2.wireDecode(ss);
+  BOOST_CHECK_EQUAL(info2.getName(), "sample");
+  BOOST_CHECK_EQUAL(info2.getLength(), 7);
+  BOOST_CHECK_EQUAL(info2.getPieceLength(), 4);
+  BOOST_CHECK_EQUAL(info2.getNumPieces(), 2);
+  BOOST_CHECK(equal(make_shared<Buffer>(pieces.data() + 20, 20), info2.getPieceHash(1)));
+
+  // not enough hashes for the length
+  info.setLength(9);
+  ss.str("");
+  info.wireEncode(ss);
+  BOOST_CHECK_THROW(info2.wireDecode(ss), bencoding::Error);
+}
+
+BOOST_AUTO_TEST_CASE(InfoHash)
+{
+  // keys out of order, encoding the info dictionary again would sort them
+  std::string info("d4:name1:x6:lengthi7e12:piece lengthi4e6:pieces40:" +
+                   std::string(40, 'a') + "e");
+  std::string torrent("d8:announce3:url4:info" + info + "e");
+
+  MetaInfo meta;
+  meta.wireDecode(reinterpret_cast<const uint8_t*>(torrent.data()), torrent.size());
+
+  ConstBufferPtr expected = util::sha1(make_shared<Buffer>(info.data(), info.size()));
+  BOOST_CHECK(equal(meta.getHash(), expected));
+  BOOST_CHECK_EQUAL(meta.getHash(), meta.getHash());
+
+  // a change to the info dictionary makes it hash the new encoding
+  meta.setName("y");
+  std::stringstream ss;
+  meta.getRoot().get("info")->wireEncode(ss);
+  std::string encoded = ss.str();
+  BOOST_CHECK(equal(meta.getHash(), util::sha1(make_shared<Buffer>(encoded.data(), encoded.size()))));
+
+  std::string noInfo("d8:announce3:urle");
+  BOOST_CHECK_THROW(meta.wireDecode(reinterpret_cast<const uint8_t*>(noInfo.data()), noInfo.size()),
+                    bencoding::Error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace test
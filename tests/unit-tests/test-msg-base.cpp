@@ -73,6 +73,55 @@ BOOST_AUTO_TEST_CASE(Encode)
                                   encoded_raw, encoded_raw + sizeof(encoded_raw));
 }
 
+BOOST_AUTO_TEST_CASE(EncodeTo)
+{
+  // the messages are appended one after the other
+  Buffer buffer;
+  Have have(7);
+  have.encodeTo(buffer);
+  KeepAlive keepAlive;
+  keepAlive.encodeTo(buffer);
+  Interested interested;
+  interested.encodeTo(buffer);
+
+  Buffer expected(*Have(7).encode());
+  ConstBufferPtr keepAliveEncoded = KeepAlive().encode();
+  expected.insert(expected.end(), keepAliveEncoded->begin(), keepAliveEncoded->end());
+  ConstBufferPtr interestedEncoded = Interested().encode();
+  expected.insert(expected.end(), interestedEncoded->begin(), interestedEncoded->end());
+
+  BOOST_CHECK_EQUAL(buffer.size(), 9 + 4 + 5);
+  BOOST_CHECK_EQUAL_COLLECTIONS(buffer.begin(), buffer.end(),
+                                expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(EncodeToFixedFields)
+{
+  // the fields are written straight into the buffer, the same
+  // bytes as encode() without a payload buffer in between
+  Request request(1, 16384, 16384);
+  Cancel cancel(2, 0, 16384);
+  RejectRequest reject(3, 32768, 1024);
+  SuggestPiece suggest(4);
+  AllowedFast allowedFast(5);
+  ConstBufferPtr block = std::make_shared<Buffer>(10, 7);
+  Piece piece(6, 16, block);
+
+  std::vector<MsgBase*> msgs = {&request, &cancel, &reject, &suggest,
+                                &allowedFast, &piece};
+  for (MsgBase* msg : msgs) {
+    Buffer buffer(3);
+    msg->encodeTo(buffer);
+    BOOST_CHECK(!msg->getPayload());
+
+    Buffer expected(3);
+    ConstBufferPtr encoded = msg->encode();
+    expected.insert(expected.end(), encoded->begin(), encoded->end());
+    BOOST_CHECK_EQUAL_COLLECTIONS(buffer.begin(), buffer.end(),
+                                  expected.begin(), expected.end());
+  }
+}
+
 BOOST_AUTO_TEST_CASE(Decode)
 {
   ConstBufferPtr payload = std::make_shared<Buffer>(20, 1);
@@ -338,10 +387,18 @@ BOOST_AUTO_TEST_CASE(TestPiece)
   BOOST_CHECK_EQUAL(static_cast<bool>(piece2.getPayload()), true);
   BOOST_CHECK_EQUAL(piece2.getIndex(), 256);
   BOOST_CHECK_EQUAL(piece2.getBegin(), 257);
-  BOOST_REQUIRE_EQUAL_COLLECTIONS(piece2.getBlock()->begin(),
-                                  piece2.getBlock()->end(),
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(piece2.getBlock().begin(),
+                                  piece2.getBlock().end(),
                                   block_raw,
                                   block_raw + sizeof(block_raw));
+
+  // the header is the encoded piece without the block
+  ConstBufferPtr header = Piece::encodeHeader(256, 257, sizeof(block_raw));
+  BOOST_CHECK_EQUAL(header->size(), Piece::HEADER_LENGTH);
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(header->begin(),
+                                  header->end(),
+                                  encoded_piece,
+                                  encoded_piece + Piece::HEADER_LENGTH);
 }
 
 BOOST_AUTO_TEST_CASE(TestCancel)
@@ -374,6 +431,139 @@ BOOST_AUTO_TEST_CASE(TestCancel)
   BOOST_CHECK_EQUAL(cancel2.getLength(), 258);
 }
 
+BOOST_AUTO_TEST_CASE(TestSuggestPiece)
+{
+  uint8_t encoded_suggest[] = {
+    0x00, 0x00, 0x00, 0x05,
+    0x0d,
+    0x00, 0x00, 0x01, 0x00
+  };
+
+  SuggestPiece suggest(256);
+
+  ConstBufferPtr encoded = suggest.encode();
+
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(encoded->begin(),
+                                  encoded->end(),
+                                  encoded_suggest,
+                                  encoded_suggest + sizeof(encoded_suggest));
+
+
+  SuggestPiece suggest2;
+  BOOST_REQUIRE_NO_THROW(suggest2.decode(encoded));
+
+  BOOST_CHECK_EQUAL(suggest2.getId(), MSG_ID_SUGGEST_PIECE);
+  BOOST_CHECK_EQUAL(suggest2.getIndex(), 256);
+}
+
+BOOST_AUTO_TEST_CASE(TestHaveAllNone)
+{
+  uint8_t encoded_have_all[] = {
+    0x00, 0x00, 0x00, 0x01,
+    0x0e
+  };
+  uint8_t encoded_have_none[] = {
+    0x00, 0x00, 0x00, 0x01,
+    0x0f
+  };
+
+  ConstBufferPtr encoded = HaveAll().encode();
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(encoded->begin(),
+                                  encoded->end(),
+                                  encoded_have_all,
+                                  encoded_have_all + sizeof(encoded_have_all));
+
+  HaveAll haveAll;
+  BOOST_REQUIRE_NO_THROW(haveAll.decode(encoded));
+  BOOST_CHECK_EQUAL(haveAll.getId(), MSG_ID_HAVE_ALL);
+  BOOST_CHECK_EQUAL(static_cast<bool>(haveAll.getPayload()), false);
+
+  encoded = HaveNone().encode();
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(encoded->begin(),
+                                  encoded->end(),
+                                  encoded_have_none,
+                                  encoded_have_none + sizeof(encoded_have_none));
+
+  HaveNone haveNone;
+  BOOST_REQUIRE_NO_THROW(haveNone.decode(encoded));
+  BOOST_CHECK_EQUAL(haveNone.getId(), MSG_ID_HAVE_NONE);
+  BOOST_CHECK_EQUAL(static_cast<bool>(haveNone.getPayload()), false);
+}
+
+BOOST_AUTO_TEST_CASE(TestRejectRequest)
+{
+  uint8_t encoded_reject[] = {
+    0x00, 0x00, 0x00, 0x0d,
+    0x10,
+    0x00, 0x00, 0x01, 0x00,
+    0x00, 0x00, 0x01, 0x01,
+    0x00, 0x00, 0x01, 0x02
+  };
+
+  RejectRequest reject(256, 257, 258);
+
+  ConstBufferPtr encoded = reject.encode();
+
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(encoded->begin(),
+                                  encoded->end(),
+                                  encoded_reject,
+                                  encoded_reject + sizeof(encoded_reject));
+
+
+  RejectRequest reject2;
+  BOOST_REQUIRE_NO_THROW(reject2.decode(encoded));
+
+  BOOST_CHECK_EQUAL(reject2.getId(), MSG_ID_REJECT_REQUEST);
+  BOOST_CHECK_EQUAL(reject2.getIndex(), 256);
+  BOOST_CHECK_EQUAL(reject2.getBegin(), 257);
+  BOOST_CHECK_EQUAL(reject2.getLength(), 258);
+}
+
+BOOST_AUTO_TEST_CASE(TestAllowedFast)
+{
+  uint8_t encoded_allowed_fast[] = {
+    0x00, 0x00, 0x00, 0x05,
+    0x11,
+    0x00, 0x00, 0x01, 0x00
+  };
+
+  AllowedFast allowedFast(256);
+
+  ConstBufferPtr encoded = allowedFast.encode();
+
+  BOOST_REQUIRE_EQUAL_COLLECTIONS(encoded->begin(),
+                                  encoded->end(),
+                                  encoded_allowed_fast,
+                                  encoded_allowed_fast + sizeof(encoded_allowed_fast));
+
+
+  AllowedFast allowedFast2;
+  BOOST_REQUIRE_NO_THROW(allowedFast2.decode(encoded));
+
+  BOOST_CHECK_EQUAL(allowedFast2.getId(), MSG_ID_ALLOWED_FAST);
+  BOOST_CHECK_EQUAL(allowedFast2.getIndex(), 256);
+}
+
+BOOST_AUTO_TEST_CASE(AllowedFastSet)
+{
+  // the example of BEP 6
+  ConstBufferPtr infoHash = std::make_shared<Buffer>(20, 0xaa);
+  uint32_t expected[] = {1059, 431, 808, 1217, 287, 376, 1188};
+
+  std::vector<uint32_t> pieces = AllowedFast::generateSet("80.4.4.200", infoHash, 1313, 7);
+  BOOST_CHECK_EQUAL_COLLECTIONS(pieces.begin(), pieces.end(),
+                                expected, expected + sizeof(expected) / sizeof(uint32_t));
+
+  // the same network gets the same set
+  pieces = AllowedFast::generateSet("80.4.4.1", infoHash, 1313, 7);
+  BOOST_CHECK_EQUAL_COLLECTIONS(pieces.begin(), pieces.end(),
+                                expected, expected + sizeof(expected) / sizeof(uint32_t));
+
+  // never more than the number of pieces
+  BOOST_CHECK_EQUAL(AllowedFast::generateSet("80.4.4.200", infoHash, 3, 10).size(), 3);
+  BOOST_CHECK(AllowedFast::generateSet("::1", infoHash, 1313, 7).empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace test
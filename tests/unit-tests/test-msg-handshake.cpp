@@ -81,6 +81,26 @@ BOOST_AUTO_TEST_CASE(Decode)
   BOOST_CHECK_EQUAL(peerId, msg.getPeerId());
 }
 
+BOOST_AUTO_TEST_CASE(FastExtension)
+{
+  ConstBufferPtr fakeInfoHash = std::make_shared<Buffer>(20, 1);
+  std::string peerId("PEERID12340000000000");
+
+  HandShake msg(fakeInfoHash, peerId);
+  BOOST_CHECK_EQUAL(msg.supportsFastExtension(), false);
+
+  msg.setFastExtension(true);
+  ConstBufferPtr encoded = msg.encode();
+  BOOST_CHECK_EQUAL((*encoded)[27], 0x04);
+
+  HandShake msg2;
+  BOOST_REQUIRE_NO_THROW(msg2.decode(encoded));
+  BOOST_CHECK(msg2.supportsFastExtension());
+
+  msg2.setFastExtension(false);
+  BOOST_CHECK_EQUAL(msg2.supportsFastExtension(), false);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace test
@@ -0,0 +1,192 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "partial-piece.hpp"
+#include "resume-data.hpp"
+#include "worker-pool.hpp"
+
+#include <atomic>
+
+#include "boost-test.hpp"
+
+namespace sbt {
+namespace test {
+
+BOOST_AUTO_TEST_SUITE(TestPartialPiece)
+
+BOOST_AUTO_TEST_CASE(Blocks)
+{
+  // two full blocks and a short one
+  uint32_t length = PartialPiece::BLOCK_SIZE * 2 + 100;
+  PartialPiece piece(3, length);
+
+  BOOST_CHECK_EQUAL(piece.getIndex(), 3);
+  BOOST_CHECK_EQUAL(piece.getNumBlocks(), 3);
+
+  uint32_t begin = 0;
+  uint32_t blockLength = 0;
+
+  BOOST_REQUIRE(piece.nextBlock(begin, blockLength));
+  BOOST_CHECK_EQUAL(begin, 0);
+  BOOST_CHECK_EQUAL(blockLength, PartialPiece::BLOCK_SIZE);
+
+  BOOST_REQUIRE(piece.nextBlock(begin, blockLength));
+  BOOST_CHECK_EQUAL(begin, PartialPiece::BLOCK_SIZE);
+
+  BOOST_REQUIRE(piece.nextBlock(begin, blockLength));
+  BOOST_CHECK_EQUAL(begin, PartialPiece::BLOCK_SIZE * 2);
+  BOOST_CHECK_EQUAL(blockLength, 100);
+
+  BOOST_CHECK_EQUAL(piece.nextBlock(begin, blockLength), false);
+
+  // an aborted block is handed out again
+  piece.abortBlock(PartialPiece::BLOCK_SIZE);
+  BOOST_REQUIRE(piece.nextBlock(begin, blockLength));
+  BOOST_CHECK_EQUAL(begin, PartialPiece::BLOCK_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(Endgame)
+{
+  PartialPiece piece(0, PartialPiece::BLOCK_SIZE * 2);
+
+  uint32_t begin = 0;
+  uint32_t blockLength = 0;
+
+  // only outstanding blocks can be requested again
+  BOOST_CHECK_EQUAL(piece.requestAgain(0, begin, blockLength), false);
+  BOOST_REQUIRE(piece.nextBlock(begin, blockLength));
+  BOOST_REQUIRE(piece.requestAgain(0, begin, blockLength));
+  BOOST_CHECK_EQUAL(begin, 0);
+  BOOST_CHECK_EQUAL(blockLength, PartialPiece::BLOCK_SIZE);
+
+  // the block stays requested until both requests are aborted
+  piece.abortBlock(0);
+  BOOST_REQUIRE(piece.nextBlock(begin, blockLength));
+  BOOST_CHECK_EQUAL(begin, PartialPiece::BLOCK_SIZE);
+  piece.abortBlock(0);
+  BOOST_REQUIRE(piece.nextBlock(begin, blockLength));
+  BOOST_CHECK_EQUAL(begin, 0);
+
+  Buffer block(PartialPiece::BLOCK_SIZE);
+  BOOST_CHECK(piece.addBlock(0, block.buf(), block.size()));
+  BOOST_CHECK_EQUAL(piece.requestAgain(0, begin, blockLength), false);
+}
+
+BOOST_AUTO_TEST_CASE(Assemble)
+{
+  uint32_t length = PartialPiece::BLOCK_SIZE + 10;
+  PartialPiece piece(0, length);
+
+  Buffer first(PartialPiece::BLOCK_SIZE);
+  std::fill(first.begin(), first.end(), 1);
+  Buffer last(10);
+  std::fill(last.begin(), last.end(), 2);
+
+  // misaligned or wrongly sized blocks are refused
+  BOOST_CHECK_EQUAL(piece.addBlock(1, last.buf(), last.size()), false);
+  BOOST_CHECK_EQUAL(piece.addBlock(0, last.buf(), last.size()), false);
+
+  Buffer whole(first.begin(), first.end());
+  whole.insert(whole.end(), last.begin(), last.end());
+  ConstBufferPtr expected = util::sha1(make_shared<Buffer>(whole));
+
+  // blocks may arrive out of order, the early ones wait
+  BOOST_CHECK(piece.addBlock(PartialPiece::BLOCK_SIZE, last.buf(), last.size()));
+  BOOST_CHECK_EQUAL(piece.isComplete(), false);
+  BOOST_CHECK_EQUAL(piece.getNumBuffered(), 1);
+  BOOST_CHECK(!piece.getHash());
+  BOOST_CHECK_EQUAL(piece.addBlock(PartialPiece::BLOCK_SIZE, last.buf(), last.size()), false);
+  BOOST_CHECK(piece.addBlock(0, first.buf(), first.size()));
+  BOOST_CHECK(piece.isComplete());
+  BOOST_CHECK_EQUAL(piece.getNumBuffered(), 0);
+
+  BOOST_REQUIRE(piece.getHash());
+  BOOST_CHECK_EQUAL_COLLECTIONS(piece.getHash()->begin(), piece.getHash()->end(),
+                                expected->begin(), expected->end());
+  BOOST_CHECK_EQUAL(piece.getChecksum(), ResumeData::checksum(whole.buf(), whole.size()));
+
+  // in order blocks are not buffered, and the hash starts over
+  piece.reset();
+  BOOST_CHECK_EQUAL(piece.isComplete(), false);
+  BOOST_CHECK(!piece.getHash());
+  BOOST_CHECK(piece.addBlock(0, first.buf(), first.size()));
+  BOOST_CHECK_EQUAL(piece.getNumBuffered(), 0);
+  BOOST_CHECK(piece.addBlock(PartialPiece::BLOCK_SIZE, last.buf(), last.size()));
+  BOOST_REQUIRE(piece.getHash());
+  BOOST_CHECK_EQUAL_COLLECTIONS(piece.getHash()->begin(), piece.getHash()->end(),
+                                expected->begin(), expected->end());
+}
+
+BOOST_AUTO_TEST_CASE(HashOnWorkers)
+{
+  uint32_t length = PartialPiece::BLOCK_SIZE * 8;
+  PartialPiece piece(0, length);
+
+  Buffer whole(length);
+  for (size_t i = 0; i < whole.size(); i++)
+    whole[i] = i % 251;
+  ConstBufferPtr expected = util::sha1(make_shared<Buffer>(whole));
+
+  // the blocks are taken in on this thread, hashed in any order
+  for (uint32_t begin = 0; begin < length; begin += PartialPiece::BLOCK_SIZE)
+    BOOST_REQUIRE(piece.receiveBlock(begin, PartialPiece::BLOCK_SIZE));
+  BOOST_CHECK(piece.isComplete());
+  BOOST_CHECK_EQUAL(piece.receiveBlock(0, PartialPiece::BLOCK_SIZE), false);
+
+  // a dropped block is picked and received again
+  piece.dropBlock(0);
+  BOOST_CHECK_EQUAL(piece.isComplete(), false);
+  uint32_t begin = 0;
+  uint32_t blockLength = 0;
+  BOOST_REQUIRE(piece.nextBlock(begin, blockLength));
+  BOOST_CHECK_EQUAL(begin, 0);
+  BOOST_REQUIRE(piece.receiveBlock(0, PartialPiece::BLOCK_SIZE));
+  BOOST_CHECK(piece.isComplete());
+
+  std::atomic<int> numHashed(0);
+  {
+    WorkerPool pool(4);
+    for (uint32_t begin = length; begin > 0; begin -= PartialPiece::BLOCK_SIZE) {
+      uint32_t blockBegin = begin - PartialPiece::BLOCK_SIZE;
+      pool.post([&piece, &whole, &numHashed, blockBegin] {
+        if (piece.hashBlock(blockBegin, whole.buf() + blockBegin, PartialPiece::BLOCK_SIZE))
+          numHashed++;
+      });
+    }
+  }
+
+  // only the block completing the hash reports it
+  BOOST_CHECK_EQUAL(numHashed, 1);
+  BOOST_CHECK_EQUAL(piece.getNumBuffered(), 0);
+  BOOST_REQUIRE(piece.getHash());
+  BOOST_CHECK_EQUAL_COLLECTIONS(piece.getHash()->begin(), piece.getHash()->end(),
+                                expected->begin(), expected->end());
+  BOOST_CHECK_EQUAL(piece.getChecksum(), ResumeData::checksum(whole.buf(), whole.size()));
+
+  BOOST_CHECK_EQUAL(piece.hasWriteError(), false);
+  piece.setWriteError();
+  BOOST_CHECK(piece.hasWriteError());
+  piece.reset();
+  BOOST_CHECK_EQUAL(piece.hasWriteError(), false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
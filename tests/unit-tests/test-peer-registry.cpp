@@ -0,0 +1,121 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "peer-registry.hpp"
+#include "peer.hpp"
+
+#include "boost-test.hpp"
+
+namespace sbt {
+namespace test {
+
+static shared_ptr<Peer>
+makePeer(const std::string& ip, uint16_t port)
+{
+  return make_shared<Peer>("", ip, port);
+}
+
+BOOST_AUTO_TEST_SUITE(TestPeerRegistry)
+
+BOOST_AUTO_TEST_CASE(Endpoints)
+{
+  PeerRegistry peers;
+  BOOST_CHECK(peers.empty());
+
+  // the same port on different hosts are different peers
+  shared_ptr<Peer> first = makePeer("10.0.0.1", 6881);
+  shared_ptr<Peer> second = makePeer("10.0.0.2", 6881);
+  BOOST_CHECK(peers.insert("10.0.0.1", 6881, first));
+  BOOST_CHECK(peers.insert("10.0.0.2", 6881, second));
+  BOOST_CHECK_EQUAL(peers.size(), 2);
+
+  BOOST_CHECK_EQUAL(peers.find("10.0.0.1", 6881), first);
+  BOOST_CHECK_EQUAL(peers.find("10.0.0.2", 6881), second);
+  BOOST_CHECK(!peers.contains("10.0.0.1", 6882));
+  BOOST_CHECK(!peers.contains("10.0.0.3", 6881));
+
+  // an endpoint is only taken once, and must be an address
+  BOOST_CHECK_EQUAL(peers.insert("10.0.0.1", 6881, makePeer("10.0.0.1", 6881)), false);
+  BOOST_CHECK_EQUAL(peers.insert("tracker.example", 6881, makePeer("", 6881)), false);
+  BOOST_CHECK_EQUAL(peers.find("10.0.0.1", 6881), first);
+  BOOST_CHECK_EQUAL(peers.size(), 2);
+
+  BOOST_CHECK(peers.erase("10.0.0.1", 6881));
+  BOOST_CHECK_EQUAL(peers.erase("10.0.0.1", 6881), false);
+  BOOST_CHECK(!peers.contains("10.0.0.1", 6881));
+  BOOST_CHECK_EQUAL(peers.find("10.0.0.2", 6881), second);
+  BOOST_CHECK_EQUAL(peers.size(), 1);
+
+  // the iteration skips the free slot
+  size_t numPeers = 0;
+  for (auto& peer : peers) {
+    BOOST_CHECK_EQUAL(peer, second);
+    numPeers++;
+  }
+  BOOST_CHECK_EQUAL(numPeers, 1);
+
+  BOOST_CHECK(peers.insert("10.0.0.1", 6881, first));
+  BOOST_CHECK_EQUAL(peers.find("10.0.0.1", 6881), first);
+}
+
+BOOST_AUTO_TEST_CASE(Many)
+{
+  PeerRegistry peers;
+  BOOST_REQUIRE(peers.insert("192.168.0.1", 1, makePeer("192.168.0.1", 1)));
+  shared_ptr<Peer>& slot = *peers.begin();
+  Peer* peer = slot.get();
+
+  // tens of thousands of peers, few hosts with many ports each
+  for (int host = 0; host < 8; host++) {
+    std::string ip = "10.0.0." + std::to_string(host);
+    for (uint16_t port = 1; port <= 5000; port++)
+      BOOST_REQUIRE(peers.insert(ip, port, makePeer(ip, port)));
+  }
+  BOOST_CHECK_EQUAL(peers.size(), 40001);
+
+  // the slots don't move while the peers are added
+  BOOST_CHECK_EQUAL(slot.get(), peer);
+  BOOST_CHECK_EQUAL(peers.find("192.168.0.1", 1).get(), peer);
+
+  // half of them go, and come back into the freed slots
+  for (uint16_t port = 1; port <= 5000; port += 2) {
+    for (int host = 0; host < 8; host++)
+      BOOST_REQUIRE(peers.erase("10.0.0." + std::to_string(host), port));
+  }
+  BOOST_CHECK_EQUAL(peers.size(), 20001);
+
+  for (uint16_t port = 1; port <= 5000; port++) {
+    bool isErased = port % 2 == 1;
+    BOOST_REQUIRE_EQUAL(peers.contains("10.0.0.7", port), !isErased);
+    if (isErased)
+      BOOST_REQUIRE(peers.insert("10.0.0.7", port, makePeer("10.0.0.7", port)));
+  }
+  BOOST_CHECK_EQUAL(peers.size(), 22501);
+
+  size_t numPeers = 0;
+  for (auto it = peers.begin(); it != peers.end(); ++it)
+    numPeers++;
+  BOOST_CHECK_EQUAL(numPeers, peers.size());
+  BOOST_CHECK_EQUAL(slot.get(), peer);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
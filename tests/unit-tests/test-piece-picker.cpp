@@ -0,0 +1,186 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "piece-picker.hpp"
+
+#include "boost-test.hpp"
+
+namespace sbt {
+namespace test {
+
+static Bitfield
+makeBitfield(std::initializer_list<bool> pieces)
+{
+  Bitfield bitfield(pieces.size());
+
+  size_t i = 0;
+  for (bool piece : pieces) {
+    if (piece)
+      bitfield.set(i);
+    i++;
+  }
+
+  return bitfield;
+}
+
+BOOST_AUTO_TEST_SUITE(TestPiecePicker)
+
+BOOST_AUTO_TEST_CASE(RarestFirst)
+{
+  PiecePicker picker;
+  picker.reset(4);
+  picker.setRandomPieces(0);
+
+  // piece 2 is the only one held by a single peer
+  Bitfield all = makeBitfield({true, true, true, true});
+  Bitfield some = makeBitfield({true, true, false, true});
+  picker.addPeer(all);
+  picker.addPeer(some);
+
+  BOOST_CHECK_EQUAL(picker.getAvailability(0), 2);
+  BOOST_CHECK_EQUAL(picker.getAvailability(2), 1);
+
+  BOOST_CHECK_EQUAL(picker.pick(all), 2);
+  BOOST_CHECK(picker.isClaimed(2));
+
+  // a claimed piece is not picked twice
+  BOOST_CHECK(picker.pick(all) != 2);
+
+  // the second peer has none of the pieces left
+  Bitfield only2 = makeBitfield({false, false, true, false});
+  BOOST_CHECK_EQUAL(picker.pick(only2), -1);
+
+  picker.release(2);
+  BOOST_CHECK_EQUAL(picker.pick(only2), 2);
+
+  picker.setHave(2);
+  BOOST_CHECK_EQUAL(picker.getNumHave(), 1);
+  picker.release(2);
+  BOOST_CHECK_EQUAL(picker.pick(only2), -1);
+}
+
+BOOST_AUTO_TEST_CASE(Availability)
+{
+  PiecePicker picker;
+  picker.reset(3);
+  picker.setRandomPieces(0);
+
+  Bitfield first = makeBitfield({true, true, false});
+  Bitfield second = makeBitfield({false, true, true});
+  picker.addPeer(first);
+  picker.addPeer(second);
+  picker.incrementAvailability(2);
+
+  // piece 0 is now the rarest
+  BOOST_CHECK_EQUAL(picker.pick(first), 0);
+
+  picker.removePeer(first);
+  BOOST_CHECK_EQUAL(picker.getAvailability(0), 0);
+  BOOST_CHECK_EQUAL(picker.getAvailability(1), 1);
+  BOOST_CHECK_EQUAL(picker.getAvailability(2), 2);
+
+  // nobody connected has piece 0
+  BOOST_CHECK_EQUAL(picker.pick(makeBitfield({true, false, false})), -1);
+
+  BOOST_CHECK_EQUAL(picker.pick(second), 1);
+  BOOST_CHECK_EQUAL(picker.pick(second), 2);
+  BOOST_CHECK_EQUAL(picker.pick(second), -1);
+}
+
+BOOST_AUTO_TEST_CASE(Endgame)
+{
+  PiecePicker picker;
+  picker.reset(2);
+  picker.setRandomPieces(0);
+
+  Bitfield all = makeBitfield({true, true});
+  picker.addPeer(all);
+
+  BOOST_CHECK_EQUAL(picker.isEndgame(), false);
+  picker.setHave(picker.pick(all));
+  BOOST_CHECK_EQUAL(picker.isEndgame(), false);
+
+  // the last missing piece is being downloaded
+  int index = picker.pick(all);
+  BOOST_CHECK(picker.isEndgame());
+
+  picker.release(index);
+  BOOST_CHECK_EQUAL(picker.isEndgame(), false);
+
+  picker.pick(all);
+  picker.setHave(index);
+  BOOST_CHECK_EQUAL(picker.isEndgame(), false);
+}
+
+BOOST_AUTO_TEST_CASE(WorkReleased)
+{
+  PiecePicker picker;
+  picker.reset(3);
+  picker.setRandomPieces(0);
+
+  Bitfield all = makeBitfield({true, true, true});
+  picker.addPeer(all);
+  BOOST_CHECK_EQUAL(picker.takeWorkReleased(), false);
+
+  int index = picker.pick(all);
+  BOOST_CHECK_EQUAL(picker.takeWorkReleased(), false);
+
+  // a piece given back
+  picker.release(index);
+  BOOST_CHECK(picker.takeWorkReleased());
+  BOOST_CHECK_EQUAL(picker.takeWorkReleased(), false);
+
+  // the start of the endgame
+  picker.pick(all);
+  picker.pick(all);
+  BOOST_CHECK_EQUAL(picker.takeWorkReleased(), false);
+  picker.pick(all);
+  BOOST_CHECK(picker.isEndgame());
+  BOOST_CHECK(picker.takeWorkReleased());
+}
+
+BOOST_AUTO_TEST_CASE(Checking)
+{
+  PiecePicker picker;
+  picker.reset(2);
+  picker.setRandomPieces(0);
+
+  Bitfield all = makeBitfield({true, true});
+  picker.addPeer(all);
+
+  // pieces being checked are not picked, nor count for endgame
+  picker.setChecking(0);
+  BOOST_CHECK_EQUAL(picker.pick(all), 1);
+  BOOST_CHECK_EQUAL(picker.pick(all), -1);
+  BOOST_CHECK_EQUAL(picker.isEndgame(), false);
+
+  picker.release(0);
+  BOOST_CHECK_EQUAL(picker.pick(all), 0);
+  BOOST_CHECK(picker.isEndgame());
+
+  picker.setHave(0);
+  picker.setHave(1);
+  BOOST_CHECK_EQUAL(picker.getNumHave(), 2);
+  BOOST_CHECK_EQUAL(picker.isEndgame(), false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
@@ -0,0 +1,101 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "piece-table.hpp"
+#include "worker-pool.hpp"
+
+#include "boost-test.hpp"
+
+namespace sbt {
+namespace test {
+
+BOOST_AUTO_TEST_SUITE(TestPieceTable)
+
+BOOST_AUTO_TEST_CASE(Transitions)
+{
+  PieceTable table;
+  table.reset(3);
+
+  BOOST_CHECK_EQUAL(table.getState(0), PieceTable::PIECE_MISSING);
+  BOOST_CHECK(table.claim(0));
+  BOOST_CHECK_EQUAL(table.claim(0), false);
+  BOOST_CHECK_EQUAL(table.getNumClaimed(), 1);
+
+  BOOST_CHECK(table.setChecking(1));
+  BOOST_CHECK_EQUAL(table.claim(1), false);
+  BOOST_CHECK(table.release(1));
+  BOOST_CHECK_EQUAL(table.release(1), false);
+
+  BOOST_CHECK(table.setVerified(0));
+  BOOST_CHECK_EQUAL(table.setVerified(0), false);
+  BOOST_CHECK_EQUAL(table.getNumClaimed(), 0);
+  BOOST_CHECK_EQUAL(table.getNumVerified(), 1);
+  BOOST_CHECK_EQUAL(table.release(0), false);
+
+  // piece 1 and 2 are left
+  BOOST_CHECK(table.claim(1));
+  BOOST_CHECK_EQUAL(table.isEndgame(), false);
+  BOOST_CHECK(table.claim(2));
+  BOOST_CHECK(table.isEndgame());
+
+  table.setVerified(1);
+  table.setVerified(2);
+  BOOST_CHECK(table.isComplete());
+  BOOST_CHECK_EQUAL(table.isEndgame(), false);
+
+  BOOST_CHECK_THROW(table.claim(3), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentClaims)
+{
+  const size_t numPieces = 1000;
+  PieceTable table;
+  table.reset(numPieces);
+
+  // every thread tries to claim every piece, each piece is
+  // claimed exactly once
+  std::vector<std::vector<size_t>> claimed(4);
+  {
+    WorkerPool pool(4);
+    for (auto& pieces : claimed) {
+      pool.post([&table, &pieces, numPieces] {
+        for (size_t i = 0; i < numPieces; i++) {
+          if (table.claim(i)) {
+            pieces.push_back(i);
+            table.setVerified(i);
+          }
+        }
+      });
+    }
+  }
+
+  size_t total = 0;
+  for (const auto& pieces : claimed)
+    total += pieces.size();
+
+  BOOST_CHECK_EQUAL(total, numPieces);
+  BOOST_CHECK_EQUAL(table.getNumVerified(), numPieces);
+  BOOST_CHECK_EQUAL(table.getNumClaimed(), 0);
+  BOOST_CHECK(table.isComplete());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
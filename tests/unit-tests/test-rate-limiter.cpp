@@ -0,0 +1,105 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rate-limiter.hpp"
+
+#include "boost-test.hpp"
+
+#include <vector>
+
+namespace sbt {
+namespace test {
+
+BOOST_AUTO_TEST_SUITE(TestRateLimiter)
+
+BOOST_AUTO_TEST_CASE(Bucket)
+{
+  using std::chrono::milliseconds;
+
+  TokenBucket unlimited;
+  BOOST_CHECK_EQUAL(unlimited.isLimited(), false);
+  unlimited.consume(1000000);
+  BOOST_CHECK(unlimited.hasTokens());
+
+  TokenBucket bucket(1000);
+  TokenBucket::Clock::time_point start = TokenBucket::Clock::now();
+  BOOST_CHECK(bucket.hasTokens(start));
+
+  // a transfer larger than the tokens left goes into debt
+  bucket.consume(1500, start);
+  BOOST_CHECK_EQUAL(bucket.hasTokens(start + milliseconds(250)), false);
+  BOOST_CHECK(bucket.hasTokens(start + milliseconds(600)));
+
+  // the debt is paid off after the wait time
+  bucket.consume(1000, start + milliseconds(600));
+  TokenBucket::Clock::duration wait = bucket.getWaitTime(start + milliseconds(600));
+  BOOST_CHECK(wait > milliseconds(899) && wait < milliseconds(901));
+  BOOST_CHECK_EQUAL(bucket.hasTokens(start + milliseconds(600) + wait - milliseconds(1)), false);
+  BOOST_CHECK(bucket.hasTokens(start + milliseconds(600) + wait));
+  BOOST_CHECK(bucket.getWaitTime(start + milliseconds(600) + wait) == TokenBucket::Clock::duration::zero());
+
+  // no more than a second worth of tokens is saved up
+  bucket.consume(1000, start + milliseconds(10000));
+  BOOST_CHECK_EQUAL(bucket.hasTokens(start + milliseconds(10000)), false);
+
+  bucket.setRate(0, start + milliseconds(10000));
+  BOOST_CHECK(bucket.hasTokens(start + milliseconds(10000)));
+}
+
+BOOST_AUTO_TEST_CASE(RoundRobin)
+{
+  RateLimiter limiter(1000);
+  std::vector<char> granted;
+
+  BOOST_CHECK(limiter.request(1500, [] {}));
+
+  // the bucket is in debt, both have to wait
+  BOOST_CHECK_EQUAL(limiter.request(1000, [&] {
+        granted.push_back('a');
+        // more to send, behind b
+        limiter.request(1000, [&] { granted.push_back('A'); });
+      }), false);
+  BOOST_CHECK_EQUAL(limiter.request(1000, [&] { granted.push_back('b'); }), false);
+  BOOST_CHECK_EQUAL(limiter.getNumWaiting(), 2);
+
+  limiter.tick();
+  BOOST_CHECK(granted.empty());
+
+  // enough tokens for one of them
+  usleep(600000);
+  limiter.tick();
+  BOOST_REQUIRE_EQUAL(granted.size(), 1);
+  BOOST_CHECK_EQUAL(granted[0], 'a');
+  BOOST_CHECK_EQUAL(limiter.getNumWaiting(), 2);
+
+  // without a limit the waiting ones go through in order
+  limiter.setRate(0);
+  BOOST_CHECK_EQUAL(limiter.request(1000, [] {}), false);
+  limiter.tick();
+  BOOST_REQUIRE_EQUAL(granted.size(), 3);
+  BOOST_CHECK_EQUAL(granted[1], 'b');
+  BOOST_CHECK_EQUAL(granted[2], 'A');
+  BOOST_CHECK_EQUAL(limiter.getNumWaiting(), 0);
+  BOOST_CHECK(limiter.request(1000, [] {}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
@@ -0,0 +1,100 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resume-data.hpp"
+#include "util/buffer-stream.hpp"
+
+#include "boost-test.hpp"
+
+#include <fstream>
+
+namespace sbt {
+namespace test {
+
+BOOST_AUTO_TEST_SUITE(TestResumeData)
+
+BOOST_AUTO_TEST_CASE(EncodeDecode)
+{
+  ConstBufferPtr infoHash = make_shared<Buffer>(20);
+
+  ResumeData data;
+  data.reset(infoHash, 10);
+  data.setFileInfo(12345, 1400000000123456789LL);
+  data.setPiece(0, 0xdeadbeef);
+  data.setPiece(9, 1);
+  BOOST_CHECK(data.isDirty());
+
+  OBufferStream os;
+  data.wireEncode(os);
+
+  ResumeData decoded;
+  std::istringstream is(std::string(os.buf()->begin(), os.buf()->end()));
+  decoded.wireDecode(is);
+
+  BOOST_CHECK(equal(decoded.getInfoHash(), infoHash));
+  BOOST_CHECK_EQUAL(decoded.getNumPieces(), 10);
+  BOOST_CHECK_EQUAL(decoded.getLength(), 12345);
+  BOOST_CHECK_EQUAL(decoded.getMtime(), 1400000000123456789LL);
+  BOOST_CHECK(decoded.hasPiece(0));
+  BOOST_CHECK_EQUAL(decoded.hasPiece(1), false);
+  BOOST_CHECK(decoded.hasPiece(9));
+  BOOST_CHECK_EQUAL(decoded.getChecksum(0), 0xdeadbeef);
+  BOOST_CHECK_EQUAL(decoded.getChecksum(1), 0);
+  BOOST_CHECK_EQUAL(decoded.isDirty(), false);
+}
+
+BOOST_AUTO_TEST_CASE(Checksum)
+{
+  // the standard CRC-32 check value
+  std::string check("123456789");
+  BOOST_CHECK_EQUAL(ResumeData::checksum(reinterpret_cast<const uint8_t*>(check.data()),
+                                         check.size()),
+                    0xcbf43926);
+}
+
+BOOST_AUTO_TEST_CASE(SaveLoad)
+{
+  const std::string path("resume-data.tmp");
+
+  ResumeData data;
+  data.reset(make_shared<Buffer>(20), 3);
+  data.setPiece(1, 42);
+  BOOST_REQUIRE(data.save(path));
+  BOOST_CHECK_EQUAL(data.isDirty(), false);
+
+  ResumeData loaded;
+  BOOST_REQUIRE(loaded.load(path));
+  BOOST_CHECK(loaded.hasPiece(1));
+  BOOST_CHECK_EQUAL(loaded.getChecksum(1), 42);
+
+  // a torn or foreign file is not trusted
+  {
+    std::ofstream os(path, std::ios::trunc);
+    os << "d6:lengthi3ee";
+  }
+  BOOST_CHECK_EQUAL(loaded.load(path), false);
+
+  unlink(path.c_str());
+  BOOST_CHECK_EQUAL(loaded.load(path), false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
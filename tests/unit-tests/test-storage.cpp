@@ -0,0 +1,102 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "storage.hpp"
+
+#include "boost-test.hpp"
+
+namespace sbt {
+namespace test {
+
+BOOST_AUTO_TEST_SUITE(TestStorage)
+
+static void
+checkReadWrite(Storage& storage)
+{
+  const uint8_t data[] = {1, 2, 3, 4};
+  uint8_t buf[4] = {0};
+
+  BOOST_CHECK(storage.write(6, data, sizeof(data)));
+  BOOST_CHECK(storage.read(6, buf, sizeof(buf)));
+  BOOST_CHECK_EQUAL_COLLECTIONS(buf, buf + 4, data, data + 4);
+
+  // out of bounds accesses are refused
+  BOOST_CHECK_EQUAL(storage.write(7, data, sizeof(data)), false);
+  BOOST_CHECK_EQUAL(storage.read(11, buf, 0), false);
+}
+
+BOOST_AUTO_TEST_CASE(Mmap)
+{
+  const std::string path("storage-mmap.tmp");
+  unlink(path.c_str());
+
+  {
+    MmapStorage storage(path, 10);
+    BOOST_CHECK_EQUAL(storage.hasExistingData(), false);
+    BOOST_CHECK_EQUAL(storage.getLength(), 10);
+    checkReadWrite(storage);
+  }
+
+  // the data is there when the file is opened again
+  {
+    MmapStorage storage(path, 10);
+    BOOST_CHECK(storage.hasExistingData());
+
+    uint8_t buf[2] = {0};
+    BOOST_CHECK(storage.read(6, buf, sizeof(buf)));
+    BOOST_CHECK_EQUAL(buf[0], 1);
+    BOOST_CHECK_EQUAL(buf[1], 2);
+  }
+
+  // a file of the wrong length is started over
+  {
+    MmapStorage storage(path, 12);
+    BOOST_CHECK_EQUAL(storage.hasExistingData(), false);
+
+    uint8_t buf[1] = {1};
+    BOOST_CHECK(storage.read(6, buf, sizeof(buf)));
+    BOOST_CHECK_EQUAL(buf[0], 0);
+  }
+
+  unlink(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(File)
+{
+  const std::string path("storage-file.tmp");
+  unlink(path.c_str());
+
+  {
+    FileStorage storage(path, 10);
+    BOOST_CHECK_EQUAL(storage.hasExistingData(), false);
+    checkReadWrite(storage);
+  }
+
+  {
+    shared_ptr<Storage> storage = Storage::open(path, 10);
+    BOOST_CHECK(storage->hasExistingData());
+  }
+
+  unlink(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
@@ -0,0 +1,134 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timer-wheel.hpp"
+
+#include "boost-test.hpp"
+
+namespace sbt {
+namespace test {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+BOOST_AUTO_TEST_SUITE(TestTimerWheel)
+
+BOOST_AUTO_TEST_CASE(Schedule)
+{
+  TimerWheel::Clock::time_point now = TimerWheel::Clock::now();
+  TimerWheel wheel(now);
+  BOOST_CHECK_EQUAL(wheel.getTimeout(now), -1);
+
+  std::vector<int> order;
+  wheel.schedule(milliseconds(30), [&] { order.push_back(30); }, now);
+  wheel.schedule(milliseconds(10), [&] { order.push_back(10); }, now);
+  TimerWheel::TimerId id = wheel.schedule(milliseconds(20), [&] { order.push_back(20); }, now);
+  BOOST_CHECK(id != 0);
+  BOOST_CHECK_EQUAL(wheel.size(), 3);
+  BOOST_CHECK_EQUAL(wheel.getTimeout(now), 11);
+
+  // nothing is due before its time
+  BOOST_CHECK_EQUAL(wheel.advance(now + milliseconds(9)), 0);
+  BOOST_CHECK_EQUAL(wheel.advance(now + milliseconds(10)), 1);
+  BOOST_CHECK_EQUAL(order.size(), 1);
+
+  BOOST_CHECK(wheel.cancel(id));
+  BOOST_CHECK_EQUAL(wheel.cancel(id), false);
+  BOOST_CHECK_EQUAL(wheel.advance(now + milliseconds(100)), 1);
+  BOOST_CHECK_EQUAL(wheel.size(), 0);
+
+  std::vector<int> expected = {10, 30};
+  BOOST_CHECK_EQUAL_COLLECTIONS(order.begin(), order.end(), expected.begin(), expected.end());
+
+  // a timer that ran can't be cancelled, nor the one that took its node
+  TimerWheel::TimerId first = wheel.schedule(milliseconds(10), [] {}, now);
+  wheel.advance(now + milliseconds(200));
+  TimerWheel::TimerId second = wheel.schedule(milliseconds(10), [] {}, now);
+  BOOST_CHECK_EQUAL(wheel.cancel(first), false);
+  BOOST_CHECK(wheel.cancel(second));
+}
+
+BOOST_AUTO_TEST_CASE(Levels)
+{
+  TimerWheel::Clock::time_point now = TimerWheel::Clock::now();
+  TimerWheel wheel(now);
+
+  // from the first level to the last one, a keep-alive and an
+  // hour long tracker interval among them
+  std::vector<milliseconds> delays = {milliseconds(500), seconds(7), seconds(120),
+                                      seconds(3600), seconds(100000)};
+  std::vector<TimerWheel::Clock::time_point> ran(delays.size());
+  for (size_t i = 0; i < delays.size(); i++) {
+    TimerWheel::Clock::time_point* time = &ran[i];
+    wheel.schedule(delays[i], [&now, time] { *time = now; }, now);
+  }
+
+  // the loop sleeps until there is something to do
+  TimerWheel::Clock::time_point start = now;
+  size_t numWakeups = 0;
+  while (wheel.size() > 0) {
+    int timeout = wheel.getTimeout(now);
+    BOOST_REQUIRE(timeout >= 0);
+    now += milliseconds(timeout);
+    wheel.advance(now);
+    numWakeups++;
+  }
+  BOOST_CHECK_LT(numWakeups, 100);
+
+  for (size_t i = 0; i < delays.size(); i++) {
+    BOOST_CHECK(ran[i] >= start + delays[i]);
+    BOOST_CHECK(ran[i] <= start + delays[i] + milliseconds(20));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Callbacks)
+{
+  TimerWheel::Clock::time_point now = TimerWheel::Clock::now();
+  TimerWheel wheel(now);
+
+  // a periodic timer reschedules itself, and cancels another one
+  // that is due at the same time
+  int numRuns = 0;
+  TimerWheel::TimerId other = 0;
+  function<void()> periodic = [&] {
+    numRuns++;
+    wheel.cancel(other);
+    wheel.schedule(seconds(1), periodic, now);
+  };
+  wheel.schedule(seconds(1), periodic, now);
+  other = wheel.schedule(seconds(1), [] { BOOST_FAIL("cancelled timer ran"); }, now);
+
+  for (int i = 0; i < 5; i++) {
+    now += seconds(1);
+    wheel.advance(now);
+  }
+  BOOST_CHECK_EQUAL(numRuns, 5);
+  BOOST_CHECK_EQUAL(wheel.size(), 1);
+
+  // after a long sleep, everything due runs at once
+  for (int i = 0; i < 1000; i++)
+    wheel.schedule(milliseconds(i * 37), [&] { numRuns++; }, now);
+  now += seconds(60);
+  BOOST_CHECK_EQUAL(wheel.advance(now), 1001);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt
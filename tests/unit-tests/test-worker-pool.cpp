@@ -0,0 +1,160 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2014,  Regents of the University of California
+ *
+ * This file is part of Simple BT.
+ * See AUTHORS.md for complete list of Simple BT authors and contributors.
+ *
+ * NSL is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * NSL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * NSL, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "worker-pool.hpp"
+#include "event-loop.hpp"
+
+#include "boost-test.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <unistd.h>
+
+namespace sbt {
+namespace test {
+
+BOOST_AUTO_TEST_SUITE(TestWorkerPool)
+
+BOOST_AUTO_TEST_CASE(PostToLoop)
+{
+  EventLoop loop;
+  std::vector<int> results;
+
+  {
+    WorkerPool pool(4);
+    BOOST_CHECK_EQUAL(pool.getNumThreads(), 4);
+
+    // the results are collected on the loop thread only
+    for (int i = 0; i < 100; i++) {
+      pool.post([&loop, &results, i] {
+        int square = i * i;
+        loop.post([&results, square] { results.push_back(square); });
+      });
+    }
+
+    for (int n = 0; n < 100 && results.size() < 100; n++)
+      loop.runOnce(100);
+  }
+
+  BOOST_REQUIRE_EQUAL(results.size(), 100);
+  std::sort(results.begin(), results.end());
+  BOOST_CHECK_EQUAL(results[0], 0);
+  BOOST_CHECK_EQUAL(results[99], 99 * 99);
+}
+
+BOOST_AUTO_TEST_CASE(DrainOnDestruction)
+{
+  int count = 0;
+  pthread_mutex_t lock;
+  pthread_mutex_init(&lock, NULL);
+
+  {
+    WorkerPool pool(2);
+    for (int i = 0; i < 50; i++) {
+      pool.post([&] {
+        pthread_mutex_lock(&lock);
+        count++;
+        pthread_mutex_unlock(&lock);
+      });
+    }
+  }
+
+  BOOST_CHECK_EQUAL(count, 50);
+  pthread_mutex_destroy(&lock);
+}
+
+BOOST_AUTO_TEST_CASE(Bounded)
+{
+  std::atomic<bool> isStarted(false);
+  std::atomic<bool> isReleased(false);
+  std::atomic<int> numPosted(0);
+  std::atomic<int> count(0);
+
+  {
+    WorkerPool pool(1, 2);
+    BOOST_CHECK_EQUAL(pool.getMaxTasks(), 2);
+
+    // keep the only thread busy
+    pool.post([&] {
+      isStarted = true;
+      while (!isReleased)
+        usleep(1000);
+      count++;
+    });
+    while (!isStarted)
+      usleep(1000);
+
+    // the third task does not fit until the thread is released
+    WorkerPool producer(1);
+    producer.post([&] {
+      for (int i = 0; i < 3; i++) {
+        pool.post([&] { count++; });
+        numPosted++;
+      }
+    });
+
+    usleep(50000);
+    BOOST_CHECK_EQUAL(numPosted, 2);
+
+    isReleased = true;
+  }
+
+  BOOST_CHECK_EQUAL(numPosted, 3);
+  BOOST_CHECK_EQUAL(count, 4);
+}
+
+BOOST_AUTO_TEST_CASE(TryPost)
+{
+  std::atomic<bool> isStarted(false);
+  std::atomic<bool> isReleased(false);
+  std::atomic<int> numReady(0);
+  std::atomic<int> count(0);
+
+  {
+    WorkerPool pool(1, 2);
+    pool.setReadyCallback([&] { numReady++; });
+
+    pool.post([&] {
+      isStarted = true;
+      while (!isReleased)
+        usleep(1000);
+    });
+    while (!isStarted)
+      usleep(1000);
+
+    // nothing waits for room, and only those that were told the
+    // queue is full are called back
+    BOOST_CHECK_EQUAL(pool.isFull(), false);
+    BOOST_CHECK(pool.tryPost([&] { count++; }));
+    BOOST_CHECK(pool.tryPost([&] { count++; }));
+    BOOST_CHECK(pool.isFull());
+    BOOST_CHECK_EQUAL(pool.tryPost([&] { count++; }), false);
+    BOOST_CHECK_EQUAL(numReady, 0);
+
+    isReleased = true;
+  }
+
+  BOOST_CHECK_EQUAL(count, 2);
+  BOOST_CHECK_EQUAL(numReady, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace test
+} // namespace sbt